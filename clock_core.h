@@ -0,0 +1,378 @@
+// Clock and timezone arithmetic shared by the network and display tasks.
+// Plain C++ on purpose: nothing here touches Arduino, ESP-IDF or global
+// state, so it also compiles on a desktop host for simulation.
+#pragma once
+
+#include <ctype.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+const int64_t CLOCK_MAX_SLEW_PPM = 500;
+const int64_t NTP_PHI_PPM = 15;            // dispersion growth with age (NTP's PHI)
+const int NTP_SELECT_MAX = 8;              // candidates ntpSelect() considers
+const int TZ_TABLE_SIZE = 6;  // transitions precomputed around the current year
+
+// -----------------------------------------------
+// Clock
+// -----------------------------------------------
+// Disciplined local timebase: UTC as a function of the monotonic clock
+struct ClockState {
+  int64_t utc_base_us;
+  int64_t mono_base_us;
+  int64_t freq_ppb;       // estimated oscillator error, corrected continuously
+  int64_t slew_total_us;  // correction being slewed in since mono_base_us
+};
+
+// Portion of slew_total_us applied after elapsed_us at the maximum slew rate
+inline int64_t slewApplied(const ClockState& clock, int64_t elapsed_us) {
+  if (elapsed_us <= 0) return 0;
+  int64_t limit = elapsed_us * CLOCK_MAX_SLEW_PPM / 1000000;
+  if (clock.slew_total_us > limit) return limit;
+  if (clock.slew_total_us < -limit) return -limit;
+  return clock.slew_total_us;
+}
+
+// Pure function of the state, so the display task can run it on a snapshot
+inline int64_t clockUtcAt(const ClockState& clock, int64_t mono_us) {
+  int64_t elapsed = mono_us - clock.mono_base_us;
+  return clock.utc_base_us + elapsed + elapsed * clock.freq_ppb / 1000000000 + slewApplied(clock, elapsed);
+}
+
+// Inverse of clockUtcAt() near guess_mono_us. The rate differs from one
+// by at most ~0.1%, so two correction steps converge to the microsecond.
+inline int64_t clockMonoAt(const ClockState& clock, int64_t utc_us, int64_t guess_mono_us) {
+  int64_t mono = guess_mono_us + (utc_us - clockUtcAt(clock, guess_mono_us));
+  return mono + (utc_us - clockUtcAt(clock, mono));
+}
+
+// Days since 1970-01-01 for a proleptic Gregorian date
+inline long daysFromCivil(int y, int m, int d) {
+  y -= m <= 2;
+  long era = (y >= 0 ? y : y - 399) / 400;
+  long yoe = y - era * 400;
+  long doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 719468;
+}
+
+// -----------------------------------------------
+// NTP Filter and Selection
+// -----------------------------------------------
+// NTP's clock filter and an intersection-style clock select over plain
+// sample arrays, so recorded traces can be replayed off-device.
+
+struct NtpSample {
+  int64_t offset_us;    // server minus local clock
+  uint32_t delay_us;    // round trip
+  uint32_t distance_us; // delay/2 plus the server's root delay/2 and dispersion
+  int64_t mono_us;      // local time of arrival
+};
+
+// Distance grown by PHI for the time since the sample arrived
+inline int64_t ntpSampleDistance(const NtpSample& sample, int64_t now_mono_us) {
+  int64_t age = now_mono_us > sample.mono_us ? now_mono_us - sample.mono_us : 0;
+  return sample.distance_us + age * NTP_PHI_PPM / 1000000;
+}
+
+// Index of the register entry to use: the lowest delay once each is aged
+// by PHI, so a stale sample gives way to a fresh one of similar delay
+// instead of carrying drift it did not see into the next correction
+inline int ntpFilter(const NtpSample* samples, int count, int64_t now_mono_us) {
+  int best = -1;
+  int64_t best_key = 0;
+  for (int i = 0; i < count; i++) {
+    int64_t age = now_mono_us > samples[i].mono_us ? now_mono_us - samples[i].mono_us : 0;
+    int64_t key = samples[i].delay_us / 2 + age * NTP_PHI_PPM / 1000000;
+    if (best < 0 || key < best_key || (key == best_key && samples[i].mono_us > samples[best].mono_us)) {
+      best = i;
+      best_key = key;
+    }
+  }
+  return best;
+}
+
+// Intersection-style selection in the spirit of NTP's clock-select:
+// find the smallest number of falsetickers for which a majority of the
+// correctness intervals [offset - distance, offset + distance] overlap,
+// then pick the survivor with the lowest distance. Returns the index
+// into candidates, or -1 when no majority agrees.
+inline int ntpSelect(const NtpSample* candidates, int count, int64_t now_mono_us, int& survivors) {
+  int64_t edge[2 * NTP_SELECT_MAX];
+  int8_t type[2 * NTP_SELECT_MAX];
+  int64_t distance[NTP_SELECT_MAX];
+  int n = count < NTP_SELECT_MAX ? count : NTP_SELECT_MAX;
+  survivors = 0;
+  if (n <= 0) return -1;
+  for (int k = 0; k < n; k++) {
+    distance[k] = ntpSampleDistance(candidates[k], now_mono_us);
+    edge[2 * k] = candidates[k].offset_us - distance[k];
+    type[2 * k] = -1;
+    edge[2 * k + 1] = candidates[k].offset_us + distance[k];
+    type[2 * k + 1] = 1;
+  }
+
+  // Insertion sort of the interval endpoints
+  for (int i = 1; i < 2 * n; i++) {
+    int64_t e = edge[i];
+    int8_t t = type[i];
+    int j = i - 1;
+    for (; j >= 0 && edge[j] > e; j--) {
+      edge[j + 1] = edge[j];
+      type[j + 1] = type[j];
+    }
+    edge[j + 1] = e;
+    type[j + 1] = t;
+  }
+
+  int64_t low = 0, high = -1;
+  for (int falsetickers = 0; 2 * falsetickers < n; falsetickers++) {
+    int depth = 0;
+    for (int i = 0; i < 2 * n; i++) {
+      depth -= type[i];
+      if (depth >= n - falsetickers) { low = edge[i]; break; }
+    }
+    depth = 0;
+    for (int i = 2 * n - 1; i >= 0; i--) {
+      depth += type[i];
+      if (depth >= n - falsetickers) { high = edge[i]; break; }
+    }
+    if (low <= high) break;
+  }
+  if (low > high) return -1;
+
+  int best = -1;
+  for (int k = 0; k < n; k++) {
+    if (candidates[k].offset_us + distance[k] < low || candidates[k].offset_us - distance[k] > high) continue;
+    survivors++;
+    if (best < 0 || distance[k] < distance[best]) best = k;
+  }
+  return best;
+}
+
+// -----------------------------------------------
+// Timezone Rules
+// -----------------------------------------------
+// POSIX TZ strings ("EST5EDT,M3.2.0,M11.1.0", "IST-5:30",
+// "<-04>4<-03>,M9.1.6/24,M4.1.6/24"). The transitions around the current
+// year are computed once into a small table; between them a conversion is
+// one range check plus an add.
+
+struct TzRuleDate {
+  char kind;       // 'M' month.week.weekday, 'J' Julian 1-365 without Feb 29, 'D' zero-based day of year
+  int16_t month;
+  int16_t week;    // 1-5, 5 = last
+  int16_t day;     // weekday 0-6 (Sunday = 0) for 'M', day of year otherwise
+  int32_t time;    // seconds after local midnight, may be negative or past 24h
+};
+
+struct TzRule {
+  char std_abbr[12];
+  char dst_abbr[12];
+  int32_t std_offset;  // seconds east of UTC
+  int32_t dst_offset;
+  bool has_dst;
+  TzRuleDate start;    // standard -> daylight
+  TzRuleDate end;      // daylight -> standard
+};
+
+// Interval over which a zone's current offset is valid; each reader keeps its own
+struct TzWindow {
+  time_t from;
+  time_t until;  // empty interval forces a rebuild
+  int32_t offset;
+  bool dst;
+};
+
+inline bool parseTzName(const char*& p, char* out, size_t size) {
+  size_t n = 0;
+  if (*p == '<') {
+    p++;
+    while (*p && *p != '>') {
+      if (n < size - 1) out[n++] = *p;
+      p++;
+    }
+    if (*p != '>') return false;
+    p++;
+  } else {
+    while (isalpha((unsigned char)*p)) {
+      if (n < size - 1) out[n++] = *p;
+      p++;
+    }
+  }
+  out[n] = '\0';
+  return n >= 3;
+}
+
+// [+|-]hh[:mm[:ss]] in seconds
+inline bool parseTzTime(const char*& p, int32_t& seconds) {
+  int sign = 1;
+  if (*p == '+' || *p == '-') sign = (*p++ == '-') ? -1 : 1;
+  if (!isdigit((unsigned char)*p)) return false;
+  int32_t value = 0;
+  for (int field = 0; field < 3; field++) {
+    int32_t part = 0;
+    while (isdigit((unsigned char)*p)) part = part * 10 + (*p++ - '0');
+    value += part * (field == 0 ? 3600 : field == 1 ? 60 : 1);
+    if (*p != ':' || field == 2) break;
+    p++;
+  }
+  seconds = sign * value;
+  return true;
+}
+
+inline int parseTzNumber(const char*& p) {
+  int value = 0;
+  while (isdigit((unsigned char)*p)) value = value * 10 + (*p++ - '0');
+  return value;
+}
+
+inline bool parseTzDate(const char*& p, TzRuleDate& date) {
+  if (*p == 'M') {
+    p++;
+    date.kind = 'M';
+    date.month = parseTzNumber(p);
+    if (*p++ != '.') return false;
+    date.week = parseTzNumber(p);
+    if (*p++ != '.') return false;
+    date.day = parseTzNumber(p);
+    if (date.month < 1 || date.month > 12 || date.week < 1 || date.week > 5 || date.day > 6) return false;
+  } else if (*p == 'J') {
+    p++;
+    date.kind = 'J';
+    date.day = parseTzNumber(p);
+    if (date.day < 1 || date.day > 365) return false;
+  } else if (isdigit((unsigned char)*p)) {
+    date.kind = 'D';
+    date.day = parseTzNumber(p);
+    if (date.day > 365) return false;
+  } else {
+    return false;
+  }
+  date.time = 7200;  // default 02:00
+  if (*p == '/') {
+    p++;
+    if (!parseTzTime(p, date.time)) return false;
+  }
+  return true;
+}
+
+inline bool parsePosixTz(const char* posix, TzRule& rule) {
+  const char* p = posix;
+  int32_t offset;
+  if (!parseTzName(p, rule.std_abbr, sizeof(rule.std_abbr))) return false;
+  if (!parseTzTime(p, offset)) return false;
+  rule.std_offset = -offset;  // POSIX offsets are west of UTC
+  rule.dst_offset = rule.std_offset;
+  rule.has_dst = false;
+  strcpy(rule.dst_abbr, rule.std_abbr);
+  if (*p == '\0') return true;
+
+  if (!parseTzName(p, rule.dst_abbr, sizeof(rule.dst_abbr))) return false;
+  rule.has_dst = true;
+  rule.dst_offset = rule.std_offset + 3600;
+  if (*p && *p != ',') {
+    if (!parseTzTime(p, offset)) return false;
+    rule.dst_offset = -offset;
+  }
+  if (*p == '\0') {
+    p = ",M3.2.0,M11.1.0";  // no rule given: US default
+  }
+  if (*p++ != ',' || !parseTzDate(p, rule.start)) return false;
+  if (*p++ != ',' || !parseTzDate(p, rule.end)) return false;
+  return *p == '\0';
+}
+
+inline bool isLeapYear(int year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+// UTC instant of a rule date in the given year; the rule time is local
+// wall-clock time in the offset in effect before the transition
+inline time_t tzTransitionUtc(int year, const TzRuleDate& date, int32_t offset_before) {
+  long days;
+  if (date.kind == 'M') {
+    long first = daysFromCivil(year, date.month, 1);
+    int weekday = (first + 4) % 7;  // 1970-01-01 was a Thursday
+    int mday = 1 + (date.day - weekday + 7) % 7 + (date.week - 1) * 7;
+    long month_days = (date.month == 12 ? daysFromCivil(year + 1, 1, 1) : daysFromCivil(year, date.month + 1, 1)) - first;
+    while (mday > month_days) mday -= 7;  // week 5 = last
+    days = first + mday - 1;
+  } else if (date.kind == 'J') {
+    days = daysFromCivil(year, 1, 1) + date.day - 1 + (isLeapYear(year) && date.day >= 60 ? 1 : 0);
+  } else {
+    days = daysFromCivil(year, 1, 1) + date.day;
+  }
+  return (time_t)days * 86400 + date.time - offset_before;
+}
+
+// Precomputes the transitions of the years around utc and caches the
+// interval containing it
+inline void rebuildTzWindow(const TzRule& rule, TzWindow& window, time_t utc) {
+  struct tm t;
+  gmtime_r(&utc, &t);
+  int year = t.tm_year + 1900;
+
+  time_t at[TZ_TABLE_SIZE];
+  bool dst_after[TZ_TABLE_SIZE];
+  int n = 0;
+  for (int y = year - 1; y <= year + 1; y++) {
+    time_t transitions[2] = {tzTransitionUtc(y, rule.start, rule.std_offset),
+                             tzTransitionUtc(y, rule.end, rule.dst_offset)};
+    for (int k = 0; k < 2; k++) {
+      int i = n++;
+      for (; i > 0 && at[i - 1] > transitions[k]; i--) {
+        at[i] = at[i - 1];
+        dst_after[i] = dst_after[i - 1];
+      }
+      at[i] = transitions[k];
+      dst_after[i] = (k == 0);
+    }
+  }
+
+  int k = 0;
+  while (k + 1 < n && at[k + 1] <= utc) k++;
+  window.dst = dst_after[k];
+  window.offset = window.dst ? rule.dst_offset : rule.std_offset;
+  window.from = at[k];
+  window.until = at[k + 1];
+}
+
+inline int32_t tzOffset(const TzRule& rule, TzWindow& window, time_t utc) {
+  if (!rule.has_dst) return rule.std_offset;
+  if (utc < window.from || utc >= window.until) rebuildTzWindow(rule, window, utc);
+  return window.offset;
+}
+
+// -----------------------------------------------
+// Sun
+// -----------------------------------------------
+// NOAA's low-precision solar equations, good to a minute or two at
+// non-polar latitudes. Latitude is north positive, longitude east positive.
+
+enum SunDay { SUN_NORMAL, SUN_ALWAYS_UP, SUN_ALWAYS_DOWN };
+
+// Sunrise and sunset as UTC instants for the date whose days-since-epoch
+// is given; rise may fall on the previous UTC day west of Greenwich
+inline SunDay sunTimesUtc(long days, double latitude, double longitude, time_t& rise, time_t& set) {
+  time_t noon = (time_t)days * 86400 + 43200;
+  struct tm t;
+  gmtime_r(&noon, &t);
+  double gamma = 2 * M_PI / 365 * t.tm_yday;  // fractional year at noon
+  double eqtime = 229.18 * (0.000075 + 0.001868 * cos(gamma) - 0.032077 * sin(gamma) -
+                            0.014615 * cos(2 * gamma) - 0.040849 * sin(2 * gamma));
+  double decl = 0.006918 - 0.399912 * cos(gamma) + 0.070257 * sin(gamma) - 0.006758 * cos(2 * gamma) +
+                0.000907 * sin(2 * gamma) - 0.002697 * cos(3 * gamma) + 0.00148 * sin(3 * gamma);
+  double lat = latitude * M_PI / 180;
+  // Zenith 90.833 degrees: refraction plus the sun's radius
+  double cos_ha = cos(90.833 * M_PI / 180) / (cos(lat) * cos(decl)) - tan(lat) * tan(decl);
+  if (cos_ha < -1) return SUN_ALWAYS_UP;
+  if (cos_ha > 1) return SUN_ALWAYS_DOWN;
+  double ha = acos(cos_ha) * 180 / M_PI;
+  double midnight = (double)days * 86400;
+  rise = (time_t)(midnight + (720 - 4 * (longitude + ha) - eqtime) * 60);
+  set = (time_t)(midnight + (720 - 4 * (longitude - ha) - eqtime) * 60);
+  return SUN_NORMAL;
+}
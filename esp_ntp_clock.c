@@ -1,14 +1,26 @@
 #include <WiFi.h>
-#include <WebServer.h>
-#include <DNSServer.h>
 #include <Preferences.h>
 #include <ESPmDNS.h>
 #include <NetworkUdp.h>
 #include <ArduinoOTA.h>
 #include <TM1640.h>
 #include <WiFiUdp.h>
-#include "NTP.h"
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+#include <freertos/semphr.h>
+#include <lwip/dns.h>
+#include <lwip/tcpip.h>
+#include <lwip/sockets.h>
+#include <mbedtls/md.h>
+#include <errno.h>
 #include <math.h>
+#include <atomic>
+#include <functional>
+#include <new>
+#include <time.h>
+#include <sys/time.h>
+#include "clock_core.h"
+#include "static_assets.h"
 
 // -----------------------------------------------
 // Hardware Configuration
@@ -17,500 +29,3704 @@ const int PIN_DIO = 12;
 const int PIN_CLOCK = 13;
 const int PIN_power = 14;
 const int PIN_STB = 7;
-const uint32_t updateinterval_Msec = 600000;
-int display_brightness = 7;  // 0-7, configurable via web GUI
+const uint8_t minpoll_Log2sec = 6;     // poll interval adapts between 64 s ...
+const uint8_t maxpoll_Log2sec = 11;    // ... and 2048 s
+const uint32_t retryinterval_Msec = 30000;
+const uint32_t displayinterval_Msec = 500;
+const uint32_t loopidle_Msec = 10;     // longest sleep per network pass (HTTP/OTA latency)
+const uint32_t wificonnecttimeout_Msec = 15000;  // fall back to AP mode if never connected
+const uint32_t wifiminbackoff_Msec = 4000;       // reconnect attempts back off from here ...
+const uint32_t wifimaxbackoff_Msec = 60000;      // ... up to this
+const uint32_t wifijointimeout_Msec = 20000;     // a join with no result by then is abandoned
+int display_brightness = 7;  // 0-7, configurable via web GUI (daytime level when dimming)
+const int PIN_LIGHT = 4;                 // optional light sensor (ADC1), higher reading = brighter
+const int LIGHT_SENSOR_DARK = 200;       // raw readings mapped to night ...
+const int LIGHT_SENSOR_BRIGHT = 3000;    // ... and day brightness
+const long BRIGHTNESS_RAMP_SEC = 3600;   // dimming ramps over this span around sunrise/sunset
+const int NIGHT_START_MIN = 22 * 60;     // night hours when no location is set
+const int NIGHT_END_MIN = 7 * 60;
+const uint32_t BRIGHTNESS_PREVIEW_MSEC = 10000;  // slider value overrides the schedule this long
+
+// Display refresh runs on the application core at a higher priority than
+// the web server, NTP and OTA, which share the protocol core with Wi-Fi.
+// Single-core chips (ESP32-S2, -C3, -C6) have only core 0; the display
+// task shares it and still comes first by priority.
+const BaseType_t DISPLAY_TASK_CORE = portNUM_PROCESSORS > 1 ? 1 : 0;
+const UBaseType_t DISPLAY_TASK_PRIORITY = 3;
+const uint32_t DISPLAY_TASK_STACK = 4096;
+const BaseType_t NETWORK_TASK_CORE = 0;
+const UBaseType_t NETWORK_TASK_PRIORITY = 1;
+const uint32_t NETWORK_TASK_STACK = 8192;
+const UBaseType_t WEB_TASK_PRIORITY = 1;  // a slow HTTP client no longer holds up NTP or OTA
+const uint32_t WEB_TASK_STACK = 8192;
+const UBaseType_t NTP_SERVER_TASK_PRIORITY = 2;  // above the network loop so receive stamps are prompt
+const uint32_t NTP_SERVER_TASK_STACK = 3072;
+const UBaseType_t CAPTIVE_DNS_TASK_PRIORITY = 2;  // portal lookups are answered while a scan or page runs
+const uint32_t CAPTIVE_DNS_TASK_STACK = 3072;
+const uint32_t DISPLAY_EVENT_TICK = 0x01;      // task notification bits
+const uint32_t DISPLAY_EVENT_SETTINGS = 0x02;
+const int DISPLAY_TICK_BUCKETS = 7;  // tick error histogram, upper bounds in us
+const uint32_t DISPLAY_TICK_BUCKET_US[DISPLAY_TICK_BUCKETS] = {100, 250, 500, 1000, 2000, 5000, 10000};
 
 // -----------------------------------------------
 // AP Mode Configuration
 // -----------------------------------------------
 const char* AP_SSID = "NTP-Clock-Setup";
 const char* AP_PASS = "clocksetup";
-const byte DNS_PORT = 53;
+const uint16_t DNS_PORT = 53;
+const int DNS_PACKET_MAX = 512;
+const uint32_t DNS_TTL_SEC = 60;
+const uint32_t DNS_PROBE_TTL_SEC = 1;  // probe answers must not outlive setup mode
+// Hosts phones and PCs query to detect a captive portal
+const char* const CAPTIVE_PROBE_HOSTS[] = {
+  "connectivitycheck.gstatic.com", "connectivitycheck.android.com", "clients3.google.com",
+  "captive.apple.com", "www.apple.com", "www.msftconnecttest.com", "www.msftncsi.com",
+  "detectportal.firefox.com", "nmcheck.gnome.org",
+};
+// ... and the paths they then fetch, redirected to the portal
+const char* const CAPTIVE_PROBE_PATHS[] = {
+  "/generate_204", "/gen_204", "/hotspot-detect.html", "/library/test/success.html",
+  "/connecttest.txt", "/ncsi.txt", "/redirect", "/success.txt", "/canonical.html",
+};
+const int SCAN_TABLE_SLOTS = 32;            // power of two; unique SSIDs kept per scan
+const uint32_t SCAN_REFRESH_MSEC = 60000;   // background rescan period
+
+// -----------------------------------------------
+// Settings Storage Configuration
+// -----------------------------------------------
+const uint16_t CONFIG_VERSION = 4;             // bump when fields are appended to ConfigRecord
+const uint32_t CONFIG_SAVE_DELAY_MSEC = 5000;  // changes are written once they settle
+
+// -----------------------------------------------
+// Web Server Configuration
+// -----------------------------------------------
+const uint16_t HTTP_PORT = 80;
+const int HTTP_MAX_CONNECTIONS = 4;               // kept-alive browsers and event streams together
+const int HTTP_MAX_ROUTES = 32;
+const size_t HTTP_REQUEST_MAX = 2048;             // request line, headers and form body
+const size_t HTTP_HEAD_MAX = 640;                 // response status line and headers
+const size_t HTTP_BODY_MAX = 2048;                // response bytes buffered per connection; longer
+                                                  // responses go out chunked as the buffer fills
+const size_t HTTP_SEND_SLICE = 1460;              // bytes per connection per pass, one TCP segment
+const uint32_t HTTP_REQUEST_TIMEOUT_MSEC = 5000;  // a started request must be complete by then
+const uint32_t HTTP_IDLE_TIMEOUT_MSEC = 15000;    // kept-alive connections close after this idle
+const uint32_t HTTP_SEND_TIMEOUT_MSEC = 10000;    // a client taking no data for this long is dropped
+const uint32_t HTTP_RESTART_DELAY_MSEC = 2000;    // save and reset pages go out before the restart
+
+// -----------------------------------------------
+// Status API Configuration
+// -----------------------------------------------
+const size_t API_BUFFER_SIZE = 4096;  // fixed render buffer for JSON/metrics
+const int SSE_MAX_CLIENTS = 2;
+const int HANDLER_STATS_MAX = 16;      // instrumented routes
+const uint32_t HANDLER_SAMPLES = 100;  // recent calls kept per route for percentiles
+const bool TELEMETRY_ENABLED = true;   // false compiles the event log and scoped timers out
+const uint32_t TELEMETRY_EVENTS = 256; // power of two; most recent events kept
+const int64_t TELEMETRY_SLOW_US = 20000;       // scoped timers log sections slower than this
+const uint32_t TELEMETRY_TICK_LATE_US = 2000;  // display ticks further off than this are logged
+const uint32_t TELEMETRY_HEAP_STEP = 1024;     // heap low-water drops logged in steps of this
+
+// -----------------------------------------------
+// NTP Client Configuration
+// -----------------------------------------------
+const uint16_t NTP_PORT = 123;
+const uint16_t NTP_LOCAL_PORT = 2390;
+const uint32_t NTP_TIMEOUT_MSEC = 1500;    // reply deadline per request
+const uint32_t NTP_DNS_TIMEOUT_MSEC = 5000;
+const int NTP_PACKET_SIZE = 48;
+const int NTP_MAX_SERVERS = 4;             // comma-separated entries in ntp_server (at most NTP_SELECT_MAX)
+const int NTP_FILTER_SIZE = 8;             // samples kept per server for the clock filter
+const uint32_t NTP_MIN_DISPERSION_US = 1000;
+const uint32_t NTP_MAX_DISPERSION_US = 16000000;  // MAXDISP: a root distance past this is unsynchronized
+const int64_t CLOCK_STEP_THRESHOLD_US = 128000;  // larger corrections step instead of slewing
+const int64_t CLOCK_MAX_FREQ_PPB = 500000;
+const int64_t POLL_STABLE_US = 5000;    // offsets below this lengthen the poll interval
+const int64_t POLL_UNSTABLE_US = 25000; // offsets above this shorten it
+const int64_t NTP_UNIX_OFFSET = 2208988800LL;  // seconds from 1900 to 1970
+const int8_t NTP_SERVER_PRECISION = -20;          // log2 seconds, about 1 us
+const int64_t NTP_SERVER_MAX_AGE_US = 86400 * 1000000LL;  // unsynchronized after a day without a sync
+const uint32_t CLOCK_PERSIST_MAGIC = 0x4e545043;  // "NTPC"
+const int64_t CLOCK_RESTORE_MAX_AGE_US = 7 * 86400 * 1000000LL;  // older saved syncs are not trusted
+
+// -----------------------------------------------
+// Time Beacon Configuration
+// -----------------------------------------------
+const IPAddress BEACON_GROUP(239, 255, 78, 84);  // site-local multicast
+const uint16_t BEACON_PORT = 12390;
+const uint32_t BEACON_MAGIC = 0x4e544342;        // "NTCB"
+const uint8_t BEACON_VERSION = 1;
+const int BEACON_BODY_SIZE = 24;                 // signed part of the packet
+const int BEACON_MAC_SIZE = 8;                   // truncated HMAC-SHA256
+const int BEACON_PACKET_SIZE = BEACON_BODY_SIZE + BEACON_MAC_SIZE;
+const int BEACON_FIRST_WINDOW = 8;     // beacons before the first correction ...
+const int BEACON_WINDOW = 64;          // ... and between later ones
+const uint32_t BEACON_TIMEOUT_MSEC = 10000;  // followers fall back to NTP after this long without one
+const int64_t BEACON_MAX_OFFSET_US = CLOCK_STEP_THRESHOLD_US;  // farther from the verified clock is rejected
 
 // -----------------------------------------------
 // Timezone definitions
 // -----------------------------------------------
+// Rules are POSIX TZ strings; a custom string from the settings page
+// overrides the selection. Keep existing entries in place: the saved
+// setting is an index into this table.
 struct TimezoneInfo {
   const char* name;
-  const char* dstAbbrev;
-  const char* stdAbbrev;
-  int dstOffset;  // minutes from UTC
-  int stdOffset;  // minutes from UTC
+  const char* posix;
 };
 
 TimezoneInfo timezones[] = {
-  {"Eastern",  "EDT", "EST", -240, -300},
-  {"Central",  "CDT", "CST", -300, -360},
-  {"Mountain", "MDT", "MST", -360, -420},
-  {"Pacific",  "PDT", "PST", -420, -480},
-  {"Alaska",   "AKDT", "AKST", -480, -540},
-  {"Hawaii",   "HST", "HST", -600, -600},  // No DST
-  {"Arizona",  "MST", "MST", -420, -420},  // No DST
-  {"UTC",      "UTC", "UTC", 0, 0}
+  {"Eastern",          "EST5EDT,M3.2.0,M11.1.0"},
+  {"Central",          "CST6CDT,M3.2.0,M11.1.0"},
+  {"Mountain",         "MST7MDT,M3.2.0,M11.1.0"},
+  {"Pacific",          "PST8PDT,M3.2.0,M11.1.0"},
+  {"Alaska",           "AKST9AKDT,M3.2.0,M11.1.0"},
+  {"Hawaii",           "HST10"},  // No DST
+  {"Arizona",          "MST7"},   // No DST
+  {"UTC",              "UTC0"},
+  {"Newfoundland",     "NST3:30NDT,M3.2.0,M11.1.0"},
+  {"Atlantic",         "AST4ADT,M3.2.0,M11.1.0"},
+  {"Brazil (Sao Paulo)", "<-03>3"},
+  {"UK / Ireland",     "GMT0BST,M3.5.0/1,M10.5.0"},
+  {"Central Europe",   "CET-1CEST,M3.5.0,M10.5.0/3"},
+  {"Eastern Europe",   "EET-2EEST,M3.5.0/3,M10.5.0/4"},
+  {"Moscow",           "MSK-3"},
+  {"India",            "IST-5:30"},
+  {"Nepal",            "<+0545>-5:45"},
+  {"China / Singapore", "CST-8"},
+  {"Japan / Korea",    "JST-9"},
+  {"Adelaide",         "ACST-9:30ACDT,M10.1.0,M4.1.0/3"},
+  {"Brisbane",         "AEST-10"},
+  {"Sydney / Melbourne", "AEST-10AEDT,M10.1.0,M4.1.0/3"},
+  {"New Zealand",      "NZST-12NZDT,M9.5.0,M4.1.0/3"},
+  {"Chile",            "<-04>4<-03>,M9.1.6/24,M4.1.6/24"}
 };
 const int NUM_TIMEZONES = sizeof(timezones) / sizeof(timezones[0]);
 
 // -----------------------------------------------
-// Global Objects
+// Display Driver
+// -----------------------------------------------
+const int DISPLAY_GRIDS = 6;  // 4 digits + AM/PM/alarm indicator grids
+const int DISPLAY_DIGITS = 4;
+
+// Segment bits within a grid byte
+const uint8_t SEG_A = 0x01;  // top, then clockwise
+const uint8_t SEG_B = 0x02;
+const uint8_t SEG_C = 0x04;
+const uint8_t SEG_D = 0x08;
+const uint8_t SEG_E = 0x10;
+const uint8_t SEG_F = 0x20;
+const uint8_t SEG_G = 0x40;  // middle
+const uint8_t SEG_DOT = 0x80;
+
+// Layout: the colon is the dots of the two middle digits; the indicator
+// grids use one segment as the AM/PM lamp and another as the sync alarm
+const int GRID_HOUR_TENS = 0;
+const int GRID_HOUR_ONES = 1;
+const int GRID_MINUTE_TENS = 2;
+const int GRID_MINUTE_ONES = 3;
+const int GRID_AM = 4;
+const int GRID_PM = 5;
+const uint8_t LAMP_AMPM = SEG_B;
+const uint8_t LAMP_ALARM = SEG_C;
+
+// Indicator grids by [pm][synced]: {AM grid, PM grid}
+constexpr uint8_t INDICATOR_GRIDS[2][2][2] = {
+  {{LAMP_AMPM | LAMP_ALARM, 0}, {LAMP_AMPM, 0}},
+  {{0, LAMP_AMPM | LAMP_ALARM}, {0, LAMP_AMPM}},
+};
+
+// Seven-segment shapes for ASCII, built at compile time. Characters a
+// seven-segment digit cannot show render blank.
+struct GlyphTable {
+  uint8_t segments[128];
+
+  static constexpr uint8_t shape(char c) {
+    switch (c) {
+      case '0': case 'O': return SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F;
+      case '1': case 'I': return SEG_B | SEG_C;
+      case '2': case 'Z': return SEG_A | SEG_B | SEG_D | SEG_E | SEG_G;
+      case '3': return SEG_A | SEG_B | SEG_C | SEG_D | SEG_G;
+      case '4': return SEG_B | SEG_C | SEG_F | SEG_G;
+      case '5': case 'S': return SEG_A | SEG_C | SEG_D | SEG_F | SEG_G;
+      case '6': return SEG_A | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G;
+      case '7': return SEG_A | SEG_B | SEG_C;
+      case '8': return SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G;
+      case '9': return SEG_A | SEG_B | SEG_C | SEG_D | SEG_F | SEG_G;
+      case 'A': return SEG_A | SEG_B | SEG_C | SEG_E | SEG_F | SEG_G;
+      case 'b': case 'B': return SEG_C | SEG_D | SEG_E | SEG_F | SEG_G;
+      case 'C': return SEG_A | SEG_D | SEG_E | SEG_F;
+      case 'c': return SEG_D | SEG_E | SEG_G;
+      case 'd': case 'D': return SEG_B | SEG_C | SEG_D | SEG_E | SEG_G;
+      case 'E': return SEG_A | SEG_D | SEG_E | SEG_F | SEG_G;
+      case 'F': return SEG_A | SEG_E | SEG_F | SEG_G;
+      case 'G': return SEG_A | SEG_C | SEG_D | SEG_E | SEG_F;
+      case 'H': return SEG_B | SEG_C | SEG_E | SEG_F | SEG_G;
+      case 'h': return SEG_C | SEG_E | SEG_F | SEG_G;
+      case 'i': return SEG_C;
+      case 'J': return SEG_B | SEG_C | SEG_D | SEG_E;
+      case 'L': return SEG_D | SEG_E | SEG_F;
+      case 'N': return SEG_A | SEG_B | SEG_C | SEG_E | SEG_F;
+      case 'n': return SEG_C | SEG_E | SEG_G;
+      case 'o': return SEG_C | SEG_D | SEG_E | SEG_G;
+      case 'P': return SEG_A | SEG_B | SEG_E | SEG_F | SEG_G;
+      case 'q': return SEG_A | SEG_B | SEG_C | SEG_F | SEG_G;
+      case 'r': case 'R': return SEG_E | SEG_G;
+      case 't': case 'T': return SEG_D | SEG_E | SEG_F | SEG_G;
+      case 'U': return SEG_B | SEG_C | SEG_D | SEG_E | SEG_F;
+      case 'u': return SEG_C | SEG_D | SEG_E;
+      case 'y': case 'Y': return SEG_B | SEG_C | SEG_D | SEG_F | SEG_G;
+      case '-': return SEG_G;
+      case '_': return SEG_D;
+      case '=': return SEG_D | SEG_G;
+      case '\'': return SEG_F;
+      case '?': return SEG_A | SEG_B | SEG_E | SEG_G;
+      default: return 0;
+    }
+  }
+
+  constexpr GlyphTable() : segments() {
+    for (int c = 0; c < 128; c++) segments[c] = shape((char)c);
+  }
+};
+
+constexpr GlyphTable GLYPHS;
+
+// Both digits of each two-grid time field, so a frame is two lookups
+struct TimeGlyphTable {
+  uint8_t hour12[13][2];   // 1-12, blank leading zero
+  uint8_t minute[60][2];
+
+  constexpr TimeGlyphTable() : hour12(), minute() {
+    for (int h = 1; h <= 12; h++) {
+      hour12[h][0] = h < 10 ? 0 : GlyphTable::shape('0' + h / 10);
+      hour12[h][1] = GlyphTable::shape('0' + h % 10);
+    }
+    for (int m = 0; m < 60; m++) {
+      minute[m][0] = GlyphTable::shape('0' + m / 10);
+      minute[m][1] = GlyphTable::shape('0' + m % 10);
+    }
+  }
+};
+
+constexpr TimeGlyphTable TIME_GLYPHS;
+
+// TM1640 with bus transaction counting and auto-increment burst writes
+class TM1640Burst : public TM1640 {
+ public:
+  TM1640Burst(byte dataPin, byte clockPin, byte numDigits) : TM1640(dataPin, clockPin, numDigits) {}
+
+  // Writes count consecutive grids starting at first in one transfer. The
+  // chip keeps the data command, so auto-increment is only set again after
+  // another command (begin, a brightness change) may have replaced it.
+  void writeBurst(byte first, const uint8_t* data, byte count) {
+    if (!data_auto) sendCommand(TM16XX_CMD_DATA_AUTO);
+    start();
+    send(TM16XX_CMD_ADDRESS | first);
+    for (byte i = 0; i < count; i++) send(data[i]);
+    stop();
+    transactions++;
+  }
+
+  uint32_t transactions = 0;
+
+ protected:
+  void sendCommand(byte cmd) override {
+    TM1640::sendCommand(cmd);
+    transactions++;
+    data_auto = cmd == TM16XX_CMD_DATA_AUTO;
+  }
+  void sendData(byte address, byte data) override {
+    TM1640::sendData(address, data);
+    transactions++;
+  }
+
+ private:
+  bool data_auto = false;
+};
+
+// Shadow of the grid bytes; flush() only sends what changed since the
+// last flush, as a single burst spanning the dirty grids
+class DisplayFrame {
+ public:
+  DisplayFrame(TM1640Burst& driver) : driver(driver) {}
+
+  void load(const uint8_t* grids) { memcpy(frame, grids, DISPLAY_GRIDS); }
+
+  void flush() {
+    int first = 0, last = DISPLAY_GRIDS - 1;
+    if (sent_valid) {
+      while (first < DISPLAY_GRIDS && frame[first] == sent[first]) first++;
+      if (first == DISPLAY_GRIDS) return;
+      while (frame[last] == sent[last]) last--;
+    }
+    driver.writeBurst(first, frame + first, last - first + 1);
+    memcpy(sent + first, frame + first, last - first + 1);
+    sent_valid = true;
+  }
+
+ private:
+  TM1640Burst& driver;
+  uint8_t frame[DISPLAY_GRIDS] = {0};
+  uint8_t sent[DISPLAY_GRIDS] = {0};
+  bool sent_valid = false;
+};
+
+// -----------------------------------------------
+// HTTP Server
+// -----------------------------------------------
+// Serves the web interface from the web task over lwIP sockets. Handlers
+// only render: the response goes into the connection's fixed buffer while
+// the handler holds StateLock (see timedHandler()), and is sent afterwards,
+// HTTP_SEND_SLICE bytes per connection per pass in turn, so a slow client
+// holds neither the lock nor the other browsers. A response that outgrows
+// the buffer goes out chunked, one buffer at a time; the handler waits for
+// each chunk to be taken with StateLock released. Connections are kept
+// alive up to HTTP_MAX_CONNECTIONS; while a new client waits for a slot,
+// idle ones are closed and busy ones close after their current response.
+// Event streams are connections of the same pool that stay open.
+
+enum HttpMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_OPTIONS, HTTP_OTHER };
+typedef std::function<void(void)> HttpHandler;
+
+enum HttpConnectionState { HTTP_FREE, HTTP_READING, HTTP_SENDING, HTTP_STREAMING };
+
+// Room around the body for chunk framing: the size line before it, and
+// CRLF plus the last chunk after it
+const size_t HTTP_CHUNK_PREFIX = 8;
+const size_t HTTP_CHUNK_SUFFIX = 7;
+
+struct HttpConnection {
+  int fd = -1;
+  HttpConnectionState state = HTTP_FREE;
+  unsigned long active_at = 0;   // last bytes in or out, for the timeouts
+  unsigned long request_at = 0;  // first bytes of the pending request
+  uint32_t served = 0;           // responses completed on this connection
+  bool keep_alive = false;
+  char request[HTTP_REQUEST_MAX + 1];
+  size_t request_len = 0;
+  char head[HTTP_HEAD_MAX];
+  size_t head_len = 0;
+  size_t head_sent = 0;
+  bool chunked = false;           // the head went out before the body was complete
+  char body[HTTP_CHUNK_PREFIX + HTTP_BODY_MAX + HTTP_CHUNK_SUFFIX];
+  size_t body_len = 0;            // rendered into body + HTTP_CHUNK_PREFIX, not yet framed
+  size_t content_length = 0;      // body bytes of the current response so far
+  const char* out = NULL;         // framed bytes going out: in body, or a flash asset
+  size_t out_len = 0;
+  size_t out_sent = 0;
+};
+
+class HttpServer {
+ public:
+  explicit HttpServer(uint16_t port) : port(port) {}
+
+  void on(const char* uri, HttpHandler handler) { on(uri, HTTP_ANY, handler); }
+  void on(const char* uri, HttpMethod method, HttpHandler handler);
+  void onNotFound(HttpHandler handler) { not_found = handler; }
+  void clearRoutes();
+  bool begin();
+
+  // Waits up to wait_msec for socket activity; service() then gives
+  // every connection a turn
+  void wait(uint32_t wait_msec);
+  void service();
+
+  // The request being handled
+  HttpMethod method() const { return request_method; }
+  bool hasArg(const char* name) const;
+  String arg(const char* name) const;
+  String header(const char* name) const;
+
+  // Its response, rendered into the connection
+  void sendHeader(const char* name, const char* value);
+  void send(int code, const char* type = NULL, const char* content = "");
+  void send(int code, const char* type, const String& content) { send(code, type, content.c_str()); }
+  void send_P(int code, const char* type, const char* data, size_t length);
+  void sendContent(const char* data, size_t length);
+  void sendContent(const char* text) { sendContent(text, strlen(text)); }
+  void closeAfterResponse() { close_after = true; }
+  // Turns the connection into an event stream; false when SSE_MAX_CLIENTS are open
+  bool startEventStream(const char* first);
+
+  int eventStreams() const;
+  void pushEvent(const char* data, size_t length);
+
+ private:
+  struct HttpRoute {
+    const char* uri;
+    HttpMethod method;
+    HttpHandler handler;
+  };
+
+  void acceptPending();
+  bool receive(HttpConnection& c);
+  long requestLength(HttpConnection& c);
+  void dispatch(HttpConnection& c, size_t length);
+  void reject(HttpConnection& c, int code);
+  void endHead(HttpConnection& c);
+  void queueBody(HttpConnection& c, bool last);
+  bool flush(HttpConnection& c);
+  void finish(HttpConnection& c);
+  bool sendPending(HttpConnection& c);
+  void sendSlice(HttpConnection& c);
+  void responseSent(HttpConnection& c);
+  void expire(HttpConnection& c);
+  void drop(HttpConnection& c);
+  void appendHead(HttpConnection& c, const char* fmt, ...) __attribute__((format(printf, 3, 4)));
+
+  uint16_t port;
+  int listen_fd = -1;
+  bool pressure = false;  // a client is waiting for a free connection
+  int turn = 0;           // connection served first in the next pass
+  fd_set readable;
+  fd_set writable;
+  HttpConnection connections[HTTP_MAX_CONNECTIONS];
+  HttpRoute routes[HTTP_MAX_ROUTES];
+  int route_count = 0;
+  HttpHandler not_found;
+
+  // Request being handled, parsed in place in its connection's buffer
+  HttpConnection* current = NULL;
+  HttpMethod request_method = HTTP_OTHER;
+  const char* request_path = "";
+  const char* request_query = "";
+  const char* request_headers = "";
+  const char* request_form = "";
+  int response_code = 0;
+  bool responded = false;
+  bool flash_body = false;  // send_P(): the body is sent from flash in place
+  const char* flash_data = NULL;
+  bool aborted = false;     // the client stopped taking the response
+  bool close_after = false;
+  char pending_headers[HTTP_HEAD_MAX];  // sendHeader() lines until send()
+  size_t pending_len = 0;
+};
+
+// -----------------------------------------------
+// Global Objects
+// -----------------------------------------------
+WiFiUDP wifiUdp;
+TM1640Burst module(PIN_DIO, PIN_CLOCK, PIN_STB);
+DisplayFrame frame(module);
+HttpServer server(HTTP_PORT);
+Preferences preferences;
+
+// -----------------------------------------------
+// State Variables
+// -----------------------------------------------
+String wifi_ssid = "";
+String wifi_pass = "";
+String ntp_server = "pool.ntp.org";
+int timezone_index = 0;  // Default to Eastern
+String tz_custom = "";    // POSIX TZ string, overrides timezone_index when set
+bool wifi_connected = false;
+bool ap_mode = true;
+bool serve_ntp = false;   // answer NTP clients on UDP 123 from the disciplined clock
+uint8_t beacon_mode = 0;  // BeaconMode
+String beacon_key = "";   // shared secret that signs beacons
+
+// Settings as stored in NVS: one versioned record, rewritten only when it
+// differs from the copy already in flash. Only append fields, so records
+// from older versions still load.
+struct ConfigRecord {
+  uint32_t writes;  // lifetime count of record writes
+  uint16_t version;
+  int16_t timezone_index;
+  uint8_t brightness;
+  char ssid[33];
+  char pass[65];
+  char ntp_server[160];
+  char tz_posix[64];
+  // Version 2
+  uint8_t auto_brightness;
+  uint8_t night_brightness;
+  uint8_t light_sensor;
+  uint8_t has_location;
+  float latitude;
+  float longitude;
+  // Version 3
+  uint8_t serve_ntp;
+  // Version 4
+  uint8_t beacon_mode;
+  char beacon_key[33];
+};
+
+ConfigRecord config_stored;  // what flash currently holds
+bool config_dirty = false;
+unsigned long config_save_at = 0;
+uint32_t config_writes = 0;        // since boot
+uint32_t config_writes_today = 0;  // in the current 24 h of uptime
+unsigned long config_day_started = 0;
+
+// Brightness schedule; display_brightness is the daytime level
+bool auto_brightness = false;
+int night_brightness = 1;
+bool light_sensor = false;
+bool has_location = false;
+float latitude = 0;
+float longitude = 0;
+int effective_brightness = 7;  // level sent to the display
+unsigned long brightness_checked_at = 0;
+bool brightness_previewing = false;
+unsigned long brightness_preview_at = 0;
+long sun_day = -1;             // local day the sun times below are for
+SunDay sun_kind = SUN_NORMAL;
+time_t sun_rise = 0;
+time_t sun_set = 0;
+float light_level = -1;        // smoothed sensor reading, negative until sampled
+
+// WiFi connection manager
+volatile bool wifi_event_got_ip = false;
+volatile bool wifi_event_disconnected = false;
+bool wifi_ever_connected = false;
+bool network_services_started = false;
+unsigned long wifi_connect_started = 0;
+bool wifi_joining = false;      // WiFi.begin() called, no GOT_IP or DISCONNECTED yet
+unsigned long wifi_join_started = 0;
+unsigned long wifi_retry_at = 0;
+uint32_t wifi_backoff_msec = wifiminbackoff_Msec;
+uint32_t wifi_reconnects = 0;
+
+unsigned long lastExecutedMillis_2 = 0;
+bool last_update = false;
+
+// Disciplined local timebase, see clockUtcAt()
+ClockState clock_state = {0, 0, 0, 0};
+int64_t last_sync_mono_us = 0;
+uint8_t poll_log2sec = 9;
+uint8_t poll_stable_count = 0;
+bool time_valid = false;     // there is a time to display
+bool time_verified = false;  // an NTP sync has confirmed it since boot
+bool time_restored = false;  // the time was carried over from before a restart
+
+// Kept in RTC memory across software resets (OTA, restart, panic) but not
+// power loss. The wall clock itself survives in the RTC-backed system time
+// set by persistClock(); this adds the drift estimate and a sanity bound.
+struct PersistedClock {
+  uint32_t magic;
+  uint8_t poll_log2sec;
+  int64_t freq_ppb;
+  int64_t last_sync_utc_us;
+  uint32_t checksum;
+};
+
+RTC_NOINIT_ATTR PersistedClock persisted_clock;
+
+// Active timezone rule
+TzRule tz_rule;
+TzWindow tz_window = {0, 0, 0, false};
+uint32_t time_generation = 0;  // bumped whenever the clock or zone changes
+
+// NTP request state machine
+enum NtpState { NTP_IDLE, NTP_RESOLVING, NTP_WAITING };
+NtpState ntp_state = NTP_IDLE;
+bool ntp_force_update = false;
+unsigned long ntp_deadline = 0;
+
+struct NtpPeer {
+  char host[64];
+  IPAddress ip;
+  bool resolved;
+  bool polled;          // request sent this round
+  bool replied;         // reply received this round
+  uint8_t reach;        // shift register of the last 8 rounds
+  uint8_t stratum;
+  uint32_t root_delay_us;  // as reported by the server, for our own replies
+  uint32_t root_disp_us;
+  uint8_t sent_stamp[8];
+  int64_t sent_mono_us;
+  NtpSample samples[NTP_FILTER_SIZE];
+  uint8_t sample_count;
+  uint8_t sample_next;
+  NtpSample filtered;   // register entry picked by ntpFilter()
+};
+
+NtpPeer ntp_peers[NTP_MAX_SERVERS];
+int ntp_peer_count = 0;
+int ntp_resolve_index = -1;
+int ntp_selected_peer = -1;
+int ntp_survivor_count = 0;
+int64_t last_offset_us = 0;
+uint8_t ntp_ref_stratum = 0;       // upstream reference at the last sync, 0 before the first
+uint8_t ntp_ref_id[4] = {0, 0, 0, 0};
+uint32_t ntp_ref_root_delay_us = 0;
+uint32_t ntp_ref_root_disp_us = 0;
+volatile uint32_t ntp_dns_generation = 0;
+volatile int8_t ntp_dns_result = 0;  // 0 = pending, 1 = resolved, -1 = failed
+char ntp_dns_host[64];
+volatile uint32_t ntp_dns_addr = 0;
+
+// LAN time beacons: a leader multicasts its clock once a second and
+// followers phase-lock to it instead of polling NTP
+enum BeaconMode { BEACON_OFF, BEACON_LEAD, BEACON_FOLLOW };
+WiFiUDP beaconUdp;
+uint32_t beacon_seq = 0;
+int64_t beacon_next_utc_us = 0;   // leader: next send, on the second
+int64_t beacon_last_utc_us = 0;   // follower: newest accepted, rejects replays
+unsigned long beacon_heard_at = 0;
+bool beacon_locked = false;       // follower: the clock is following beacons
+uint8_t beacon_stratum = 0;
+uint8_t beacon_leader[4] = {0, 0, 0, 0};
+int beacon_window_count = 0;
+int64_t beacon_window_max_us = 0; // offsets over the window; the latest
+int64_t beacon_window_min_us = 0; // arrival has the least delay, so max is used
+int64_t beacon_offset_us = 0;     // phase error against the leader at the last correction
+int64_t beacon_spread_us = 0;     // max - min arrival offset in that window
+uint32_t beacon_sent = 0;
+uint32_t beacon_received = 0;
+uint32_t beacon_rejected = 0;     // bad signature, replayed, too far off or malformed
+
+// A value written by the network task and copied out by other tasks
+// without a lock. seq is odd while an update is in progress; readers retry
+// until they see the same even value before and after copying.
+template <typename T>
+struct Snapshot {
+  T value;
+  std::atomic<uint32_t> seq{0};
+
+  void publish(const T& v) {
+    uint32_t s = seq.load(std::memory_order_relaxed);
+    seq.store(s + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&value, &v, sizeof(T));
+    seq.store(s + 2, std::memory_order_release);
+  }
+
+  void read(T& out) const {
+    uint32_t before, after;
+    do {
+      before = seq.load(std::memory_order_acquire);
+      memcpy(&out, &value, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = seq.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+  }
+};
+
+// Everything the display task needs, published by the network task
+struct DisplayState {
+  ClockState clock;
+  TzRule tz;
+  uint32_t generation;
+  bool show_time;  // false shows text instead
+  bool synced;
+  bool verified;   // false holds the colon on instead of blinking
+  int brightness;
+  char text[8];
+};
+
+Snapshot<DisplayState> display_state;
+char display_text[8] = "";
+
+// What the NTP server task needs to answer a request, published by the
+// network task alongside the display state
+struct NtpServerState {
+  ClockState clock;
+  bool enabled;
+  bool synced;             // false answers with stratum 16 and the alarm leap indicator
+  uint8_t stratum;
+  uint8_t poll_log2sec;
+  uint8_t refid[4];        // upstream IPv4 address
+  uint32_t root_delay_us;  // upstream root delay plus our delay to it
+  uint32_t root_disp_us;   // upstream root dispersion plus our distance, at the last sync
+  int64_t ref_mono_us;     // monotonic time of the last sync
+};
+
+Snapshot<NtpServerState> ntp_server_state;
+TaskHandle_t captive_dns_task_handle = NULL;
+uint8_t captive_dns_answer[16];        // precomputed answer record for ordinary names ...
+uint8_t captive_dns_probe_answer[16];  // ... and for portal-detection hosts
+TaskHandle_t ntp_server_task_handle = NULL;
+std::atomic<uint32_t> ntp_served(0);
+std::atomic<uint32_t> ntp_server_dropped(0);  // malformed or non-client packets
+
+// Displayed time, recomputed only at minute rollover
+struct DisplayTime {
+  int hour12;
+  int minute;
+  bool pm;
+  int64_t next_minute_utc_us;  // 0 forces a recompute
+};
+
+TaskHandle_t display_task_handle = NULL;
+esp_timer_handle_t display_timer = NULL;
+
+// Distance between each display update and the UTC half-second it was
+// scheduled for; written by the display task only
+volatile uint32_t display_ticks = 0;
+volatile uint32_t display_tick_hist[DISPLAY_TICK_BUCKETS + 1] = {0};  // last bucket: over 10 ms
+volatile uint32_t display_tick_max_us = 0;
+volatile uint64_t display_tick_sum_us = 0;
+volatile int64_t display_first_time_us = 0;  // uptime when the time was first shown
+
+// Network loop instrumentation
+uint32_t loop_iterations = 0;
+int64_t loop_busy_us = 0;
+
+// Cached Wi-Fi scan, deduplicated by SSID in an open-addressing hash table
+struct ScanEntry {
+  char ssid[33];
+  int8_t rssi;
+  bool used;
+};
+ScanEntry scan_table[SCAN_TABLE_SLOTS];
+int scan_count = 0;
+bool scan_running = false;
+bool scan_has_result = false;
+unsigned long scan_completed_at = 0;
+
+// Status API
+char api_buf[API_BUFFER_SIZE];
+unsigned long lastExecutedMillis_sse = 0;
+
+// Web task: route table requested by the network task, see webLoop()
+enum WebRoutes { WEB_ROUTES_NONE, WEB_ROUTES_AP, WEB_ROUTES_STATION };
+std::atomic<uint8_t> web_routes_wanted(WEB_ROUTES_NONE);
+uint8_t web_routes_active = WEB_ROUTES_NONE;
+unsigned long web_restart_at = 0;  // nonzero: restart then, see restartAfterResponse()
+
+// Held by the network task for each pass and by the web task while a
+// handler runs; everything in this section outside a snapshot is shared
+SemaphoreHandle_t state_lock = NULL;
+
+struct StateLock {
+  StateLock() { xSemaphoreTake(state_lock, portMAX_DELAY); }
+  ~StateLock() { xSemaphoreGive(state_lock); }
+};
+
+// Event log, see telemetryRecord(). Labels must be string literals.
+enum TelemetryKind {
+  TEL_NTP_SAMPLE,  // a = offset us, b = delay us
+  TEL_NTP_SYNC,    // a = offset us, b = log2 poll interval ("ntp") or window spread us ("beacon")
+  TEL_NTP_FAIL,
+  TEL_WIFI_UP,     // a = RSSI dBm, b = reconnect attempts
+  TEL_WIFI_DOWN,   // b = reconnect attempts
+  TEL_HANDLER,     // a = duration us, b = heap retained
+  TEL_TICK_LATE,   // a = tick error us
+  TEL_HEAP_LOW,    // a = lowest free heap, b = largest free block
+  TEL_SLOW,        // a = duration us of a scoped section
+};
+const char* const TELEMETRY_KIND_NAMES[] = {
+  "ntp_sample", "ntp_sync", "ntp_fail", "wifi_up", "wifi_down", "handler", "tick_late", "heap_low", "slow",
+};
+
+struct TelemetryEvent {
+  uint32_t time_ms;
+  uint8_t kind;
+  const char* label;
+  int32_t a;
+  int32_t b;
+};
+
+TelemetryEvent telemetry_ring[TELEMETRY_EVENTS];
+uint32_t telemetry_count = 0;  // events ever recorded; the next event's sequence number
+portMUX_TYPE telemetry_mux = portMUX_INITIALIZER_UNLOCKED;
+uint32_t telemetry_heap_logged = UINT32_MAX;
+unsigned long telemetry_heap_checked_at = 0;
+
+// Per-route latency and heap accounting, see timedHandler()
+struct HandlerStats {
+  const char* name;
+  uint32_t count;
+  uint32_t max_us;
+  uint32_t samples_us[HANDLER_SAMPLES];  // ring of the most recent calls
+  int32_t heap_retained_max;    // largest drop in free heap across one call
+  int64_t heap_retained_total;
+  uint32_t max_alloc_min;       // smallest largest-free-block seen after a call
+  uint32_t allocs_max;          // most allocations in one call
+  uint64_t allocs_total;
+  uint32_t alloc_bytes_max;     // most bytes allocated in one call
+  uint64_t alloc_bytes_total;
+  int32_t alloc_peak_max;       // most bytes held at once during a call
+};
+
+HandlerStats handler_stats[HANDLER_STATS_MAX];
+int handler_stats_count = 0;
+
+// What operator new handed the web task while timedHandler() runs a handler
+struct HandlerAllocs {
+  std::atomic<TaskHandle_t> task{NULL};  // counted task, NULL between calls
+  uint32_t count = 0;
+  uint32_t bytes = 0;
+  int32_t live = 0;  // held now, net of frees since the call began
+  int32_t peak = 0;
+};
+
+HandlerAllocs handler_allocs;
+
+// -----------------------------------------------
+// HTML Templates
+// -----------------------------------------------
+// Pages are rendered into the connection's buffer, which goes out as a
+// chunk whenever it fills (see HttpServer). Only the page markup is sent
+// per request.
+
+const char HTML_HEAD_START[] PROGMEM =
+  "<!DOCTYPE html><html><head>"
+  "<meta charset='UTF-8'>"
+  "<meta name='viewport' content='width=device-width, initial-scale=1, user-scalable=yes'>"
+  "<title>";
+
+// The stylesheet is a cacheable gzip asset (assets/style.css); the version
+// query changes with its ETag so browsers never keep a stale copy
+const char HTML_HEAD_END[] PROGMEM =
+  "</title>"
+  "<link rel='stylesheet' href='/style.css?v=" STYLE_CSS_ETAG "'>"
+  "</head><body><div class='container'>";
+
+const char HTML_FOOTER[] PROGMEM = "</div></body></html>";
+
+const size_t HTML_PRINTF_MAX = 512;  // longest formatted fragment
+
+void sendHTMLHeaders();
+
+// Formats into caller-provided memory; output is truncated, never reallocated
+class FixedWriter {
+ public:
+  FixedWriter(char* buf, size_t cap) : buf(buf), cap(cap) { buf[0] = '\0'; }
+
+  void printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    if (len >= cap - 1) return;
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + len, cap - len, fmt, args);
+    va_end(args);
+    if (n > 0) len = min(len + n, cap - 1);
+  }
+
+  // JSON string literal with the required escapes
+  void printJsonString(const char* text) {
+    printf("\"");
+    for (const char* p = text; *p; p++) {
+      if (*p == '"' || *p == '\\') printf("\\%c", *p);
+      else if ((uint8_t)*p < 0x20) printf("\\u%04x", *p);
+      else printf("%c", *p);
+    }
+    printf("\"");
+  }
+
+  const char* data() const { return buf; }
+  size_t length() const { return len; }
+
+ private:
+  char* buf;
+  size_t cap;
+  size_t len = 0;
+};
+
+// Appends page fragments to the response being rendered
+class HtmlStream {
+ public:
+  // Starts the response with the page head
+  void begin(int code, const char* title) {
+    sendHTMLHeaders();
+    server.send(code, "text/html; charset=utf-8");
+    print(HTML_HEAD_START);
+    print(title);
+    print(HTML_HEAD_END);
+  }
+
+  void print(const char* text) { server.sendContent(text); }
+
+  void print(const String& text) { print(text.c_str()); }
+
+  // Truncated past HTML_PRINTF_MAX
+  void printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[HTML_PRINTF_MAX];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (n > 0) server.sendContent(buf, min((size_t)n, sizeof(buf) - 1));
+  }
+
+  void end() { print(HTML_FOOTER); }
+};
+
+void sendHTMLHeaders() {
+  server.sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
+  server.sendHeader("Pragma", "no-cache");
+  server.sendHeader("Expires", "-1");
+  server.sendHeader("Access-Control-Allow-Origin", "*");
+  server.sendHeader("Access-Control-Allow-Methods", "GET, POST, OPTIONS");
+  server.sendHeader("Access-Control-Allow-Headers", "*");
+}
+
+void handleOptions() {
+  server.sendHeader("Access-Control-Allow-Origin", "*");
+  server.sendHeader("Access-Control-Allow-Methods", "GET, POST, OPTIONS");
+  server.sendHeader("Access-Control-Allow-Headers", "*");
+  server.send(204);
+}
+
+// Serves a gzip asset from flash, answering revalidation with 304
+void sendStaticAsset(const StaticAsset& asset) {
+  server.sendHeader("Cache-Control", "public, max-age=31536000, immutable");
+  server.sendHeader("ETag", asset.etag);
+  if (server.header("If-None-Match") == asset.etag) {
+    server.send(304);
+    return;
+  }
+  server.sendHeader("Content-Encoding", "gzip");
+  server.send_P(200, asset.mime, (PGM_P)asset.data, asset.length);
+}
+
+void registerStaticAssets() {
+  for (int i = 0; i < NUM_STATIC_ASSETS; i++) {
+    const StaticAsset* asset = &STATIC_ASSETS[i];
+    server.on(asset->path, HTTP_GET, [asset]() { sendStaticAsset(*asset); });
+  }
+}
+
+void printTimezoneOptions(HtmlStream& html, int selected) {
+  for (int i = 0; i < NUM_TIMEZONES; i++) {
+    html.printf("<option value='%d'%s>%s</option>", i, i == selected ? " selected" : "", timezones[i].name);
+  }
+}
+
+// -----------------------------------------------
+// HTTP Server Implementation
+// -----------------------------------------------
+const char* httpStatusText(int code) {
+  switch (code) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 302: return "Found";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 413: return "Payload Too Large";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default: return "Unknown";
+  }
+}
+
+bool httpWouldBlock() {
+  return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+// Head or body bytes the socket has not taken yet
+bool httpPending(const HttpConnection& c) {
+  return c.head_sent < c.head_len || c.out_sent < c.out_len;
+}
+
+// Value of header name in a block of "Name: value\r\n" lines, NULL if absent
+const char* httpFindHeader(const char* lines, const char* name) {
+  size_t n = strlen(name);
+  for (const char* p = lines; *p && *p != '\r';) {
+    if (strncasecmp(p, name, n) == 0 && p[n] == ':') {
+      p += n + 1;
+      while (*p == ' ') p++;
+      return p;
+    }
+    const char* next = strstr(p, "\r\n");
+    if (!next) break;
+    p = next + 2;
+  }
+  return NULL;
+}
+
+// Raw value of name in "a=1&b=2", NULL if absent
+const char* httpFindArg(const char* params, const char* name, size_t& value_len) {
+  size_t n = strlen(name);
+  for (const char* p = params; *p;) {
+    const char* end = strchr(p, '&');
+    if (!end) end = p + strlen(p);
+    const char* eq = (const char*)memchr(p, '=', end - p);
+    const char* key_end = eq ? eq : end;
+    if ((size_t)(key_end - p) == n && strncmp(p, name, n) == 0) {
+      const char* value = eq ? eq + 1 : end;
+      value_len = end - value;
+      return value;
+    }
+    p = *end ? end + 1 : end;
+  }
+  return NULL;
+}
+
+int httpHexDigit(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+void HttpServer::on(const char* uri, HttpMethod method, HttpHandler handler) {
+  if (route_count >= HTTP_MAX_ROUTES) {
+    Serial.printf("HTTP: no room for route %s\n", uri);
+    return;
+  }
+  routes[route_count++] = HttpRoute{uri, method, handler};
+}
+
+void HttpServer::clearRoutes() {
+  for (int i = 0; i < route_count; i++) routes[i].handler = NULL;
+  route_count = 0;
+  not_found = NULL;
+}
+
+bool HttpServer::begin() {
+  if (listen_fd >= 0) return true;
+  int fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  int reuse = 1;
+  if (fd >= 0) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, HTTP_MAX_CONNECTIONS) < 0) {
+    Serial.printf("HTTP: cannot listen on port %u\n", port);
+    if (fd >= 0) closesocket(fd);
+    return false;
+  }
+  listen_fd = fd;
+  return true;
+}
+
+void HttpServer::wait(uint32_t wait_msec) {
+  FD_ZERO(&readable);
+  FD_ZERO(&writable);
+  if (listen_fd < 0 && !begin()) {
+    delay(wait_msec);  // retried on the next pass
+    return;
+  }
+  int max_fd = -1;
+  // Under pressure new clients stay in the backlog until a slot frees
+  if (!pressure) {
+    FD_SET(listen_fd, &readable);
+    max_fd = listen_fd;
+  }
+  for (HttpConnection& c : connections) {
+    if (c.state == HTTP_FREE) continue;
+    // A request, or an event stream being closed by the browser
+    if (c.state == HTTP_READING || c.state == HTTP_STREAMING) FD_SET(c.fd, &readable);
+    if (httpPending(c)) FD_SET(c.fd, &writable);
+    if (c.fd > max_fd) max_fd = c.fd;
+  }
+  if (max_fd < 0) {
+    delay(wait_msec);
+    return;
+  }
+  struct timeval timeout = {(time_t)(wait_msec / 1000), (suseconds_t)(wait_msec % 1000) * 1000};
+  if (select(max_fd + 1, &readable, &writable, NULL, &timeout) < 0) {
+    FD_ZERO(&readable);
+    FD_ZERO(&writable);
+    delay(10);
+  }
+}
+
+void HttpServer::service() {
+  if (listen_fd >= 0 && FD_ISSET(listen_fd, &readable)) acceptPending();
+  for (int k = 0; k < HTTP_MAX_CONNECTIONS; k++) {
+    HttpConnection& c = connections[(turn + k) % HTTP_MAX_CONNECTIONS];
+    if (c.state == HTTP_FREE) continue;
+    if (FD_ISSET(c.fd, &readable) && !receive(c)) continue;
+    if (c.state == HTTP_READING && c.request_len > 0) {
+      long length = requestLength(c);
+      if (length > 0) dispatch(c, length);
+      else if (length < 0 || c.request_len >= HTTP_REQUEST_MAX) reject(c, 413);
+    }
+    if (c.state == HTTP_SENDING || c.state == HTTP_STREAMING) sendSlice(c);
+    if (c.state != HTTP_FREE) expire(c);
+  }
+  turn = (turn + 1) % HTTP_MAX_CONNECTIONS;
+}
+
+void HttpServer::acceptPending() {
+  HttpConnection* slot = NULL;
+  HttpConnection* idle = NULL;
+  for (HttpConnection& c : connections) {
+    if (c.state == HTTP_FREE) {
+      slot = &c;
+      break;
+    }
+    // Kept alive with nothing asked yet: the longest idle gives way
+    if (c.state == HTTP_READING && c.served > 0 && c.request_len == 0 &&
+        (!idle || (long)(c.active_at - idle->active_at) < 0)) {
+      idle = &c;
+    }
+  }
+  if (!slot && idle) {
+    drop(*idle);
+    slot = idle;
+  }
+  if (!slot) {
+    pressure = true;
+    return;
+  }
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  int fd = accept(listen_fd, (struct sockaddr*)&addr, &addr_len);
+  if (fd < 0) {
+    delay(10);  // out of sockets; retry rather than spin
+    return;
+  }
+  int nodelay = 1;  // the head and body go out as separate writes
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+  slot->fd = fd;
+  slot->state = HTTP_READING;
+  slot->active_at = millis();
+  slot->served = 0;
+  slot->request_len = 0;
+}
+
+// Reads what has arrived; false if the connection was closed
+bool HttpServer::receive(HttpConnection& c) {
+  char discard[64];
+  bool reading = c.state == HTTP_READING;
+  size_t room = reading ? HTTP_REQUEST_MAX - c.request_len : sizeof(discard);
+  if (room == 0) return true;
+  int n = ::recv(c.fd, reading ? c.request + c.request_len : discard, room, MSG_DONTWAIT);
+  if (n == 0 || (n < 0 && !httpWouldBlock())) {
+    drop(c);
+    return false;
+  }
+  if (n > 0 && reading) {
+    if (c.request_len == 0) c.request_at = millis();
+    c.request_len += n;
+    c.active_at = millis();
+  }
+  return true;
+}
+
+// Length of the request at the start of the buffer once all of it is
+// there, 0 before that, -1 if it can never fit
+long HttpServer::requestLength(HttpConnection& c) {
+  c.request[c.request_len] = '\0';
+  const char* end = strstr(c.request, "\r\n\r\n");
+  if (!end) return 0;
+  size_t head = end + 4 - c.request;
+  const char* line = strstr(c.request, "\r\n") + 2;
+  const char* value = httpFindHeader(line, "Content-Length");
+  long body = value ? strtol(value, NULL, 10) : 0;
+  if (body < 0 || head + body > HTTP_REQUEST_MAX) return -1;
+  return c.request_len >= head + body ? (long)(head + body) : 0;
+}
+
+void HttpServer::dispatch(HttpConnection& c, size_t length) {
+  char saved = c.request[length];  // first byte of a pipelined request, if any
+  c.request[length] = '\0';
+  char* head_end = strstr(c.request, "\r\n\r\n");
+  head_end[2] = '\0';  // header lines keep their CRLF for httpFindHeader()
+  char* line_end = strstr(c.request, "\r\n");
+  *line_end = '\0';
+  char* target = strchr(c.request, ' ');
+  char* version = target ? strchr(target + 1, ' ') : NULL;
+  if (!version) {
+    reject(c, 400);
+    return;
+  }
+  *target++ = '\0';
+  *version++ = '\0';
+  char* query = strchr(target, '?');
+  if (query) *query++ = '\0';
+
+  const char* name = c.request;
+  request_method = strcmp(name, "GET") == 0       ? HTTP_GET
+                   : strcmp(name, "HEAD") == 0    ? HTTP_HEAD
+                   : strcmp(name, "POST") == 0    ? HTTP_POST
+                   : strcmp(name, "OPTIONS") == 0 ? HTTP_OPTIONS
+                                                  : HTTP_OTHER;
+  request_path = target;
+  request_query = query ? query : "";
+  request_headers = line_end + 2;
+  request_form = request_method == HTTP_POST ? head_end + 4 : "";
+  const char* connection = httpFindHeader(request_headers, "Connection");
+  if (strcmp(version, "HTTP/1.1") == 0) c.keep_alive = !connection || strncasecmp(connection, "close", 5) != 0;
+  else c.keep_alive = connection && strncasecmp(connection, "keep-alive", 10) == 0;
+
+  current = &c;
+  responded = false;
+  flash_body = false;
+  aborted = false;
+  close_after = false;
+  pending_len = 0;
+  c.head_len = c.head_sent = 0;
+  c.chunked = false;
+  c.body_len = c.content_length = 0;
+  HttpHandler handler = not_found;
+  for (int i = 0; i < route_count; i++) {
+    HttpMethod wanted = routes[i].method;
+    bool method_ok = wanted == HTTP_ANY || wanted == request_method ||
+                     (wanted == HTTP_GET && request_method == HTTP_HEAD);
+    if (method_ok && strcmp(routes[i].uri, request_path) == 0) {
+      handler = routes[i].handler;
+      break;
+    }
+  }
+  if (handler) handler();
+  if (aborted) {
+    current = NULL;
+    drop(c);
+    return;
+  }
+  if (!responded) send(handler ? 500 : 404, "text/plain", handler ? "No response" : "Not Found");
+  finish(c);
+  current = NULL;
+
+  // Whatever the client sent after this request waits for the next turn
+  c.request[length] = saved;
+  c.request_len -= length;
+  memmove(c.request, c.request + length, c.request_len);
+  c.request_at = millis();
+}
+
+// Answers a request that can't be parsed or doesn't fit, then closes
+void HttpServer::reject(HttpConnection& c, int code) {
+  current = &c;
+  responded = false;
+  flash_body = false;
+  aborted = false;
+  pending_len = 0;
+  c.head_len = c.head_sent = 0;
+  c.chunked = false;
+  c.body_len = c.content_length = 0;
+  request_method = HTTP_OTHER;
+  send(code, "text/plain", httpStatusText(code));
+  close_after = true;
+  finish(c);
+  current = NULL;
+  c.request_len = 0;
+}
+
+// Completes the head: the length, or chunked when the body is not
+// complete yet, and the connection headers
+void HttpServer::endHead(HttpConnection& c) {
+  c.keep_alive = c.keep_alive && !close_after && !pressure;
+  if (c.chunked) appendHead(c, "Transfer-Encoding: chunked\r\n");
+  else if (response_code != 204 && response_code != 304) appendHead(c, "Content-Length: %u\r\n", (unsigned)c.content_length);
+  if (c.keep_alive) appendHead(c, "Connection: keep-alive\r\nKeep-Alive: timeout=%lu\r\n\r\n",
+                               (unsigned long)(HTTP_IDLE_TIMEOUT_MSEC / 1000));
+  else appendHead(c, "Connection: close\r\n\r\n");
+}
+
+// Queues what has been rendered, framed in place as a chunk when chunked;
+// the last one is followed by the terminating chunk
+void HttpServer::queueBody(HttpConnection& c, bool last) {
+  size_t start = HTTP_CHUNK_PREFIX;
+  size_t end = HTTP_CHUNK_PREFIX + c.body_len;
+  if (c.chunked) {
+    if (c.body_len > 0) {
+      char size[HTTP_CHUNK_PREFIX + 1];
+      int n = snprintf(size, sizeof(size), "%x\r\n", (unsigned)c.body_len);
+      start -= n;
+      memcpy(c.body + start, size, n);
+      memcpy(c.body + end, "\r\n", 2);
+      end += 2;
+    }
+    if (last) {
+      memcpy(c.body + end, "0\r\n\r\n", 5);
+      end += 5;
+    }
+  }
+  c.out = c.body + start;
+  c.out_len = end - start;
+  c.out_sent = 0;
+  c.body_len = 0;
+}
+
+// Sends the body rendered so far as a chunk to make room for the rest.
+// The handler waits here until the socket has taken it, with StateLock
+// released so the network task is not held up by the client; the other
+// connections get their slices meanwhile. False if the client stopped
+// taking data for HTTP_SEND_TIMEOUT_MSEC or went away.
+bool HttpServer::flush(HttpConnection& c) {
+  if (!c.chunked) {
+    c.chunked = true;
+    endHead(c);
+  }
+  queueBody(c, false);
+  bool locked = xSemaphoreGetMutexHolder(state_lock) == xTaskGetCurrentTaskHandle();
+  if (locked) xSemaphoreGive(state_lock);
+  for (;;) {
+    if (!sendPending(c) || millis() - c.active_at > HTTP_SEND_TIMEOUT_MSEC) {
+      aborted = true;
+      break;
+    }
+    if (!httpPending(c)) break;
+    fd_set ready;
+    FD_ZERO(&ready);
+    int max_fd = -1;
+    for (HttpConnection& other : connections) {
+      if (other.state == HTTP_FREE || !httpPending(other)) continue;
+      FD_SET(other.fd, &ready);
+      if (other.fd > max_fd) max_fd = other.fd;
+    }
+    struct timeval timeout = {0, 100000};
+    if (select(max_fd + 1, NULL, &ready, NULL, &timeout) <= 0) continue;
+    for (int k = 0; k < HTTP_MAX_CONNECTIONS; k++) {
+      HttpConnection& other = connections[(turn + k) % HTTP_MAX_CONNECTIONS];
+      if (&other != &c && other.state != HTTP_FREE && FD_ISSET(other.fd, &ready)) sendSlice(other);
+    }
+    turn = (turn + 1) % HTTP_MAX_CONNECTIONS;
+  }
+  if (locked) xSemaphoreTake(state_lock, portMAX_DELAY);
+  return !aborted;
+}
+
+void HttpServer::finish(HttpConnection& c) {
+  c.active_at = millis();
+  if (c.state == HTTP_STREAMING) {
+    queueBody(c, false);
+    return;
+  }
+  if (!c.chunked) endHead(c);
+  else if (close_after) c.keep_alive = false;  // the head already went out
+  queueBody(c, true);
+  if (flash_body && request_method != HTTP_HEAD) {
+    c.out = flash_data;
+    c.out_len = c.content_length;
+  }
+  c.state = HTTP_SENDING;
+}
+
+// Gives the socket what it takes of the head, then up to HTTP_SEND_SLICE
+// of the body; false on a socket error
+bool HttpServer::sendPending(HttpConnection& c) {
+  if (c.head_sent < c.head_len) {
+    int n = ::send(c.fd, c.head + c.head_sent, c.head_len - c.head_sent, MSG_DONTWAIT);
+    if (n < 0 && !httpWouldBlock()) return false;
+    if (n > 0) {
+      c.head_sent += n;
+      c.active_at = millis();
+    }
+    if (c.head_sent < c.head_len) return true;
+  }
+  if (c.out_sent < c.out_len) {
+    int n = ::send(c.fd, c.out + c.out_sent, min(c.out_len - c.out_sent, HTTP_SEND_SLICE), MSG_DONTWAIT);
+    if (n < 0 && !httpWouldBlock()) return false;
+    if (n > 0) {
+      c.out_sent += n;
+      c.active_at = millis();
+    }
+  }
+  return true;
+}
+
+void HttpServer::sendSlice(HttpConnection& c) {
+  if (!sendPending(c)) {
+    drop(c);
+    return;
+  }
+  if (!httpPending(c)) responseSent(c);
+}
+
+void HttpServer::responseSent(HttpConnection& c) {
+  if (c.state == HTTP_STREAMING) {
+    c.out_len = c.out_sent = 0;  // the buffer is free for the next event
+    return;
+  }
+  c.served++;
+  if (!c.keep_alive) {
+    drop(c);
+    return;
+  }
+  c.head_len = c.head_sent = 0;
+  c.out = NULL;
+  c.out_len = c.out_sent = 0;
+  c.state = HTTP_READING;
+  c.active_at = millis();
+}
+
+void HttpServer::expire(HttpConnection& c) {
+  unsigned long now = millis();
+  bool expired;
+  if (c.state == HTTP_READING && c.request_len > 0) expired = now - c.request_at > HTTP_REQUEST_TIMEOUT_MSEC;
+  // A new connection has to ask for something sooner than a kept-alive one
+  else if (c.state == HTTP_READING && c.served == 0) expired = now - c.active_at > HTTP_REQUEST_TIMEOUT_MSEC;
+  else if (c.state == HTTP_READING) expired = now - c.active_at > HTTP_IDLE_TIMEOUT_MSEC;
+  else expired = httpPending(c) && now - c.active_at > HTTP_SEND_TIMEOUT_MSEC;
+  if (expired) drop(c);
+}
+
+void HttpServer::drop(HttpConnection& c) {
+  closesocket(c.fd);
+  c.head_len = c.head_sent = 0;
+  c.out = NULL;
+  c.out_len = c.out_sent = 0;
+  c.body_len = 0;
+  c.request_len = 0;
+  c.fd = -1;
+  c.state = HTTP_FREE;
+  pressure = false;
+}
+
+void HttpServer::appendHead(HttpConnection& c, const char* fmt, ...) {
+  if (c.head_len >= sizeof(c.head) - 1) return;
+  va_list args;
+  va_start(args, fmt);
+  int n = vsnprintf(c.head + c.head_len, sizeof(c.head) - c.head_len, fmt, args);
+  va_end(args);
+  if (n > 0) c.head_len = min(c.head_len + n, sizeof(c.head) - 1);
+}
+
+bool HttpServer::hasArg(const char* name) const {
+  size_t length;
+  return httpFindArg(request_query, name, length) || httpFindArg(request_form, name, length);
+}
+
+// URL-decoded, from the query string or else a form body
+String HttpServer::arg(const char* name) const {
+  size_t length = 0;
+  const char* value = httpFindArg(request_query, name, length);
+  if (!value) value = httpFindArg(request_form, name, length);
+  String decoded;
+  if (!value) return decoded;
+  decoded.reserve(length);
+  for (size_t i = 0; i < length; i++) {
+    char ch = value[i];
+    if (ch == '+') {
+      ch = ' ';
+    } else if (ch == '%' && i + 2 < length && httpHexDigit(value[i + 1]) >= 0 && httpHexDigit(value[i + 2]) >= 0) {
+      ch = (char)(httpHexDigit(value[i + 1]) * 16 + httpHexDigit(value[i + 2]));
+      i += 2;
+    }
+    decoded += ch;
+  }
+  return decoded;
+}
+
+String HttpServer::header(const char* name) const {
+  const char* value = httpFindHeader(request_headers, name);
+  if (!value) return String();
+  const char* end = strstr(value, "\r\n");
+  String result;
+  size_t length = end ? (size_t)(end - value) : strlen(value);
+  result.reserve(length);
+  for (size_t i = 0; i < length; i++) result += value[i];
+  return result;
+}
+
+void HttpServer::sendHeader(const char* name, const char* value) {
+  if (pending_len >= sizeof(pending_headers) - 1) return;
+  int n = snprintf(pending_headers + pending_len, sizeof(pending_headers) - pending_len, "%s: %s\r\n", name, value);
+  if (n > 0) pending_len = min(pending_len + n, sizeof(pending_headers) - 1);
+}
+
+void HttpServer::send(int code, const char* type, const char* content) {
+  if (!current || responded) return;
+  responded = true;
+  response_code = code;
+  HttpConnection& c = *current;
+  c.head_len = 0;
+  appendHead(c, "HTTP/1.1 %d %s\r\n", code, httpStatusText(code));
+  if (type) appendHead(c, "Content-Type: %s\r\n", type);
+  if (pending_len > 0) appendHead(c, "%.*s", (int)pending_len, pending_headers);
+  pending_len = 0;
+  sendContent(content, strlen(content));
+}
+
+void HttpServer::send_P(int code, const char* type, const char* data, size_t length) {
+  send(code, type);
+  if (current) {
+    flash_body = true;
+    flash_data = data;
+    current->content_length = length;
+  }
+}
+
+// Appends to the body, flushing the buffer as a chunk each time it fills
+void HttpServer::sendContent(const char* data, size_t length) {
+  if (!current || !responded || flash_body || aborted) return;
+  HttpConnection& c = *current;
+  c.content_length += length;
+  if (request_method == HTTP_HEAD) return;  // only the length goes out
+  while (length > 0) {
+    if (c.body_len == HTTP_BODY_MAX && !flush(c)) return;
+    size_t n = min(length, HTTP_BODY_MAX - c.body_len);
+    memcpy(c.body + HTTP_CHUNK_PREFIX + c.body_len, data, n);
+    c.body_len += n;
+    data += n;
+    length -= n;
+  }
+}
+
+bool HttpServer::startEventStream(const char* first) {
+  if (!current || responded || eventStreams() >= SSE_MAX_CLIENTS) return false;
+  responded = true;
+  response_code = 200;
+  HttpConnection& c = *current;
+  c.head_len = 0;
+  appendHead(c, "HTTP/1.1 200 OK\r\n"
+                "Content-Type: text/event-stream\r\n"
+                "Cache-Control: no-cache\r\n"
+                "Connection: keep-alive\r\n"
+                "Access-Control-Allow-Origin: *\r\n\r\n");
+  pending_len = 0;
+  c.state = HTTP_STREAMING;
+  sendContent(first);
+  return true;
+}
+
+int HttpServer::eventStreams() const {
+  int n = 0;
+  for (const HttpConnection& c : connections) n += c.state == HTTP_STREAMING;
+  return n;
+}
+
+// Queues an event on every stream that has taken the previous one; a
+// stream still behind skips it rather than buffering more, and an event
+// longer than HTTP_BODY_MAX is not sent
+void HttpServer::pushEvent(const char* data, size_t length) {
+  if (length > HTTP_BODY_MAX) return;
+  for (HttpConnection& c : connections) {
+    if (c.state != HTTP_STREAMING || httpPending(c)) continue;
+    memcpy(c.body + HTTP_CHUNK_PREFIX, data, length);
+    c.body_len = length;
+    queueBody(c, false);
+    c.active_at = millis();
+  }
+}
+
+// -----------------------------------------------
+// WiFi Scanning
+// -----------------------------------------------
+// Scans run in the background; portal pages render from the last result.
+
+void startWifiScan() {
+  if (scan_running) return;
+  scan_running = WiFi.scanNetworks(true) == WIFI_SCAN_RUNNING;
+}
+
+uint32_t ssidHash(const char* ssid) {
+  uint32_t h = 2166136261u;  // FNV-1a
+  while (*ssid) {
+    h ^= (uint8_t)*ssid++;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+// Inserts an SSID or keeps the stronger signal of a duplicate
+void scanTableInsert(const char* ssid, int rssi) {
+  if (scan_count >= SCAN_TABLE_SLOTS) return;
+  uint32_t slot = ssidHash(ssid) & (SCAN_TABLE_SLOTS - 1);
+  while (scan_table[slot].used) {
+    if (strcmp(scan_table[slot].ssid, ssid) == 0) {
+      if (rssi > scan_table[slot].rssi) scan_table[slot].rssi = rssi;
+      return;
+    }
+    slot = (slot + 1) & (SCAN_TABLE_SLOTS - 1);
+  }
+  ScanEntry& entry = scan_table[slot];
+  strncpy(entry.ssid, ssid, sizeof(entry.ssid) - 1);
+  entry.ssid[sizeof(entry.ssid) - 1] = '\0';
+  entry.rssi = rssi;
+  entry.used = true;
+  scan_count++;
+}
+
+// Collects a finished scan into the cache and schedules the next one
+void pollWifiScan() {
+  if (!scan_running) {
+    if (!scan_has_result || millis() - scan_completed_at >= SCAN_REFRESH_MSEC) startWifiScan();
+    return;
+  }
+  int n = WiFi.scanComplete();
+  if (n == WIFI_SCAN_RUNNING) return;
+
+  scan_running = false;
+  scan_completed_at = millis();
+  if (n < 0) return;  // failed; retried after SCAN_REFRESH_MSEC
+
+  memset(scan_table, 0, sizeof(scan_table));
+  scan_count = 0;
+  for (int i = 0; i < n; i++) {
+    String ssid = WiFi.SSID(i);
+    if (ssid.length() == 0) continue;  // Skip hidden networks
+    scanTableInsert(ssid.c_str(), WiFi.RSSI(i));
+  }
+  scan_has_result = true;
+  WiFi.scanDelete();
+}
+
+void printNetworks(HtmlStream& html) {
+  if (!scan_has_result) {
+    html.print("<p>Scanning for networks...</p>");
+    html.print("<script>setTimeout(function(){location.reload()},3000)</script>");
+    return;
+  }
+
+  // Strongest first
+  int order[SCAN_TABLE_SLOTS];
+  int count = 0;
+  for (int slot = 0; slot < SCAN_TABLE_SLOTS; slot++) {
+    if (!scan_table[slot].used) continue;
+    int j = count++;
+    for (; j > 0 && scan_table[order[j - 1]].rssi < scan_table[slot].rssi; j--) order[j] = order[j - 1];
+    order[j] = slot;
+  }
+
+  html.printf("<p>Updated %lu s ago%s. <a href='/scan'>Scan again</a></p>",
+              (millis() - scan_completed_at) / 1000, scan_running ? ", rescanning" : "");
+  if (count == 0) {
+    html.print("<p>No networks found.</p>");
+    return;
+  }
+
+  html.print("<form action='/connect' method='post'>");
+  for (int i = 0; i < count; i++) {
+    const ScanEntry& entry = scan_table[order[i]];
+    int bars = 1;
+    if (entry.rssi > -50) bars = 4;
+    else if (entry.rssi > -60) bars = 3;
+    else if (entry.rssi > -70) bars = 2;
+
+    html.print("<div class='network' onclick=\"document.getElementById('ssid').value='");
+    html.print(entry.ssid);
+    html.print("'\"><span class='ssid-name'>");
+    html.print(entry.ssid);
+    html.print("</span><span class='bars'>");
+    for (int b = 1; b <= 4; b++) {
+      html.printf("<span class='bar %s' style='height:%dpx'></span>", b <= bars ? "on" : "off", b * 4 + 4);
+    }
+    html.print("</span></div>");
+  }
+  html.print("<label>Selected Network:</label>");
+  html.print("<input type='text' id='ssid' name='ssid' maxlength='32' placeholder='Click a network above or type SSID'>");
+  html.print("<label>Password:</label>");
+  html.print("<input type='password' name='password' maxlength='64' placeholder='WiFi Password'>");
+  html.print("<input type='submit' value='Connect to WiFi'>");
+  html.print("</form>");
+}
+
+// -----------------------------------------------
+// Web Handlers - AP Mode
+// -----------------------------------------------
+void handleRoot() {
+  if (ap_mode) {
+    HtmlStream html;
+    html.begin(200, "NTP Clock Setup");
+    html.print("<h1>NTP Clock Setup</h1>");
+    html.print("<div class='card'>");
+    html.print("<h2>WiFi Networks</h2>");
+    printNetworks(html);
+    html.print("</div>");
+    html.end();
+  } else {
+    handleStatus();
+  }
+}
+
+void handleScan() {
+  startWifiScan();
+  handleRoot();
+}
+
+void handleConnect() {
+  if (server.hasArg("ssid") && server.hasArg("password")) {
+    wifi_ssid = server.arg("ssid");
+    wifi_pass = server.arg("password");
+
+    HtmlStream html;
+    html.begin(200, "WiFi Setup");
+    html.print("<h1>NTP Clock Setup</h1>");
+    html.print("<div class='card'>");
+    html.print("<h2>WiFi Selected</h2>");
+    html.print("<p>Network: <strong>");
+    html.print(wifi_ssid);
+    html.print("</strong></p>");
+    html.print("<p>Now configure your timezone and NTP server.</p>");
+    html.print("</div>");
+
+    html.print("<div class='card'>");
+    html.print("<h2>Timezone & NTP</h2>");
+    html.print("<form action='/save' method='post'>");
+    html.print("<input type='hidden' name='ssid' value='");
+    html.print(wifi_ssid);
+    html.print("'><input type='hidden' name='password' value='");
+    html.print(wifi_pass);
+    html.print("'>");
+
+    html.print("<label>Timezone:</label>");
+    html.print("<select name='timezone'>");
+    printTimezoneOptions(html, 0);
+    html.print("</select>");
+    html.print("<label>Custom POSIX TZ (optional, overrides the list):</label>");
+    html.print("<input type='text' name='tzposix' maxlength='63' placeholder='e.g. CET-1CEST,M3.5.0,M10.5.0/3'>");
+
+    html.print("<label>NTP Servers (comma separated):</label>");
+    html.print("<input type='text' name='ntpserver' maxlength='159' value='pool.ntp.org' placeholder='NTP Server'>");
+
+    html.print("<label>Display Brightness: <span id='brightval'>7</span></label>");
+    html.print("<input type='range' name='brightness' min='0' max='7' value='7' oninput=\"document.getElementById('brightval').textContent=this.value\" style='width:100%'>");
+
+    html.print("<input type='submit' value='Save & Connect'>");
+    html.print("</form>");
+    html.print("</div>");
+    html.end();
+  } else {
+    server.sendHeader("Location", "/");
+    server.send(302);
+  }
+}
+
+void handleSave() {
+  if (server.hasArg("ssid") && server.hasArg("password") &&
+      server.hasArg("timezone") && server.hasArg("ntpserver")) {
+
+    wifi_ssid = server.arg("ssid");
+    wifi_pass = server.arg("password");
+    timezone_index = server.arg("timezone").toInt();
+    tz_custom = server.arg("tzposix");
+    ntp_server = server.arg("ntpserver");
+    if (server.hasArg("brightness")) {
+      display_brightness = server.arg("brightness").toInt();
+      display_brightness = constrain(display_brightness, 0, 7);
+    }
+
+    // Written now: the clock restarts below
+    configSave(true);
+
+    HtmlStream html;
+    html.begin(200, "Connecting");
+    html.print("<h1>NTP Clock Setup</h1>");
+    html.print("<div class='card'>");
+    html.print("<h2 class='success'>Configuration Saved!</h2>");
+    html.print("<div class='info'>");
+    html.print("<p><strong>WiFi:</strong> ");
+    html.print(wifi_ssid);
+    html.print("</p><p><strong>Timezone:</strong> ");
+    html.print(timezoneName());
+    html.print("</p>");
+    html.print("<p><strong>NTP Server:</strong> ");
+    html.print(ntp_server);
+    html.print("</p>");
+    html.print("</div>");
+    html.print("<p>The clock will now restart and connect to your WiFi network.</p>");
+    html.print("<p>Once connected, you can access this configuration page at the clock's IP address.</p>");
+    html.print("</div>");
+    html.end();
+    restartAfterResponse();
+  } else {
+    server.sendHeader("Location", "/");
+    server.send(302);
+  }
+}
+
+// -----------------------------------------------
+// Web Handlers - Station Mode
+// -----------------------------------------------
+void handleStatus() {
+  HtmlStream html;
+  html.begin(200, "NTP Clock Status");
+  html.print("<h1>NTP Clock</h1>");
+
+  html.print("<div class='card'>");
+  html.print("<h2>Status</h2>");
+  html.print("<div class='info'>");
+  html.print("<p><strong>WiFi Network:</strong> ");
+  html.print(wifi_ssid);
+  IPAddress ip = WiFi.localIP();
+  html.printf("</p><p><strong>IP Address:</strong> %u.%u.%u.%u</p>", ip[0], ip[1], ip[2], ip[3]);
+  html.printf("<p><strong>Signal Strength:</strong> %d dBm</p>", WiFi.RSSI());
+  html.print("<p><strong>Timezone:</strong> ");
+  html.print(timezoneName());
+  html.printf(" (%s)</p>", tz_window.dst ? tz_rule.dst_abbr : tz_rule.std_abbr);
+  html.print("<p><strong>NTP Server:</strong> ");
+  html.print(ntp_server);
+  html.print("</p>");
+  html.printf("<p><strong>Brightness:</strong> %d/7", effective_brightness);
+  if (light_sensor) {
+    html.printf(" (light sensor, %d-%d)", night_brightness, display_brightness);
+  } else if (auto_brightness) {
+    html.printf(" (dimming to %d at night)", night_brightness);
+  }
+  html.print("</p>");
+  if (auto_brightness && has_location && sun_day >= 0 && sun_kind == SUN_NORMAL) {
+    time_t rise = sun_rise + utcOffsetSeconds(sun_rise);
+    time_t set = sun_set + utcOffsetSeconds(sun_set);
+    html.printf("<p><strong>Sunrise / Sunset:</strong> %02d:%02d / %02d:%02d</p>", (int)(rise % 86400 / 3600),
+                (int)(rise % 3600 / 60), (int)(set % 86400 / 3600), (int)(set % 3600 / 60));
+  }
+  html.printf("<p><strong>Settings Writes:</strong> %lu today, %lu lifetime</p>", (unsigned long)config_writes_today,
+              (unsigned long)config_stored.writes);
+  html.printf("<p><strong>Display Bus Transactions:</strong> %lu</p>", (unsigned long)module.transactions);
+  int64_t uptime_us = esp_timer_get_time();
+  html.printf("<p><strong>Network Loop:</strong> %lu passes, %.1f%% busy</p>", (unsigned long)loop_iterations,
+              uptime_us > 0 ? loop_busy_us * 100.0 / uptime_us : 0.0);
+  uint32_t ticks = display_ticks;
+  uint32_t within_1ms = 0;
+  for (int i = 0; i < DISPLAY_TICK_BUCKETS && DISPLAY_TICK_BUCKET_US[i] <= 1000; i++) within_1ms += display_tick_hist[i];
+  html.printf("<p><strong>Display Tick Error:</strong> %.2f%% of %lu within 1 ms, worst %.2f ms</p>",
+              ticks > 0 ? within_1ms * 100.0 / ticks : 0.0, (unsigned long)ticks, display_tick_max_us / 1000.0);
+  int hours, minutes, seconds;
+  localTimeOfDay(hours, minutes, seconds);
+  html.printf("<p><strong>Current Time:</strong> %d:%02d:%02d%s</p>", hours, minutes, seconds,
+              time_verified ? "" : " <span class='error'>(unverified, carried over from before restart)</span>");
+  if (display_first_time_us > 0) {
+    html.printf("<p><strong>Time Shown After:</strong> %.1f s from boot</p>", display_first_time_us / 1e6);
+  }
+  html.printf("<p><strong>NTP Sync:</strong> %s</p>", last_update ? "<span class='success'>OK</span>" : "<span class='error'>Failed</span>");
+  if (ntp_selected_peer >= 0) {
+    NtpPeer& peer = ntp_peers[ntp_selected_peer];
+    html.printf("<p><strong>Time Source:</strong> %s (stratum %u, %d/%d agree)</p>",
+                peer.host, peer.stratum, ntp_survivor_count, ntp_peer_count);
+    html.printf("<p><strong>Offset / Delay:</strong> %.1f / %.1f ms</p>",
+                last_offset_us / 1000.0, peer.filtered.delay_us / 1000.0);
+    html.printf("<p><strong>Drift:</strong> %.2f ppm, polling every %d s</p>",
+                clock_state.freq_ppb / 1000.0, 1 << poll_log2sec);
+  }
+  if (serve_ntp) {
+    html.printf("<p><strong>NTP Server:</strong> %lu requests answered</p>", (unsigned long)ntp_served.load());
+  }
+  if (beacon_mode == BEACON_LEAD) {
+    html.printf("<p><strong>Time Beacon:</strong> leading, %lu sent</p>", (unsigned long)beacon_sent);
+  } else if (beacon_mode == BEACON_FOLLOW) {
+    if (beacon_locked) {
+      html.printf("<p><strong>Time Beacon:</strong> following %u.%u.%u.%u, phase error %.2f ms (spread %.2f ms)</p>",
+                  beacon_leader[0], beacon_leader[1], beacon_leader[2], beacon_leader[3],
+                  beacon_offset_us / 1000.0, beacon_spread_us / 1000.0);
+    } else {
+      html.print("<p><strong>Time Beacon:</strong> <span class='error'>no leader heard, using NTP</span></p>");
+    }
+  }
+  html.print("</div>");
+  html.print("</div>");
+
+  html.print("<div class='card'>");
+  html.print("<h2>Settings</h2>");
+  html.print("<a href='/settings'><button>Change Settings</button></a>");
+  html.print("<a href='/reset'><button class='btn-danger'>Reset & Reconfigure</button></a>");
+  html.print("</div>");
+  html.end();
+}
+
+void handleSettings() {
+  HtmlStream html;
+  html.begin(200, "Clock Settings");
+  html.print("<h1>Clock Settings</h1>");
+
+  html.print("<div class='card'>");
+  html.print("<h2>Timezone & NTP</h2>");
+  html.print("<form action='/updatesettings' method='post'>");
+
+  html.print("<label>Timezone:</label>");
+  html.print("<select name='timezone'>");
+  printTimezoneOptions(html, timezone_index);
+  html.print("</select>");
+  html.print("<label>Custom POSIX TZ (optional, overrides the list):</label>");
+  html.print("<input type='text' name='tzposix' maxlength='63' placeholder='e.g. CET-1CEST,M3.5.0,M10.5.0/3' value='");
+  html.print(tz_custom);
+  html.print("'>");
+
+  html.printf("<label>NTP Servers (comma separated, up to %d):</label>", NTP_MAX_SERVERS);
+  html.print("<input type='text' name='ntpserver' maxlength='159' value='");
+  html.print(ntp_server);
+  html.print("'>");
+  html.printf("<label><input type='checkbox' name='serventp'%s> Serve NTP to the local network (UDP %u)</label>",
+              serve_ntp ? " checked" : "", NTP_PORT);
+  html.print("<label>LAN Time Beacon (keeps clocks in a room blinking together):</label>");
+  html.print("<select name='beacon'>");
+  const char* beacon_modes[] = {"Off", "Lead: send beacons", "Follow beacons"};
+  for (int i = BEACON_OFF; i <= BEACON_FOLLOW; i++) {
+    html.printf("<option value='%d'%s>%s</option>", i, i == beacon_mode ? " selected" : "", beacon_modes[i]);
+  }
+  html.print("</select>");
+  html.print("<label>Beacon Key (same on every clock, required to lead or follow):</label>");
+  html.print("<input type='text' name='beaconkey' maxlength='32' value='");
+  html.print(beacon_key);
+  html.print("'>");
+
+  html.printf("<label>Display Brightness: <span id='brightval'>%d</span></label>", display_brightness);
+  // The slider previews live; the value is saved like the other settings
+  html.printf("<input type='range' name='brightness' min='0' max='7' value='%d' oninput=\"document.getElementById('brightval').textContent=this.value;"
+              "fetch('/api/brightness',{method:'POST',body:new URLSearchParams({value:this.value})})\" style='width:100%%'>", display_brightness);
+  html.printf("<label><input type='checkbox' name='autobright'%s> Dim at night</label>", auto_brightness ? " checked" : "");
+  html.printf("<label>Night Brightness: <span id='nightval'>%d</span></label>", night_brightness);
+  html.printf("<input type='range' name='nightbright' min='0' max='7' value='%d' oninput=\"document.getElementById('nightval').textContent=this.value\" style='width:100%%'>", night_brightness);
+  html.printf("<label>Latitude, Longitude (optional, for sunrise/sunset; otherwise night is %02d:00-%02d:00):</label>",
+              NIGHT_START_MIN / 60, NIGHT_END_MIN / 60);
+  if (has_location) {
+    html.printf("<input type='text' name='lat' value='%.4f'><input type='text' name='lon' value='%.4f'>", latitude, longitude);
+  } else {
+    html.print("<input type='text' name='lat' placeholder='e.g. 40.7128'><input type='text' name='lon' placeholder='e.g. -74.0060'>");
+  }
+  html.printf("<label><input type='checkbox' name='lightsensor'%s> Follow light sensor on GPIO %d</label>",
+              light_sensor ? " checked" : "", PIN_LIGHT);
+
+  html.print("<input type='submit' value='Save Settings'>");
+  html.print("</form>");
+  html.print("<a href='/'><button class='btn-secondary'>Back</button></a>");
+  html.print("</div>");
+  html.end();
+}
+
+// Each kind of change gets the smallest action that applies it: a zone
+// change re-derives the offset, a server change restarts the NTP client,
+// serving starts or stops at once and brightness goes straight to the
+// display task
+void handleUpdateSettings() {
+  if (server.hasArg("timezone") && server.hasArg("ntpserver")) {
+    bool tz_changed = server.arg("timezone").toInt() != timezone_index || server.arg("tzposix") != tz_custom;
+    bool ntp_changed = server.arg("ntpserver") != ntp_server;
+    timezone_index = server.arg("timezone").toInt();
+    tz_custom = server.arg("tzposix");
+    ntp_server = server.arg("ntpserver");
+    serve_ntp = server.hasArg("serventp");
+    bool beacon_changed = server.arg("beacon").toInt() != beacon_mode || server.arg("beaconkey") != beacon_key;
+    beacon_mode = constrain((int)server.arg("beacon").toInt(), (int)BEACON_OFF, (int)BEACON_FOLLOW);
+    beacon_key = server.arg("beaconkey");
+    bool beacon_refused = beacon_mode != BEACON_OFF && beacon_key.length() == 0;
+    if (beacon_refused) beacon_mode = BEACON_OFF;  // unsigned beacons would let anyone set the clock
+    if (server.hasArg("brightness")) {
+      display_brightness = server.arg("brightness").toInt();
+      display_brightness = constrain(display_brightness, 0, 7);
+    }
+    auto_brightness = server.hasArg("autobright");
+    light_sensor = server.hasArg("lightsensor");
+    if (server.hasArg("nightbright")) night_brightness = constrain((int)server.arg("nightbright").toInt(), 0, 7);
+    has_location = server.arg("lat").length() > 0 && server.arg("lon").length() > 0;
+    if (has_location) {
+      latitude = constrain(server.arg("lat").toFloat(), -90.0f, 90.0f);
+      longitude = constrain(server.arg("lon").toFloat(), -180.0f, 180.0f);
+    }
+    sun_day = -1;
+
+    configSave(false);
+
+    if (tz_changed) applyTimezone();
+    if (ntp_changed) ntpClientBegin();  // resolves and resyncs from the network loop
+    ntpServerBegin();
+    if (beacon_changed) beaconBegin();
+    updateBrightness();
+
+    HtmlStream html;
+    html.begin(200, "Settings Saved");
+    html.print("<h1>Settings Saved</h1>");
+    html.print("<div class='card'>");
+    html.print("<h2 class='success'>Settings Updated!</h2>");
+    html.print("<p>Timezone: ");
+    html.print(timezoneName());
+    html.print("</p>");
+    html.print("<p>NTP Server: ");
+    html.print(ntp_server);
+    html.print("</p>");
+    html.printf("<p>Brightness: %d/7</p>", display_brightness);
+    if (beacon_refused) html.print("<p class='error'>Time beacon left off: it needs a beacon key.</p>");
+    html.print("<a href='/'><button>Back to Status</button></a>");
+    html.print("</div>");
+    html.end();
+  } else {
+    server.sendHeader("Location", "/settings");
+    server.send(302);
+  }
+}
+
+void handleReset() {
+  HtmlStream html;
+  html.begin(200, "Reset Clock");
+  html.print("<h1>Reset Clock</h1>");
+  html.print("<div class='card'>");
+  html.print("<h2 class='error'>Confirm Reset</h2>");
+  html.print("<p>This will erase all settings and restart the clock in setup mode.</p>");
+  html.print("<form action='/doreset' method='post'>");
+  html.print("<input type='submit' value='Yes, Reset Everything' class='btn-danger'>");
+  html.print("</form>");
+  html.print("<a href='/'><button class='btn-secondary'>Cancel</button></a>");
+  html.print("</div>");
+  html.end();
+}
+
+void handleDoReset() {
+  configErase();
+
+  HtmlStream html;
+  html.begin(200, "Resetting");
+  html.print("<h1>Resetting...</h1>");
+  html.print("<div class='card'>");
+  html.print("<h2>Settings Cleared</h2>");
+  html.print("<p>The clock will restart in setup mode.</p>");
+  html.printf("<p>Connect to WiFi network: <strong>%s</strong></p>", AP_SSID);
+  html.printf("<p>Password: <strong>%s</strong></p>", AP_PASS);
+  html.print("</div>");
+  html.end();
+  restartAfterResponse();
+}
+
+// -----------------------------------------------
+// Web Handlers - Status API
+// -----------------------------------------------
+// Rendered into api_buf without heap allocation
+
+void renderStatusJson(FixedWriter& out) {
+  int64_t utc_us = utcNowUs();
+  time_t local = localNow();
+  struct tm t;
+  gmtime_r(&local, &t);
+
+  out.printf("{\"time\":{\"utc\":%lld,\"local\":\"%04d-%02d-%02dT%02d:%02d:%02d\",\"utc_offset_min\":%d,",
+             (long long)(utc_us / 1000000), t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+             t.tm_hour, t.tm_min, t.tm_sec, (int)(utcOffsetSeconds(utc_us / 1000000) / 60));
+  out.printf("\"zone\":");
+  out.printJsonString(tz_window.dst ? tz_rule.dst_abbr : tz_rule.std_abbr);
+  out.printf("},");
+  out.printf("\"sync\":{\"valid\":%s,\"verified\":%s,\"restored\":%s,\"time_to_display_ms\":%lld,\"ok\":%s,\"source\":",
+             time_valid ? "true" : "false", time_verified ? "true" : "false", time_restored ? "true" : "false",
+             (long long)(display_first_time_us / 1000), last_update ? "true" : "false");
+  if (ntp_selected_peer >= 0) {
+    NtpPeer& peer = ntp_peers[ntp_selected_peer];
+    out.printJsonString(peer.host);
+    out.printf(",\"stratum\":%u,\"offset_us\":%lld,\"delay_us\":%lu,", peer.stratum,
+               (long long)last_offset_us, (unsigned long)peer.filtered.delay_us);
+  } else {
+    out.printf("null,");
+  }
+  out.printf("\"drift_ppb\":%lld,\"poll_s\":%d,\"survivors\":%d,\"servers\":%d},",
+             (long long)clock_state.freq_ppb, 1 << poll_log2sec, ntp_survivor_count, ntp_peer_count);
+  out.printf("\"ntp_server\":{\"enabled\":%s,\"served\":%lu,\"dropped\":%lu},", serve_ntp ? "true" : "false",
+             (unsigned long)ntp_served.load(), (unsigned long)ntp_server_dropped.load());
+  out.printf("\"beacon\":{\"mode\":%d,\"locked\":%s,\"offset_us\":%lld,\"spread_us\":%lld,\"sent\":%lu,\"received\":%lu,\"rejected\":%lu},",
+             beacon_mode, beacon_locked ? "true" : "false", (long long)beacon_offset_us, (long long)beacon_spread_us,
+             (unsigned long)beacon_sent, (unsigned long)beacon_received, (unsigned long)beacon_rejected);
+  out.printf("\"wifi\":{\"ssid\":");
+  out.printJsonString(wifi_ssid.c_str());
+  out.printf(",\"connected\":%s,\"rssi\":%d,\"reconnects\":%lu},", wifi_connected ? "true" : "false",
+             WiFi.RSSI(), (unsigned long)wifi_reconnects);
+  out.printf("\"config\":{\"writes\":%lu,\"writes_today\":%lu,\"lifetime_writes\":%lu,\"pending\":%s},",
+             (unsigned long)config_writes, (unsigned long)config_writes_today, (unsigned long)config_stored.writes,
+             config_dirty ? "true" : "false");
+  int64_t uptime_us = esp_timer_get_time();
+  out.printf("\"uptime_s\":%lld,\"heap\":{\"free\":%lu,\"min_free\":%lu,\"max_alloc\":%lu},",
+             (long long)(uptime_us / 1000000), (unsigned long)ESP.getFreeHeap(),
+             (unsigned long)ESP.getMinFreeHeap(), (unsigned long)ESP.getMaxAllocHeap());
+  out.printf("\"loop\":{\"iterations\":%lu,\"busy_pct\":%.2f},\"display\":{\"brightness\":%d,\"level\":%d,\"auto\":%s,\"bus_transactions\":%lu,",
+             (unsigned long)loop_iterations, uptime_us > 0 ? loop_busy_us * 100.0 / uptime_us : 0.0,
+             display_brightness, effective_brightness, (auto_brightness || light_sensor) ? "true" : "false",
+             (unsigned long)module.transactions);
+  out.printf("\"ticks\":%lu,\"tick_error\":{\"max_us\":%lu,\"buckets_us\":[", (unsigned long)display_ticks,
+             (unsigned long)display_tick_max_us);
+  for (int i = 0; i < DISPLAY_TICK_BUCKETS; i++) out.printf(i ? ",%lu" : "%lu", (unsigned long)DISPLAY_TICK_BUCKET_US[i]);
+  out.printf("],\"counts\":[");
+  for (int i = 0; i <= DISPLAY_TICK_BUCKETS; i++) out.printf(i ? ",%lu" : "%lu", (unsigned long)display_tick_hist[i]);
+  out.printf("]}}}");
+}
+
+void renderMetrics(FixedWriter& out) {
+  int64_t uptime_us = esp_timer_get_time();
+  out.printf("# TYPE ntpclock_time_seconds gauge\nntpclock_time_seconds %lld\n", (long long)(utcNowUs() / 1000000));
+  out.printf("# TYPE ntpclock_sync_ok gauge\nntpclock_sync_ok %d\n", last_update ? 1 : 0);
+  out.printf("# TYPE ntpclock_time_verified gauge\nntpclock_time_verified %d\n", time_verified ? 1 : 0);
+  if (display_first_time_us > 0) {
+    out.printf("# TYPE ntpclock_time_to_display_seconds gauge\nntpclock_time_to_display_seconds %.3f\n",
+               display_first_time_us / 1e6);
+  }
+  out.printf("# TYPE ntpclock_offset_seconds gauge\nntpclock_offset_seconds %.6f\n", last_offset_us / 1e6);
+  if (ntp_selected_peer >= 0) {
+    out.printf("# TYPE ntpclock_delay_seconds gauge\nntpclock_delay_seconds %.6f\n",
+               ntp_peers[ntp_selected_peer].filtered.delay_us / 1e6);
+  }
+  out.printf("# TYPE ntpclock_drift_ppm gauge\nntpclock_drift_ppm %.3f\n", clock_state.freq_ppb / 1000.0);
+  out.printf("# TYPE ntpclock_poll_interval_seconds gauge\nntpclock_poll_interval_seconds %d\n", 1 << poll_log2sec);
+  out.printf("# TYPE ntpclock_ntp_survivors gauge\nntpclock_ntp_survivors %d\n", ntp_survivor_count);
+  out.printf("# TYPE ntpclock_ntp_served_total counter\nntpclock_ntp_served_total %lu\n", (unsigned long)ntp_served.load());
+  out.printf("# TYPE ntpclock_ntp_server_dropped_total counter\nntpclock_ntp_server_dropped_total %lu\n",
+             (unsigned long)ntp_server_dropped.load());
+  if (beacon_mode == BEACON_FOLLOW) {
+    out.printf("# TYPE ntpclock_beacon_locked gauge\nntpclock_beacon_locked %d\n", beacon_locked ? 1 : 0);
+    out.printf("# TYPE ntpclock_beacon_phase_error_seconds gauge\nntpclock_beacon_phase_error_seconds %.6f\n",
+               beacon_offset_us / 1e6);
+    out.printf("# TYPE ntpclock_beacon_spread_seconds gauge\nntpclock_beacon_spread_seconds %.6f\n", beacon_spread_us / 1e6);
+  }
+  out.printf("# TYPE ntpclock_beacons_sent_total counter\nntpclock_beacons_sent_total %lu\n", (unsigned long)beacon_sent);
+  out.printf("# TYPE ntpclock_beacons_received_total counter\nntpclock_beacons_received_total %lu\n", (unsigned long)beacon_received);
+  out.printf("# TYPE ntpclock_beacons_rejected_total counter\nntpclock_beacons_rejected_total %lu\n", (unsigned long)beacon_rejected);
+  out.printf("# TYPE ntpclock_wifi_rssi_dbm gauge\nntpclock_wifi_rssi_dbm %d\n", WiFi.RSSI());
+  out.printf("# TYPE ntpclock_wifi_reconnects_total counter\nntpclock_wifi_reconnects_total %lu\n", (unsigned long)wifi_reconnects);
+  out.printf("# TYPE ntpclock_config_writes_total counter\nntpclock_config_writes_total %lu\n", (unsigned long)config_writes);
+  out.printf("# TYPE ntpclock_config_lifetime_writes gauge\nntpclock_config_lifetime_writes %lu\n",
+             (unsigned long)config_stored.writes);
+  out.printf("# TYPE ntpclock_uptime_seconds counter\nntpclock_uptime_seconds %lld\n", (long long)(uptime_us / 1000000));
+  out.printf("# TYPE ntpclock_heap_free_bytes gauge\nntpclock_heap_free_bytes %lu\n", (unsigned long)ESP.getFreeHeap());
+  out.printf("# TYPE ntpclock_heap_min_free_bytes gauge\nntpclock_heap_min_free_bytes %lu\n", (unsigned long)ESP.getMinFreeHeap());
+  out.printf("# TYPE ntpclock_loop_iterations_total counter\nntpclock_loop_iterations_total %lu\n", (unsigned long)loop_iterations);
+  out.printf("# TYPE ntpclock_loop_busy_seconds_total counter\nntpclock_loop_busy_seconds_total %.3f\n", loop_busy_us / 1e6);
+  out.printf("# TYPE ntpclock_display_brightness gauge\nntpclock_display_brightness %d\n", effective_brightness);
+  out.printf("# TYPE ntpclock_display_bus_transactions_total counter\nntpclock_display_bus_transactions_total %lu\n",
+             (unsigned long)module.transactions);
+  out.printf("# TYPE ntpclock_display_ticks_total counter\nntpclock_display_ticks_total %lu\n", (unsigned long)display_ticks);
+  out.printf("# TYPE ntpclock_display_tick_error_seconds histogram\n");
+  uint32_t cumulative = 0;
+  for (int i = 0; i < DISPLAY_TICK_BUCKETS; i++) {
+    cumulative += display_tick_hist[i];
+    out.printf("ntpclock_display_tick_error_seconds_bucket{le=\"%g\"} %lu\n", DISPLAY_TICK_BUCKET_US[i] / 1e6,
+               (unsigned long)cumulative);
+  }
+  cumulative += display_tick_hist[DISPLAY_TICK_BUCKETS];
+  out.printf("ntpclock_display_tick_error_seconds_bucket{le=\"+Inf\"} %lu\n", (unsigned long)cumulative);
+  out.printf("ntpclock_display_tick_error_seconds_sum %.6f\n", display_tick_sum_us / 1e6);
+  out.printf("ntpclock_display_tick_error_seconds_count %lu\n", (unsigned long)cumulative);
+}
+
+void sendBuffer(const char* type, const FixedWriter& out) {
+  server.sendHeader("Cache-Control", "no-cache");
+  server.sendHeader("Access-Control-Allow-Origin", "*");
+  server.send(200, type);
+  server.sendContent(out.data(), out.length());
+}
+
+void handleApiStatus() {
+  FixedWriter out(api_buf, sizeof(api_buf));
+  renderStatusJson(out);
+  sendBuffer("application/json", out);
+}
+
+void handleMetrics() {
+  FixedWriter out(api_buf, sizeof(api_buf));
+  renderMetrics(out);
+  sendBuffer("text/plain; version=0.0.4", out);
+}
+
+// Sets the brightness without a page load (settings slider)
+void handleApiBrightness() {
+  if (server.hasArg("value")) {
+    display_brightness = constrain((int)server.arg("value").toInt(), 0, 7);
+    previewBrightness();
+    configSave(false);
+  }
+  FixedWriter out(api_buf, sizeof(api_buf));
+  out.printf("{\"brightness\":%d,\"level\":%d}", display_brightness, effective_brightness);
+  sendBuffer("application/json", out);
+}
+
+// Keeps the connection open as a Server-Sent Events stream; webLoop()
+// pushes the status JSON to it every second
+void handleEvents() {
+  if (!server.startEventStream("retry: 2000\n\n")) server.send(503, "text/plain", "Too many event streams");
+}
+
+// Renders the event under StateLock; it goes out with the next passes
+void pushEvents() {
+  if (server.eventStreams() == 0) return;
+  FixedWriter out(api_buf, sizeof(api_buf));
+  {
+    StateLock lock;
+    if (!wifi_connected) return;
+    out.printf("data: ");
+    renderStatusJson(out);
+    out.printf("\n\n");
+  }
+  server.pushEvent(out.data(), out.length());
+}
+
+// Restarts from webLoop() once the page has had time to go out; the
+// handler itself must not wait with StateLock held
+void restartAfterResponse() {
+  server.closeAfterResponse();
+  web_restart_at = millis() + HTTP_RESTART_DELAY_MSEC;
+  if (web_restart_at == 0) web_restart_at = 1;
+}
+
+void handleNotFound() {
+  if (ap_mode) {
+    // Captive portal - redirect all requests to root
+    server.sendHeader("Location", "http://192.168.4.1/");
+    server.send(302);
+  } else {
+    server.send(404, "text/plain", "Not Found");
+  }
+}
+
+// -----------------------------------------------
+// Web Handler Instrumentation
+// -----------------------------------------------
+// Routes are registered through timedHandler(), which runs the handler
+// under StateLock and records each call's latency (lock wait included),
+// the change in free heap across it and what it allocated.
+// /api/handlers reports p50/p99 over the last HANDLER_SAMPLES calls per
+// route: load a page repeatedly, then diff the report between firmware
+// versions.
+
+// The allocation counts come from replacing the global operator new.
+// Arduino String allocates with malloc() and is not seen; on the request
+// path that is only arg() and header().
+bool handlerAllocsCounting() {
+  TaskHandle_t task = handler_allocs.task.load(std::memory_order_relaxed);
+  return task != NULL && task == xTaskGetCurrentTaskHandle();
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  void* p = heap_caps_malloc(size ? size : 1, MALLOC_CAP_DEFAULT);
+  if (p && handlerAllocsCounting()) {
+    int32_t n = heap_caps_get_allocated_size(p);
+    handler_allocs.count++;
+    handler_allocs.bytes += n;
+    handler_allocs.live += n;
+    if (handler_allocs.live > handler_allocs.peak) handler_allocs.peak = handler_allocs.live;
+  }
+  return p;
+}
+
+void* operator new(size_t size) {
+  void* p = operator new(size, std::nothrow);
+#if __cpp_exceptions
+  if (!p) throw std::bad_alloc();
+#else
+  if (!p) abort();
+#endif
+  return p;
+}
+
+void operator delete(void* p) noexcept {
+  if (!p) return;
+  if (handlerAllocsCounting()) {
+    handler_allocs.live -= heap_caps_get_allocated_size(p);
+  }
+  heap_caps_free(p);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return operator new(size, std::nothrow); }
+void operator delete[](void* p) noexcept { operator delete(p); }
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+void operator delete[](void* p, size_t) noexcept { operator delete(p); }
+
+HandlerStats* handlerStatsFor(const char* name) {
+  for (int i = 0; i < handler_stats_count; i++) {
+    if (strcmp(handler_stats[i].name, name) == 0) return &handler_stats[i];
+  }
+  if (handler_stats_count >= HANDLER_STATS_MAX) return NULL;
+  HandlerStats* stats = &handler_stats[handler_stats_count++];
+  stats->name = name;
+  stats->max_alloc_min = UINT32_MAX;
+  return stats;
+}
+
+HttpHandler timedHandler(const char* name, void (*handler)()) {
+  HandlerStats* stats = handlerStatsFor(name);
+  if (!stats) {
+    return [handler]() {
+      StateLock lock;
+      handler();
+    };
+  }
+  return [stats, handler]() {
+    int64_t start = esp_timer_get_time();
+    int32_t retained;
+    {
+      StateLock lock;
+      // Sampled under the lock so other tasks' state changes stay out of it
+      uint32_t heap_before = ESP.getFreeHeap();
+      handler_allocs.count = 0;
+      handler_allocs.bytes = 0;
+      handler_allocs.live = 0;
+      handler_allocs.peak = 0;
+      handler_allocs.task.store(xTaskGetCurrentTaskHandle(), std::memory_order_relaxed);
+      handler();
+      handler_allocs.task.store(NULL, std::memory_order_relaxed);
+      retained = (int32_t)(heap_before - ESP.getFreeHeap());
+    }
+    uint32_t elapsed = esp_timer_get_time() - start;
+    telemetryRecord(TEL_HANDLER, stats->name, elapsed, retained);
+
+    stats->samples_us[stats->count % HANDLER_SAMPLES] = elapsed;
+    stats->count++;
+    if (elapsed > stats->max_us) stats->max_us = elapsed;
+    if (retained > stats->heap_retained_max) stats->heap_retained_max = retained;
+    stats->heap_retained_total += retained;
+    uint32_t max_alloc = ESP.getMaxAllocHeap();
+    if (max_alloc < stats->max_alloc_min) stats->max_alloc_min = max_alloc;
+    if (handler_allocs.count > stats->allocs_max) stats->allocs_max = handler_allocs.count;
+    stats->allocs_total += handler_allocs.count;
+    if (handler_allocs.bytes > stats->alloc_bytes_max) stats->alloc_bytes_max = handler_allocs.bytes;
+    stats->alloc_bytes_total += handler_allocs.bytes;
+    if (handler_allocs.peak > stats->alloc_peak_max) stats->alloc_peak_max = handler_allocs.peak;
+  };
+}
+
+void renderHandlerStats(FixedWriter& out) {
+  uint32_t sorted[HANDLER_SAMPLES];
+  out.printf("{\"handlers\":[");
+  for (int h = 0; h < handler_stats_count; h++) {
+    const HandlerStats& stats = handler_stats[h];
+    uint32_t n = stats.count < HANDLER_SAMPLES ? stats.count : HANDLER_SAMPLES;
+    for (uint32_t i = 0; i < n; i++) {
+      uint32_t v = stats.samples_us[i];
+      uint32_t j = i;
+      for (; j > 0 && sorted[j - 1] > v; j--) sorted[j] = sorted[j - 1];
+      sorted[j] = v;
+    }
+    // Nearest-rank percentiles
+    uint32_t p50 = n > 0 ? sorted[(n * 50 + 99) / 100 - 1] : 0;
+    uint32_t p99 = n > 0 ? sorted[(n * 99 + 99) / 100 - 1] : 0;
+
+    out.printf(h ? ",{\"name\":" : "{\"name\":");
+    out.printJsonString(stats.name);
+    out.printf(",\"count\":%lu,\"p50_us\":%lu,\"p99_us\":%lu,\"max_us\":%lu,", (unsigned long)stats.count,
+               (unsigned long)p50, (unsigned long)p99, (unsigned long)stats.max_us);
+    out.printf("\"heap_retained_max\":%ld,\"heap_retained_total\":%lld,\"max_alloc_min\":%lu,",
+               (long)stats.heap_retained_max, (long long)stats.heap_retained_total,
+               (unsigned long)(stats.count > 0 ? stats.max_alloc_min : 0));
+    out.printf("\"allocs_max\":%lu,\"allocs_total\":%llu,\"alloc_bytes_max\":%lu,\"alloc_bytes_total\":%llu,"
+               "\"alloc_peak_max\":%ld}",
+               (unsigned long)stats.allocs_max, (unsigned long long)stats.allocs_total,
+               (unsigned long)stats.alloc_bytes_max, (unsigned long long)stats.alloc_bytes_total,
+               (long)stats.alloc_peak_max);
+  }
+  out.printf("],\"heap\":{\"free\":%lu,\"min_free\":%lu,\"max_alloc\":%lu}}", (unsigned long)ESP.getFreeHeap(),
+             (unsigned long)ESP.getMinFreeHeap(), (unsigned long)ESP.getMaxAllocHeap());
+}
+
+void handleApiHandlers() {
+  FixedWriter out(api_buf, sizeof(api_buf));
+  renderHandlerStats(out);
+  sendBuffer("application/json", out);
+}
+
+// -----------------------------------------------
+// Telemetry
+// -----------------------------------------------
+// A fixed ring of the last TELEMETRY_EVENTS timestamped events: NTP
+// samples and syncs, Wi-Fi changes, handler calls, late display ticks,
+// heap low-water marks and slow sections caught by TelemetryScope. Any
+// task may record; each write is a few stores under a spinlock and
+// nothing is allocated. /api/telemetry and "t" on the serial console
+// dump it as CSV. With TELEMETRY_ENABLED false all of it compiles away.
+
+void telemetryRecord(TelemetryKind kind, const char* label, int64_t a, int64_t b) {
+  if (!TELEMETRY_ENABLED) return;
+  uint32_t now = millis();
+  int32_t a32 = a > INT32_MAX ? INT32_MAX : a < INT32_MIN ? INT32_MIN : (int32_t)a;
+  int32_t b32 = b > INT32_MAX ? INT32_MAX : b < INT32_MIN ? INT32_MIN : (int32_t)b;
+  portENTER_CRITICAL(&telemetry_mux);
+  TelemetryEvent& event = telemetry_ring[telemetry_count % TELEMETRY_EVENTS];
+  event.time_ms = now;
+  event.kind = kind;
+  event.label = label;
+  event.a = a32;
+  event.b = b32;
+  telemetry_count++;
+  portEXIT_CRITICAL(&telemetry_mux);
+}
+
+// Copies event seq out; false once it has been overwritten
+bool telemetryRead(uint32_t seq, TelemetryEvent& out) {
+  bool ok;
+  portENTER_CRITICAL(&telemetry_mux);
+  ok = seq < telemetry_count && telemetry_count - seq <= TELEMETRY_EVENTS;
+  if (ok) out = telemetry_ring[seq % TELEMETRY_EVENTS];
+  portEXIT_CRITICAL(&telemetry_mux);
+  return ok;
+}
+
+// Logs the enclosing block if it runs longer than TELEMETRY_SLOW_US
+class TelemetryScope {
+ public:
+  explicit TelemetryScope(const char* label) : label(label), start(TELEMETRY_ENABLED ? esp_timer_get_time() : 0) {}
+  ~TelemetryScope() {
+    if (!TELEMETRY_ENABLED) return;
+    int64_t elapsed = esp_timer_get_time() - start;
+    if (elapsed >= TELEMETRY_SLOW_US) telemetryRecord(TEL_SLOW, label, elapsed, 0);
+  }
+
+ private:
+  const char* label;
+  int64_t start;
+};
+
+// Samples the heap once a second and logs each new low-water step
+void telemetryPoll() {
+  if (!TELEMETRY_ENABLED || millis() - telemetry_heap_checked_at < 1000) return;
+  telemetry_heap_checked_at = millis();
+  uint32_t min_free = ESP.getMinFreeHeap();
+  if (telemetry_heap_logged == UINT32_MAX || min_free + TELEMETRY_HEAP_STEP <= telemetry_heap_logged) {
+    telemetry_heap_logged = min_free;
+    telemetryRecord(TEL_HEAP_LOW, "heap", min_free, ESP.getMaxAllocHeap());
+  }
+}
+
+// Formats events from seq onwards as CSV lines into out, stopping when
+// it is nearly full; returns the sequence number to continue from
+uint32_t telemetryRenderCsv(FixedWriter& out, uint32_t seq, uint32_t end, size_t room) {
+  TelemetryEvent event;
+  if (seq > end) seq = end;
+  if (end - seq > TELEMETRY_EVENTS) seq = end - TELEMETRY_EVENTS;
+  for (; seq < end && out.length() + 80 < room; seq++) {
+    if (!telemetryRead(seq, event)) continue;
+    out.printf("%lu,%lu,%s,%s,%ld,%ld\n", (unsigned long)seq, (unsigned long)event.time_ms,
+               TELEMETRY_KIND_NAMES[event.kind], event.label, (long)event.a, (long)event.b);
+  }
+  return seq;
+}
+
+// GET /api/telemetry[?since=seq], rendered through api_buf in pieces
+void handleApiTelemetry() {
+  uint32_t end = telemetry_count;
+  uint32_t seq = server.hasArg("since") ? strtoul(server.arg("since").c_str(), NULL, 10) : 0;
+  server.sendHeader("Cache-Control", "no-cache");
+  server.sendHeader("Access-Control-Allow-Origin", "*");
+  server.send(200, "text/csv");
+  FixedWriter out(api_buf, sizeof(api_buf));
+  out.printf("seq,time_ms,kind,label,a,b\n");
+  do {
+    seq = telemetryRenderCsv(out, seq, end, sizeof(api_buf));
+    server.sendContent(out.data(), out.length());
+    out = FixedWriter(api_buf, sizeof(api_buf));
+  } while (seq < end);
+}
+
+// Sending "t" over serial prints the log
+void telemetrySerialPoll() {
+  while (Serial.available() > 0) {
+    if (Serial.read() != 't') continue;
+    uint32_t end = telemetry_count;
+    uint32_t seq = 0;
+    Serial.println("seq,time_ms,kind,label,a,b");
+    char buf[512];  // api_buf belongs to the web task
+    do {
+      FixedWriter out(buf, sizeof(buf));
+      seq = telemetryRenderCsv(out, seq, end, sizeof(buf));
+      Serial.print(out.data());
+    } while (seq < end);
+  }
+}
+
+// -----------------------------------------------
+// Helper Functions
+// -----------------------------------------------
+const char* timezoneName() {
+  return tz_custom.length() > 0 ? tz_custom.c_str() : timezones[timezone_index].name;
+}
+
+void applyTimezone() {
+  if (timezone_index < 0 || timezone_index >= NUM_TIMEZONES) timezone_index = 0;
+  const char* posix = tz_custom.length() > 0 ? tz_custom.c_str() : timezones[timezone_index].posix;
+  if (!parsePosixTz(posix, tz_rule)) {
+    Serial.println("Invalid TZ rule, using UTC: " + String(posix));
+    parsePosixTz("UTC0", tz_rule);
+  }
+  // Transitions are recomputed lazily for the new zone
+  tz_window.from = tz_window.until = 0;
+  time_generation++;
+}
+
+// -----------------------------------------------
+// Settings Storage
+// -----------------------------------------------
+// Settings are loaded once at boot into the globals above. Saving builds
+// a ConfigRecord from them and writes it as a single NVS blob, and only
+// if it differs from what flash holds. Saves from the settings page are
+// deferred until changes stop for CONFIG_SAVE_DELAY_MSEC, so a burst of
+// edits costs one write.
+
+void configCapture(ConfigRecord& record) {
+  memset(&record, 0, sizeof(record));
+  record.version = CONFIG_VERSION;
+  record.timezone_index = timezone_index;
+  record.brightness = display_brightness;
+  strncpy(record.ssid, wifi_ssid.c_str(), sizeof(record.ssid) - 1);
+  strncpy(record.pass, wifi_pass.c_str(), sizeof(record.pass) - 1);
+  strncpy(record.ntp_server, ntp_server.c_str(), sizeof(record.ntp_server) - 1);
+  strncpy(record.tz_posix, tz_custom.c_str(), sizeof(record.tz_posix) - 1);
+  record.auto_brightness = auto_brightness;
+  record.night_brightness = night_brightness;
+  record.light_sensor = light_sensor;
+  record.has_location = has_location;
+  record.latitude = latitude;
+  record.longitude = longitude;
+  record.serve_ntp = serve_ntp;
+  record.beacon_mode = beacon_mode;
+  strncpy(record.beacon_key, beacon_key.c_str(), sizeof(record.beacon_key) - 1);
+}
+
+void configLoad() {
+  preferences.begin("ntpclock", true);
+  memset(&config_stored, 0, sizeof(config_stored));
+  size_t length = preferences.getBytesLength("cfg");
+  bool have_record = length >= offsetof(ConfigRecord, auto_brightness) && length <= sizeof(config_stored) &&
+                     preferences.getBytes("cfg", &config_stored, length) == length &&
+                     config_stored.version >= 1 && config_stored.version <= CONFIG_VERSION;
+  if (have_record) {
+    wifi_ssid = config_stored.ssid;
+    wifi_pass = config_stored.pass;
+    timezone_index = config_stored.timezone_index;
+    tz_custom = config_stored.tz_posix;
+    ntp_server = config_stored.ntp_server;
+    display_brightness = config_stored.brightness;
+    if (config_stored.version >= 2) {
+      auto_brightness = config_stored.auto_brightness;
+      night_brightness = constrain((int)config_stored.night_brightness, 0, 7);
+      light_sensor = config_stored.light_sensor;
+      has_location = config_stored.has_location;
+      latitude = config_stored.latitude;
+      longitude = config_stored.longitude;
+    }
+    if (config_stored.version >= 3) {
+      serve_ntp = config_stored.serve_ntp;
+    }
+    if (config_stored.version >= 4) {
+      beacon_mode = config_stored.beacon_mode <= BEACON_FOLLOW ? config_stored.beacon_mode : (uint8_t)BEACON_OFF;
+      beacon_key = config_stored.beacon_key;
+      if (beacon_key.length() == 0) beacon_mode = BEACON_OFF;
+    }
+  } else {
+    // Individual keys from earlier firmware; converted on the next save
+    wifi_ssid = preferences.getString("ssid", "");
+    wifi_pass = preferences.getString("pass", "");
+    timezone_index = preferences.getInt("tz", 0);  // Default to Eastern
+    tz_custom = preferences.getString("tzposix", "");
+    ntp_server = preferences.getString("ntp", "pool.ntp.org");
+    display_brightness = preferences.getInt("bright", 7);  // Default to max
+    memset(&config_stored, 0, sizeof(config_stored));
+  }
+  preferences.end();
+  display_brightness = constrain(display_brightness, 0, 7);
+  effective_brightness = display_brightness;
+}
+
+void configWrite() {
+  config_dirty = false;
+  ConfigRecord record;
+  configCapture(record);
+  record.writes = config_stored.writes;
+  if (memcmp(&record, &config_stored, sizeof(record)) == 0) return;
+
+  record.writes++;
+  preferences.begin("ntpclock", false);
+  bool ok = preferences.putBytes("cfg", &record, sizeof(record)) == sizeof(record);
+  if (ok && config_stored.version == 0) {
+    const char* legacy[] = {"ssid", "pass", "tz", "tzposix", "ntp", "bright"};
+    for (const char* key : legacy) preferences.remove(key);
+  }
+  preferences.end();
+  if (!ok) {
+    Serial.println("Saving settings failed");
+    return;
+  }
+  config_stored = record;
+  config_writes++;
+  config_writes_today++;
+}
+
+// Saves the current settings, now or after the debounce delay
+void configSave(bool immediate) {
+  if (immediate) {
+    configWrite();
+  } else {
+    config_dirty = true;
+    config_save_at = millis() + CONFIG_SAVE_DELAY_MSEC;
+  }
+}
+
+void configPoll() {
+  unsigned long now = millis();
+  if (now - config_day_started >= 86400000UL) {
+    config_day_started = now;
+    config_writes_today = 0;
+  }
+  if (config_dirty && (long)(now - config_save_at) >= 0) configWrite();
+}
+
+void configErase() {
+  config_dirty = false;
+  preferences.begin("ntpclock", false);
+  preferences.clear();
+  preferences.end();
+  memset(&config_stored, 0, sizeof(config_stored));
+}
+
+// -----------------------------------------------
+// Timekeeping
+// -----------------------------------------------
+// The arithmetic is in clock_core.h; these apply it to the network task's
+// clock and zone.
+int64_t utcAtMono(int64_t mono_us) {
+  return clockUtcAt(clock_state, mono_us);
+}
+
+int64_t utcNowUs() {
+  return utcAtMono(esp_timer_get_time());
+}
+
+// Correction still to be slewed in at mono_us
+int64_t slewPendingAt(int64_t mono_us) {
+  return clock_state.slew_total_us - slewApplied(clock_state, mono_us - clock_state.mono_base_us);
+}
+
+// Folds elapsed time, frequency and applied slew into the base
+void rebaseClock(int64_t mono_us) {
+  clock_state.utc_base_us = utcAtMono(mono_us);
+  clock_state.slew_total_us = slewPendingAt(mono_us);
+  clock_state.mono_base_us = mono_us;
+}
+
+uint32_t persistedClockChecksum(const PersistedClock& saved) {
+  const uint8_t* p = (const uint8_t*)&saved;
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < offsetof(PersistedClock, checksum); i++) hash = (hash ^ p[i]) * 16777619u;
+  return hash;
+}
+
+// Hands the disciplined time to the RTC-backed system clock and records
+// the drift, so a warm restart can show the time before Wi-Fi is up
+void persistClock() {
+  int64_t utc_us = utcNowUs();
+  struct timeval tv = {(time_t)(utc_us / 1000000), (suseconds_t)(utc_us % 1000000)};
+  settimeofday(&tv, NULL);
+
+  memset(&persisted_clock, 0, sizeof(persisted_clock));
+  persisted_clock.magic = CLOCK_PERSIST_MAGIC;
+  persisted_clock.poll_log2sec = poll_log2sec;
+  persisted_clock.freq_ppb = clock_state.freq_ppb;
+  persisted_clock.last_sync_utc_us = utc_us;
+  persisted_clock.checksum = persistedClockChecksum(persisted_clock);
+}
+
+// Seeds the clock from the system time after a software reset. The time
+// is shown but stays unverified, and the first NTP sync steps it.
+void restoreClock() {
+  if (persisted_clock.magic != CLOCK_PERSIST_MAGIC ||
+      persisted_clock.checksum != persistedClockChecksum(persisted_clock)) {
+    return;  // cold boot: RTC memory holds garbage
+  }
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  int64_t utc_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+  int64_t age_us = utc_us - persisted_clock.last_sync_utc_us;
+  if (age_us < 0 || age_us > CLOCK_RESTORE_MAX_AGE_US) return;
+
+  clock_state.utc_base_us = utc_us;
+  clock_state.mono_base_us = esp_timer_get_time();
+  clock_state.freq_ppb = constrain(persisted_clock.freq_ppb, -CLOCK_MAX_FREQ_PPB, CLOCK_MAX_FREQ_PPB);
+  clock_state.slew_total_us = 0;
+  poll_log2sec = constrain(persisted_clock.poll_log2sec, minpoll_Log2sec, maxpoll_Log2sec);
+  time_valid = true;
+  time_restored = true;
+  time_generation++;
+  Serial.printf("Restored time from before restart, last synced %lld s ago\n", (long long)(age_us / 1000000));
+}
+
+int32_t utcOffsetSeconds(time_t utc) {
+  return tzOffset(tz_rule, tz_window, utc);
+}
+
+time_t localNow() {
+  time_t utc = utcNowUs() / 1000000;
+  return utc + utcOffsetSeconds(utc);
+}
+
+void localTimeOfDay(int& hours, int& minutes, int& seconds) {
+  long secOfDay = localNow() % 86400;
+  hours = secOfDay / 3600;
+  minutes = (secOfDay / 60) % 60;
+  seconds = secOfDay % 60;
+}
+
+// -----------------------------------------------
+// NTP Client (non-blocking)
+// -----------------------------------------------
+// A request is sent from loop() and the reply is picked up on a later
+// iteration, so a lost packet costs at most one deadline check per pass
+// instead of stalling the display, web server and OTA.
+
+void ntpDnsFound(const char* name, const ip_addr_t* ipaddr, void* arg) {
+  if ((uint32_t)(uintptr_t)arg != ntp_dns_generation) return;  // stale lookup
+  if (ipaddr && IP_IS_V4(ipaddr)) {
+    ntp_dns_addr = ip4_addr_get_u32(ip_2_ip4(ipaddr));
+    ntp_dns_result = 1;
+  } else {
+    ntp_dns_result = -1;
+  }
+}
+
+// Runs in the lwIP thread; the result arrives via ntpDnsFound()
+void ntpDnsStart(void* arg) {
+  ip_addr_t addr;
+  err_t err = dns_gethostbyname(ntp_dns_host, &addr, ntpDnsFound, arg);
+  if (err == ERR_OK) {
+    ntpDnsFound(ntp_dns_host, &addr, arg);
+  } else if (err != ERR_INPROGRESS) {
+    ntpDnsFound(ntp_dns_host, NULL, arg);
+  }
+}
+
+// Splits the comma-separated ntp_server setting into peers
+void ntpClientBegin() {
+  wifiUdp.stop();
+  wifiUdp.begin(NTP_LOCAL_PORT);
+  ntp_state = NTP_IDLE;
+  ntp_selected_peer = -1;
+  ntp_survivor_count = 0;
+  ntp_peer_count = 0;
+
+  const char* p = ntp_server.c_str();
+  while (*p && ntp_peer_count < NTP_MAX_SERVERS) {
+    while (*p == ',' || *p == ' ') p++;
+    const char* end = p;
+    while (*end && *end != ',' && *end != ' ') end++;
+    size_t len = end - p;
+    if (len > 0 && len < sizeof(ntp_peers[0].host)) {
+      NtpPeer& peer = ntp_peers[ntp_peer_count++];
+      peer = NtpPeer();
+      memcpy(peer.host, p, len);
+      peer.resolved = peer.ip.fromString(peer.host);
+    }
+    p = end;
+  }
+  ntp_force_update = true;
+}
+
+int ntpNextUnresolved(int from) {
+  for (int i = from; i < ntp_peer_count; i++) {
+    if (!ntp_peers[i].resolved) return i;
+  }
+  return -1;
+}
+
+void ntpStartResolve(int index) {
+  ntp_resolve_index = index;
+  strncpy(ntp_dns_host, ntp_peers[index].host, sizeof(ntp_dns_host) - 1);
+  ntp_dns_host[sizeof(ntp_dns_host) - 1] = '\0';
+  ntp_dns_result = 0;
+  uint32_t generation = ++ntp_dns_generation;
+  ntp_deadline = millis() + NTP_DNS_TIMEOUT_MSEC;
+  ntp_state = NTP_RESOLVING;
+  if (tcpip_callback(ntpDnsStart, (void*)(uintptr_t)generation) != ERR_OK) {
+    ntp_dns_result = -1;
+  }
+}
+
+void writeNtpTimestamp(uint8_t* p, int64_t unix_us) {
+  uint64_t seconds = (uint64_t)(unix_us / 1000000 + NTP_UNIX_OFFSET);
+  uint64_t fraction = ((uint64_t)(unix_us % 1000000) << 32) / 1000000;
+  uint64_t v = (seconds << 32) | fraction;
+  for (int i = 7; i >= 0; i--, v >>= 8) p[i] = v & 0xFF;
+}
+
+// Queries every resolved peer at once; replies are matched by originate stamp
+void ntpSendRequests() {
+  while (wifiUdp.parsePacket() > 0) wifiUdp.flush();  // drop late replies
+
+  uint8_t packet[NTP_PACKET_SIZE];
+  for (int i = 0; i < ntp_peer_count; i++) {
+    NtpPeer& peer = ntp_peers[i];
+    peer.polled = false;
+    peer.replied = false;
+    if (!peer.resolved) continue;
+
+    memset(packet, 0, NTP_PACKET_SIZE);
+    packet[0] = 0x23;  // LI 0, version 4, mode 3 (client)
+    peer.sent_mono_us = esp_timer_get_time();
+    // Transmit timestamp doubles as a nonce; the peer index keeps them unique
+    writeNtpTimestamp(peer.sent_stamp, utcNowUs() + i);
+    memcpy(packet + 40, peer.sent_stamp, 8);
+
+    wifiUdp.beginPacket(peer.ip, NTP_PORT);
+    wifiUdp.write(packet, NTP_PACKET_SIZE);
+    peer.polled = wifiUdp.endPacket() != 0;
+  }
+
+  ntp_deadline = millis() + NTP_TIMEOUT_MSEC;
+  ntp_state = NTP_WAITING;
+}
+
+void ntpStartRound() {
+  lastExecutedMillis_2 = millis();
+  int index = ntpNextUnresolved(0);
+  if (index >= 0) {
+    ntpStartResolve(index);
+  } else {
+    ntpSendRequests();
+  }
+}
+
+uint64_t readNtpTimestamp(const uint8_t* p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+  return v;
+}
+
+void writeNtpShort(uint8_t* p, uint32_t us) {
+  uint32_t v = (uint32_t)(((uint64_t)us << 16) / 1000000);  // microseconds to 16.16 seconds
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+uint32_t readNtpShort(const uint8_t* p) {
+  uint32_t v = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+  uint64_t us = ((uint64_t)v * 1000000ULL) >> 16;  // 16.16 seconds to microseconds
+  return us > NTP_MAX_DISPERSION_US ? NTP_MAX_DISPERSION_US : (uint32_t)us;
+}
+
+// Root delay and dispersion sums, capped at MAXDISP so a bad server or a
+// long-unsynced clock can't wrap them back to small values
+uint32_t ntpRootAdd(uint32_t base_us, int64_t add_us) {
+  int64_t sum = (int64_t)base_us + (add_us > 0 ? add_us : 0);
+  return sum > NTP_MAX_DISPERSION_US ? NTP_MAX_DISPERSION_US : (uint32_t)sum;
+}
+
+// NTP 32.32 fixed point to microseconds since the Unix epoch
+int64_t ntpToUnixUs(uint64_t ts) {
+  int64_t seconds = (int64_t)(ts >> 32) - NTP_UNIX_OFFSET;
+  int64_t fraction = (int64_t)(((ts & 0xFFFFFFFFULL) * 1000000ULL) >> 32);
+  return seconds * 1000000LL + fraction;
+}
+
+void ntpReadReply() {
+  int64_t recv_mono_us = esp_timer_get_time();
+  uint8_t reply[NTP_PACKET_SIZE];
+  if (wifiUdp.read(reply, NTP_PACKET_SIZE) != NTP_PACKET_SIZE) return;
+
+  uint8_t mode = reply[0] & 0x07;
+  uint8_t stratum = reply[1];
+  if (mode != 4 || stratum == 0 || stratum > 15) return;  // not a server reply / kiss-o'-death
+
+  NtpPeer* peer = NULL;
+  for (int i = 0; i < ntp_peer_count; i++) {
+    NtpPeer& p = ntp_peers[i];
+    if (p.polled && !p.replied && memcmp(reply + 24, p.sent_stamp, 8) == 0) peer = &p;
+  }
+  if (!peer) return;  // originate must echo one of our requests
+
+  int64_t t1 = utcAtMono(peer->sent_mono_us);
+  int64_t t2 = ntpToUnixUs(readNtpTimestamp(reply + 32));  // server receive
+  int64_t t3 = ntpToUnixUs(readNtpTimestamp(reply + 40));  // server transmit
+  int64_t t4 = utcAtMono(recv_mono_us);
+  int64_t round_trip = (t4 - t1) - (t3 - t2);
+  if (round_trip < 0) round_trip = 0;
+
+  // Offsets are kept relative to the clock as it will be once the pending slew completes
+  NtpSample& sample = peer->samples[peer->sample_next];
+  sample.offset_us = ((t2 - t1) + (t3 - t4)) / 2 - slewPendingAt(recv_mono_us);
+  sample.delay_us = (uint32_t)round_trip;
+  sample.distance_us = ntpRootAdd(sample.delay_us / 2,
+                                  readNtpShort(reply + 4) / 2 + readNtpShort(reply + 8) + NTP_MIN_DISPERSION_US);
+  sample.mono_us = recv_mono_us;
+  peer->sample_next = (peer->sample_next + 1) % NTP_FILTER_SIZE;
+  if (peer->sample_count < NTP_FILTER_SIZE) peer->sample_count++;
+  telemetryRecord(TEL_NTP_SAMPLE, "ntp", sample.offset_us, sample.delay_us);
+  peer->stratum = stratum;
+  peer->root_delay_us = readNtpShort(reply + 4);
+  peer->root_disp_us = readNtpShort(reply + 8);
+  peer->replied = true;
+  peer->filtered = peer->samples[ntpFilter(peer->samples, peer->sample_count, recv_mono_us)];
+}
+
+// Runs ntpSelect() over the reachable peers' filtered samples
+int ntpSelectPeer() {
+  NtpSample candidates[NTP_MAX_SERVERS];
+  int peer_index[NTP_MAX_SERVERS];
+  int n = 0;
+  for (int i = 0; i < ntp_peer_count; i++) {
+    NtpPeer& peer = ntp_peers[i];
+    if (peer.reach == 0 || peer.sample_count == 0) continue;
+    candidates[n] = peer.filtered;
+    peer_index[n++] = i;
+  }
+  int chosen = ntpSelect(candidates, n, esp_timer_get_time(), ntp_survivor_count);
+  return chosen < 0 ? -1 : peer_index[chosen];
+}
+
+// Steps or slews the clock by offset_us, updates the frequency estimate
+// from the residual offset and adapts the poll interval. True if it stepped.
+bool disciplineClock(int64_t offset_us) {
+  int64_t now = esp_timer_get_time();
+  rebaseClock(now);
+  int64_t correction = offset_us + clock_state.slew_total_us;
+
+  bool step = !time_verified || llabs(correction) > CLOCK_STEP_THRESHOLD_US;
+  if (step) {
+    clock_state.utc_base_us += correction;
+    clock_state.slew_total_us = 0;
+    poll_stable_count = 0;
+  } else {
+    // Any offset left after the previous correction is accumulated drift
+    int64_t interval = now - last_sync_mono_us;
+    if (last_sync_mono_us != 0 && interval >= 60000000LL) {
+      clock_state.freq_ppb += offset_us * 1000000000LL / interval / 2;
+      clock_state.freq_ppb = constrain(clock_state.freq_ppb, -CLOCK_MAX_FREQ_PPB, CLOCK_MAX_FREQ_PPB);
+    }
+    clock_state.slew_total_us = correction;
+
+    if (llabs(offset_us) < POLL_STABLE_US) {
+      if (++poll_stable_count >= 3 && poll_log2sec < maxpoll_Log2sec) {
+        poll_log2sec++;
+        poll_stable_count = 0;
+      }
+    } else if (llabs(offset_us) > POLL_UNSTABLE_US) {
+      if (poll_log2sec > minpoll_Log2sec) poll_log2sec--;
+      poll_stable_count = 0;
+    }
+  }
+  last_sync_mono_us = now;
+  time_valid = true;
+  time_verified = true;
+  time_generation++;
+  persistClock();
+
+  // Filter registers stay relative to the corrected clock
+  for (int i = 0; i < ntp_peer_count; i++) {
+    NtpPeer& peer = ntp_peers[i];
+    for (int k = 0; k < peer.sample_count; k++) peer.samples[k].offset_us -= offset_us;
+    if (peer.sample_count > 0) peer.filtered.offset_us -= offset_us;
+  }
+  return step;
+}
+
+void ntpRoundFinished() {
+  ntp_state = NTP_IDLE;
+  bool any_reply = false;
+  for (int i = 0; i < ntp_peer_count; i++) {
+    NtpPeer& peer = ntp_peers[i];
+    peer.reach = (peer.reach << 1) | (peer.replied ? 1 : 0);
+    if (peer.replied) any_reply = true;
+    // Re-resolve silent pool names so a dead address gets replaced
+    if (!peer.replied && (peer.reach & 0x07) == 0) peer.resolved = peer.ip.fromString(peer.host);
+  }
+
+  ntp_selected_peer = any_reply ? ntpSelectPeer() : -1;
+  if (ntp_selected_peer < 0) {
+    last_update = false;
+    Serial.println("Failed to obtain time.");
+    telemetryRecord(TEL_NTP_FAIL, "ntp", 0, 0);
+    return;
+  }
+
+  NtpPeer& peer = ntp_peers[ntp_selected_peer];
+  last_offset_us = peer.filtered.offset_us;
+  bool stepped = disciplineClock(last_offset_us);
+  last_update = true;
+  telemetryRecord(TEL_NTP_SYNC, "ntp", last_offset_us, poll_log2sec);
+
+  ntp_ref_stratum = peer.stratum;
+  for (int i = 0; i < 4; i++) ntp_ref_id[i] = peer.ip[i];
+  // A step leaves no residual offset behind; a slew has the whole offset still to go
+  ntp_ref_root_delay_us = ntpRootAdd(peer.root_delay_us, peer.filtered.delay_us);
+  ntp_ref_root_disp_us = ntpRootAdd(peer.root_disp_us, NTP_MIN_DISPERSION_US + (stepped ? 0 : llabs(last_offset_us)));
+}
+
+bool ntpAllReplied() {
+  for (int i = 0; i < ntp_peer_count; i++) {
+    if (ntp_peers[i].polled && !ntp_peers[i].replied) return false;
+  }
+  return true;
+}
+
+// Advances the request state machine; never blocks
+void ntpClientPoll() {
+  unsigned long currentMillis = millis();
+  switch (ntp_state) {
+    case NTP_IDLE: {
+      if (beacon_locked) break;  // following a leader on the LAN
+      uint32_t interval = last_update ? (1000UL << poll_log2sec) : retryinterval_Msec;
+      if (ntp_peer_count > 0 && (ntp_force_update || currentMillis - lastExecutedMillis_2 >= interval)) {
+        ntp_force_update = false;
+        ntpStartRound();
+      }
+      break;
+    }
+    case NTP_RESOLVING: {
+      bool timed_out = (long)(currentMillis - ntp_deadline) >= 0;
+      if (ntp_dns_result == 0 && !timed_out) break;
+      if (ntp_dns_result == 1) {
+        ntp_peers[ntp_resolve_index].ip = IPAddress(ntp_dns_addr);
+        ntp_peers[ntp_resolve_index].resolved = true;
+      }
+      ntp_dns_generation++;  // ignore a late callback
+      int next = ntpNextUnresolved(ntp_resolve_index + 1);
+      if (next >= 0) {
+        ntpStartResolve(next);
+      } else {
+        ntpSendRequests();
+      }
+      break;
+    }
+    case NTP_WAITING:
+      while (wifiUdp.parsePacket() > 0) ntpReadReply();
+      if (ntpAllReplied() || (long)(currentMillis - ntp_deadline) >= 0) {
+        ntpRoundFinished();
+      }
+      break;
+  }
+}
+
+// -----------------------------------------------
+// NTP Server
 // -----------------------------------------------
-WiFiUDP wifiUdp;
-NTP ntp(wifiUdp);
-TM1640 module(PIN_DIO, PIN_CLOCK, PIN_STB);
-WebServer server(80);
-DNSServer dnsServer;
-Preferences preferences;
+// With serve_ntp on, a task on the protocol core answers client requests
+// on UDP 123 from the disciplined clock, so the rest of a site can sync
+// to one or two clocks instead of each polling the pool. It blocks in
+// recvfrom() and reads only the published snapshot, so replies are
+// stamped within microseconds of arrival regardless of what the network
+// loop is doing.
+
+void publishNtpServerState() {
+  NtpServerState state;
+  int64_t now = esp_timer_get_time();
+  state.clock = clock_state;
+  state.enabled = serve_ntp && time_valid;
+  state.synced = time_verified && ntp_ref_stratum > 0 && ntp_ref_stratum < 15 &&
+                 now - last_sync_mono_us < NTP_SERVER_MAX_AGE_US;
+  state.stratum = ntp_ref_stratum + 1;
+  state.poll_log2sec = poll_log2sec;
+  memcpy(state.refid, ntp_ref_id, sizeof(state.refid));
+  state.root_delay_us = ntp_ref_root_delay_us;
+  state.root_disp_us = ntp_ref_root_disp_us;
+  state.ref_mono_us = last_sync_mono_us;
+  ntp_server_state.publish(state);
+}
 
-// -----------------------------------------------
-// State Variables
-// -----------------------------------------------
-String wifi_ssid = "";
-String wifi_pass = "";
-String ntp_server = "pool.ntp.org";
-int timezone_index = 0;  // Default to Eastern
-bool wifi_connected = false;
-bool ap_mode = true;
-bool config_saved = false;
+// Turns a client request into the reply in place; false if it is not one
+bool ntpServerReply(uint8_t* packet, int length, const NtpServerState& state, int64_t recv_mono_us) {
+  if (length < NTP_PACKET_SIZE) return false;
+  uint8_t version = (packet[0] >> 3) & 0x07;
+  uint8_t mode = packet[0] & 0x07;
+  if (mode != 3 || version < 1 || version > 4) return false;
+
+  uint8_t poll = packet[2];
+  uint8_t originate[8];
+  memcpy(originate, packet + 40, 8);
+  memset(packet, 0, NTP_PACKET_SIZE);
+
+  // Leap indicator 3 and stratum 16 tell clients not to trust us yet
+  packet[0] = (state.synced ? 0x00 : 0xC0) | (version << 3) | 4;
+  packet[1] = state.synced ? state.stratum : 16;
+  packet[2] = poll > state.poll_log2sec ? poll : state.poll_log2sec;
+  packet[3] = (uint8_t)NTP_SERVER_PRECISION;
+  if (state.synced) {
+    int64_t age_us = recv_mono_us - state.ref_mono_us;
+    writeNtpShort(packet + 4, state.root_delay_us);
+    writeNtpShort(packet + 8, ntpRootAdd(state.root_disp_us, age_us * NTP_PHI_PPM / 1000000));
+    memcpy(packet + 12, state.refid, 4);
+    writeNtpTimestamp(packet + 16, clockUtcAt(state.clock, state.ref_mono_us));
+  } else {
+    memcpy(packet + 12, "INIT", 4);
+  }
+  memcpy(packet + 24, originate, 8);
+  writeNtpTimestamp(packet + 32, clockUtcAt(state.clock, recv_mono_us));
+  writeNtpTimestamp(packet + 40, clockUtcAt(state.clock, esp_timer_get_time()));  // as late as possible
+  return true;
+}
 
-unsigned long lastExecutedMillis_1 = 0;
-unsigned long lastExecutedMillis_2 = 0;
-unsigned long lastExecutedMillis_3 = 0;
-bool last_update = false;
-int digits[] = {0, 0, 0, 0};
-bool blink_on = true;
+void ntpServerTask(void* arg) {
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(NTP_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    Serial.println("NTP server: cannot bind UDP port 123");
+    if (sock >= 0) closesocket(sock);
+    ntp_server_task_handle = NULL;
+    vTaskDelete(NULL);
+    return;
+  }
+
+  uint8_t packet[NTP_PACKET_SIZE];
+  NtpServerState state;
+  for (;;) {
+    struct sockaddr_in client;
+    socklen_t client_len = sizeof(client);
+    int length = recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr*)&client, &client_len);
+    int64_t recv_mono_us = esp_timer_get_time();
+    if (length < 0) {
+      delay(100);  // interface going down; retry rather than spin
+      continue;
+    }
+
+    ntp_server_state.read(state);
+    if (!state.enabled) continue;
+    if (!ntpServerReply(packet, length, state, recv_mono_us)) {
+      ntp_server_dropped++;
+      continue;
+    }
+    if (sendto(sock, packet, NTP_PACKET_SIZE, 0, (struct sockaddr*)&client, client_len) == NTP_PACKET_SIZE) {
+      ntp_served++;
+    }
+  }
+}
+
+// Starts the server task the first time serving is enabled; turning the
+// setting off again only stops the replies
+void ntpServerBegin() {
+  publishNtpServerState();
+  if (!serve_ntp || ntp_server_task_handle) return;
+  startTask(ntpServerTask, "ntpserver", NTP_SERVER_TASK_STACK, NTP_SERVER_TASK_PRIORITY, &ntp_server_task_handle,
+            NETWORK_TASK_CORE);  // on failure the next settings save tries again
+}
 
 // -----------------------------------------------
-// HTML Templates
+// Time Beacons
 // -----------------------------------------------
-void sendHTML(int code, const String& html) {
-  server.sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
-  server.sendHeader("Pragma", "no-cache");
-  server.sendHeader("Expires", "-1");
-  server.sendHeader("Connection", "close");
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  server.sendHeader("Access-Control-Allow-Methods", "GET, POST, OPTIONS");
-  server.sendHeader("Access-Control-Allow-Headers", "*");
-  server.send(code, "text/html; charset=utf-8", html);
+// NTP polls every few minutes keep each clock within a few milliseconds,
+// but not of each other. A leader multicasts a small signed packet
+// carrying its clock once a second, stamped just before sending;
+// followers measure their offset from each arrival. Arrival delay only
+// ever makes the offset look smaller, so the largest offset in a window
+// is the best estimate, and it goes through the same discipline as an
+// NTP sample. While beacons keep arriving a follower stops polling NTP.
+//
+// Packet, big endian: magic(4) version(1) flags(1) stratum(1) reserved(1)
+// seq(4) utc_us(8) reserved(4), then the first 8 bytes of
+// HMAC-SHA256(beacon_key, body).
+
+void beaconSign(const uint8_t* body, uint8_t* mac) {
+  uint8_t digest[32];
+  mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), (const uint8_t*)beacon_key.c_str(),
+                  beacon_key.length(), body, BEACON_BODY_SIZE, digest);
+  memcpy(mac, digest, BEACON_MAC_SIZE);
 }
 
-void handleOptions() {
-  server.sendHeader("Access-Control-Allow-Origin", "*");
-  server.sendHeader("Access-Control-Allow-Methods", "GET, POST, OPTIONS");
-  server.sendHeader("Access-Control-Allow-Headers", "*");
-  server.send(204);
+void writeBigEndian(uint8_t* p, uint64_t v, int bytes) {
+  for (int i = bytes - 1; i >= 0; i--, v >>= 8) p[i] = v & 0xFF;
 }
 
-String getHTMLHeader(const char* title) {
-  return "<!DOCTYPE html><html><head>"
-         "<meta charset='UTF-8'>"
-         "<meta name='viewport' content='width=device-width, initial-scale=1, user-scalable=yes'>"
-         "<title>" + String(title) + "</title>"
-         "<style>"
-         "body{font-family:Arial,sans-serif;margin:0;padding:20px;background:#1a1a2e;color:#eee;}"
-         ".container{max-width:400px;margin:0 auto;}"
-         "h1{color:#0f9;text-align:center;}"
-         "h2{color:#0cf;border-bottom:1px solid #333;padding-bottom:10px;}"
-         ".card{background:#16213e;border-radius:10px;padding:20px;margin:15px 0;box-shadow:0 4px 6px rgba(0,0,0,0.3);}"
-         "label{display:block;margin:10px 0 5px;color:#aaa;}"
-         "input[type=text],input[type=password],select{width:100%;padding:12px;margin:5px 0 15px;border:1px solid #333;border-radius:5px;background:#0d1b2a;color:#fff;box-sizing:border-box;}"
-         "input[type=submit],button{width:100%;padding:14px;background:#0f9;color:#000;border:none;border-radius:5px;cursor:pointer;font-size:16px;font-weight:bold;margin:10px 0;}"
-         "input[type=submit]:hover,button:hover{background:#0da;}"
-         ".btn-secondary{background:#0cf;}"
-         ".btn-danger{background:#f55;color:#fff;}"
-         ".network{padding:12px;margin:8px 0;background:#0d1b2a;border-radius:5px;cursor:pointer;border:1px solid #333;display:flex;justify-content:space-between;align-items:center;}"
-         ".network:hover{border-color:#0f9;}"
-         ".ssid-name{flex:1;}"
-         ".bars{display:flex;align-items:flex-end;gap:2px;height:20px;}"
-         ".bar{width:4px;border-radius:1px;}"
-         ".bar.on{background:#0f9;}"
-         ".bar.off{background:#333;}"
-         ".info{background:#1e3a5f;padding:15px;border-radius:5px;margin:10px 0;}"
-         ".info p{margin:5px 0;}"
-         ".success{color:#0f9;}"
-         ".error{color:#f55;}"
-         "a{color:#0cf;}"
-         "</style></head><body><div class='container'>";
-}
-
-String getHTMLFooter() {
-  return "</div></body></html>";
+uint64_t readBigEndian(const uint8_t* p, int bytes) {
+  uint64_t v = 0;
+  for (int i = 0; i < bytes; i++) v = (v << 8) | p[i];
+  return v;
 }
 
-// -----------------------------------------------
-// WiFi Scanning
-// -----------------------------------------------
-String scanNetworks() {
-  String html = "";
-  int n = WiFi.scanNetworks();
-  if (n == 0) {
-    html += "<p>No networks found. <a href='/scan'>Scan again</a></p>";
-  } else {
-    // Collect unique SSIDs with best signal strength
-    String uniqueSSIDs[20];
-    int uniqueRSSI[20];
-    int uniqueCount = 0;
-
-    for (int i = 0; i < n && uniqueCount < 20; i++) {
-      String ssid = WiFi.SSID(i);
-      if (ssid.length() == 0) continue;  // Skip hidden networks
-
-      // Check if SSID already exists
-      bool found = false;
-      for (int j = 0; j < uniqueCount; j++) {
-        if (uniqueSSIDs[j] == ssid) {
-          // Keep the stronger signal
-          if (WiFi.RSSI(i) > uniqueRSSI[j]) {
-            uniqueRSSI[j] = WiFi.RSSI(i);
-          }
-          found = true;
-          break;
-        }
-      }
-      if (!found) {
-        uniqueSSIDs[uniqueCount] = ssid;
-        uniqueRSSI[uniqueCount] = WiFi.RSSI(i);
-        uniqueCount++;
-      }
-    }
+void beaconBegin() {
+  beaconUdp.stop();
+  beacon_locked = false;
+  beacon_window_count = 0;
+  beacon_last_utc_us = 0;
+  beacon_next_utc_us = 0;
+  if (beacon_mode != BEACON_OFF && beacon_key.length() == 0) {
+    Serial.println("Time beacon needs a key, turned off.");
+    beacon_mode = BEACON_OFF;
+  }
+  if (beacon_mode != BEACON_OFF) beaconUdp.beginMulticast(BEACON_GROUP, BEACON_PORT);
+}
 
-    html += "<form action='/connect' method='post'>";
-    for (int i = 0; i < uniqueCount; i++) {
-      int rssi = uniqueRSSI[i];
-      int bars = 1;
-      if (rssi > -50) bars = 4;
-      else if (rssi > -60) bars = 3;
-      else if (rssi > -70) bars = 2;
-
-      String signalBars = "<span class='bars'>";
-      for (int b = 1; b <= 4; b++) {
-        if (b <= bars) {
-          signalBars += "<span class='bar on' style='height:" + String(b * 4 + 4) + "px'></span>";
-        } else {
-          signalBars += "<span class='bar off' style='height:" + String(b * 4 + 4) + "px'></span>";
-        }
-      }
-      signalBars += "</span>";
+// True shortly before and after a second boundary, when beacons go out
+bool beaconDue() {
+  if (beacon_mode == BEACON_OFF || !wifi_connected || !time_valid) return false;
+  int64_t ms = (utcNowUs() / 1000) % 1000;
+  return ms >= 995 || ms < 20;
+}
+
+void beaconSend() {
+  uint8_t packet[BEACON_PACKET_SIZE];
+  memset(packet, 0, sizeof(packet));
+  writeBigEndian(packet, BEACON_MAGIC, 4);
+  packet[4] = BEACON_VERSION;
+  packet[5] = last_update ? 0x01 : 0x00;
+  packet[6] = ntp_ref_stratum + 1;
+  writeBigEndian(packet + 8, ++beacon_seq, 4);
+  writeBigEndian(packet + 12, (uint64_t)utcNowUs(), 8);
+  beaconSign(packet, packet + BEACON_BODY_SIZE);
+  beaconUdp.beginMulticastPacket();
+  beaconUdp.write(packet, sizeof(packet));
+  if (beaconUdp.endPacket()) beacon_sent++;
+}
+
+void beaconRead() {
+  int64_t recv_mono_us = esp_timer_get_time();
+  uint8_t packet[BEACON_PACKET_SIZE];
+  if (beaconUdp.read(packet, sizeof(packet)) != BEACON_PACKET_SIZE) {
+    beacon_rejected++;
+    return;
+  }
+  if (beacon_mode != BEACON_FOLLOW) return;  // a leader hears its own
+
+  uint8_t mac[BEACON_MAC_SIZE];
+  beaconSign(packet, mac);
+  int64_t utc_us = (int64_t)readBigEndian(packet + 12, 8);
+  // A captured beacon replayed later, even after a gap, is far from our
+  // own clock; it has to have been checked against NTP for that to hold.
+  // Beacons therefore only ever slew a follower, never step it.
+  int64_t local_offset = utc_us - utcAtMono(recv_mono_us);
+  if (readBigEndian(packet, 4) != BEACON_MAGIC || packet[4] != BEACON_VERSION ||
+      memcmp(mac, packet + BEACON_BODY_SIZE, BEACON_MAC_SIZE) != 0 || utc_us <= beacon_last_utc_us ||
+      !time_verified || llabs(local_offset) > BEACON_MAX_OFFSET_US) {
+    beacon_rejected++;
+    return;
+  }
+  beacon_received++;
+  beacon_last_utc_us = utc_us;
+  if (!(packet[5] & 0x01)) return;  // leader not synced itself
+  beacon_heard_at = millis();
+  beacon_stratum = packet[6];
+  IPAddress leader = beaconUdp.remoteIP();
+  for (int i = 0; i < 4; i++) beacon_leader[i] = leader[i];
+
+  int64_t offset = local_offset - slewPendingAt(recv_mono_us);
+  if (beacon_window_count == 0 || offset > beacon_window_max_us) beacon_window_max_us = offset;
+  if (beacon_window_count == 0 || offset < beacon_window_min_us) beacon_window_min_us = offset;
+  if (++beacon_window_count < (beacon_locked ? BEACON_WINDOW : BEACON_FIRST_WINDOW)) return;
+
+  beacon_offset_us = beacon_window_max_us;
+  beacon_spread_us = beacon_window_max_us - beacon_window_min_us;
+  beacon_window_count = 0;
+  bool stepped = disciplineClock(beacon_offset_us);
+  last_update = true;
+  telemetryRecord(TEL_NTP_SYNC, "beacon", beacon_offset_us, beacon_spread_us);
+  last_offset_us = beacon_offset_us;
+  beacon_locked = true;
+
+  ntp_ref_stratum = beacon_stratum;
+  memcpy(ntp_ref_id, beacon_leader, sizeof(ntp_ref_id));
+  ntp_ref_root_delay_us = 0;
+  ntp_ref_root_disp_us = ntpRootAdd(NTP_MIN_DISPERSION_US, beacon_spread_us + (stepped ? 0 : llabs(beacon_offset_us)));
+}
 
-      html += "<div class='network' onclick=\"document.getElementById('ssid').value='" + uniqueSSIDs[i] + "'\">";
-      html += "<span class='ssid-name'>" + uniqueSSIDs[i] + "</span>";
-      html += signalBars;
-      html += "</div>";
+void beaconPoll() {
+  if (beacon_mode == BEACON_OFF) return;
+  while (beaconUdp.parsePacket() > 0) beaconRead();
+
+  if (beacon_mode == BEACON_LEAD && time_verified) {
+    int64_t now = utcNowUs();
+    if (now >= beacon_next_utc_us) {
+      beaconSend();
+      beacon_next_utc_us = (now / 1000000 + 1) * 1000000;
     }
-    html += "<label>Selected Network:</label>";
-    html += "<input type='text' id='ssid' name='ssid' placeholder='Click a network above or type SSID'>";
-    html += "<label>Password:</label>";
-    html += "<input type='password' name='password' placeholder='WiFi Password'>";
-    html += "<input type='submit' value='Connect to WiFi'>";
-    html += "</form>";
   }
-  WiFi.scanDelete();
-  return html;
+
+  if (beacon_locked && millis() - beacon_heard_at > BEACON_TIMEOUT_MSEC) {
+    Serial.println("Time beacons lost, back to NTP.");
+    beacon_locked = false;
+    beacon_window_count = 0;
+    ntp_force_update = true;
+  }
 }
 
 // -----------------------------------------------
-// Web Handlers - AP Mode
+// Captive Portal DNS
 // -----------------------------------------------
-void handleRoot() {
-  if (ap_mode) {
-    String html = getHTMLHeader("NTP Clock Setup");
-    html += "<h1>NTP Clock Setup</h1>";
-    html += "<div class='card'>";
-    html += "<h2>WiFi Networks</h2>";
-    html += scanNetworks();
-    html += "</div>";
-    html += getHTMLFooter();
-    sendHTML(200, html);
-  } else {
-    handleStatus();
+// In setup mode every A query is answered with the soft-AP address, from
+// a task that blocks in recvfrom() and so costs nothing between packets
+// and is not held up by a Wi-Fi scan or a page being rendered. The
+// answer record is built once; replies copy the question and append it.
+// Portal-detection hosts get a 1 s TTL so devices do not keep the fake
+// address once the clock has joined the real network. Other record types
+// get an empty answer at once rather than a timeout.
+
+void captiveDnsRecord(uint8_t* record, IPAddress ip, uint32_t ttl) {
+  record[0] = 0xC0;  // name: pointer to the question
+  record[1] = 0x0C;
+  writeBigEndian(record + 2, 1, 2);  // type A
+  writeBigEndian(record + 4, 1, 2);  // class IN
+  writeBigEndian(record + 6, ttl, 4);
+  writeBigEndian(record + 10, 4, 2);
+  for (int i = 0; i < 4; i++) record[12 + i] = ip[i];
+}
+
+bool captiveProbeHost(const char* name) {
+  for (const char* host : CAPTIVE_PROBE_HOSTS) {
+    if (strcasecmp(name, host) == 0) return true;
   }
+  return false;
 }
 
-void handleScan() {
-  handleRoot();
+// Turns a query into the reply in place and returns its length, 0 to drop
+int captiveDnsReply(uint8_t* packet, int length) {
+  if (length < 12 || (packet[2] & 0xF8) != 0 || readBigEndian(packet + 4, 2) != 1) return 0;  // standard query, one question
+
+  char name[128];
+  size_t name_len = 0;
+  int pos = 12;
+  while (pos < length && packet[pos] != 0) {
+    int label = packet[pos++];
+    if (label > 63 || pos + label > length || name_len + label + 1 >= sizeof(name)) return 0;
+    if (name_len > 0) name[name_len++] = '.';
+    memcpy(name + name_len, packet + pos, label);
+    name_len += label;
+    pos += label;
+  }
+  name[name_len] = '\0';
+  if (pos + 5 > length) return 0;
+  uint16_t qtype = readBigEndian(packet + pos + 1, 2);
+  uint16_t qclass = readBigEndian(packet + pos + 3, 2);
+  int question_end = pos + 5;
+
+  bool answer = (qtype == 1 || qtype == 255) && qclass == 1;
+  packet[2] = 0x84 | (packet[2] & 0x01);  // response, authoritative, copy recursion desired
+  packet[3] = 0x00;                       // no error
+  writeBigEndian(packet + 6, answer ? 1 : 0, 2);
+  writeBigEndian(packet + 8, 0, 4);       // no authority or additional records
+  if (!answer) return question_end;
+  memcpy(packet + question_end, captiveProbeHost(name) ? captive_dns_probe_answer : captive_dns_answer, 16);
+  return question_end + 16;
 }
 
-void handleConnect() {
-  if (server.hasArg("ssid") && server.hasArg("password")) {
-    wifi_ssid = server.arg("ssid");
-    wifi_pass = server.arg("password");
+void captiveDnsTask(void* arg) {
+  int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(DNS_PORT);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (sock < 0 || bind(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    Serial.println("Captive DNS: cannot bind UDP port 53");
+    if (sock >= 0) closesocket(sock);
+    captive_dns_task_handle = NULL;
+    vTaskDelete(NULL);
+    return;
+  }
 
-    String html = getHTMLHeader("WiFi Setup");
-    html += "<h1>NTP Clock Setup</h1>";
-    html += "<div class='card'>";
-    html += "<h2>WiFi Selected</h2>";
-    html += "<p>Network: <strong>" + wifi_ssid + "</strong></p>";
-    html += "<p>Now configure your timezone and NTP server.</p>";
-    html += "</div>";
-
-    html += "<div class='card'>";
-    html += "<h2>Timezone & NTP</h2>";
-    html += "<form action='/save' method='post'>";
-    html += "<input type='hidden' name='ssid' value='" + wifi_ssid + "'>";
-    html += "<input type='hidden' name='password' value='" + wifi_pass + "'>";
-
-    html += "<label>Timezone:</label>";
-    html += "<select name='timezone'>";
-    for (int i = 0; i < NUM_TIMEZONES; i++) {
-      String selected = (i == 0) ? " selected" : "";
-      html += "<option value='" + String(i) + "'" + selected + ">" + String(timezones[i].name) + "</option>";
-    }
-    html += "</select>";
-
-    html += "<label>NTP Server:</label>";
-    html += "<input type='text' name='ntpserver' value='pool.ntp.org' placeholder='NTP Server'>";
-
-    html += "<label>Display Brightness: <span id='brightval'>7</span></label>";
-    html += "<input type='range' name='brightness' min='0' max='7' value='7' oninput=\"document.getElementById('brightval').textContent=this.value\" style='width:100%'>";
-
-    html += "<input type='submit' value='Save & Connect'>";
-    html += "</form>";
-    html += "</div>";
-    html += getHTMLFooter();
-    sendHTML(200, html);
-  } else {
-    server.sendHeader("Location", "/");
-    server.send(302);
+  // Room for the question plus the answer record
+  uint8_t packet[DNS_PACKET_MAX + 16];
+  for (;;) {
+    struct sockaddr_in client;
+    socklen_t client_len = sizeof(client);
+    int length = recvfrom(sock, packet, DNS_PACKET_MAX, 0, (struct sockaddr*)&client, &client_len);
+    if (length < 0) {
+      delay(100);
+      continue;
+    }
+    if (!ap_mode) continue;
+    int reply_len = captiveDnsReply(packet, length);
+    if (reply_len > 0) sendto(sock, packet, reply_len, 0, (struct sockaddr*)&client, client_len);
   }
 }
 
-void handleSave() {
-  if (server.hasArg("ssid") && server.hasArg("password") &&
-      server.hasArg("timezone") && server.hasArg("ntpserver")) {
+void captiveDnsBegin(IPAddress ip) {
+  captiveDnsRecord(captive_dns_answer, ip, DNS_TTL_SEC);
+  captiveDnsRecord(captive_dns_probe_answer, ip, DNS_PROBE_TTL_SEC);
+  if (captive_dns_task_handle) return;
+  // Without it the portal is still reachable at the soft-AP address
+  startTask(captiveDnsTask, "dns", CAPTIVE_DNS_TASK_STACK, CAPTIVE_DNS_TASK_PRIORITY, &captive_dns_task_handle,
+            NETWORK_TASK_CORE);
+}
 
-    wifi_ssid = server.arg("ssid");
-    wifi_pass = server.arg("password");
-    timezone_index = server.arg("timezone").toInt();
-    ntp_server = server.arg("ntpserver");
-    if (server.hasArg("brightness")) {
-      display_brightness = server.arg("brightness").toInt();
-      display_brightness = constrain(display_brightness, 0, 7);
-    }
+// -----------------------------------------------
+// Brightness Schedule
+// -----------------------------------------------
+// display_brightness is the daytime level. With dimming on, the level
+// follows the light sensor if one is enabled, otherwise it ramps between
+// night and day around sunrise and sunset (or fixed night hours when no
+// location is set). It is re-evaluated once a second, and the display
+// task only writes to the bus when the resulting level changes.
+
+// 1 in daylight, 0 at night, ramping in between
+float daylightFraction(time_t utc) {
+  time_t local = utc + utcOffsetSeconds(utc);
+  if (!has_location) {
+    int minute = local % 86400 / 60;
+    bool night = NIGHT_START_MIN > NIGHT_END_MIN ? (minute >= NIGHT_START_MIN || minute < NIGHT_END_MIN)
+                                                 : (minute >= NIGHT_START_MIN && minute < NIGHT_END_MIN);
+    return night ? 0 : 1;
+  }
+  long day = local / 86400;
+  if (day != sun_day) {
+    sun_day = day;
+    sun_kind = sunTimesUtc(day, latitude, longitude, sun_rise, sun_set);
+  }
+  if (sun_kind != SUN_NORMAL) return sun_kind == SUN_ALWAYS_UP ? 1 : 0;
+  float up = (float)(utc - (sun_rise - BRIGHTNESS_RAMP_SEC / 2)) / BRIGHTNESS_RAMP_SEC;
+  float down = (float)(sun_set + BRIGHTNESS_RAMP_SEC / 2 - utc) / BRIGHTNESS_RAMP_SEC;
+  return constrain(fminf(up, down), 0.0f, 1.0f);
+}
 
-    // Save to preferences
-    preferences.begin("ntpclock", false);
-    preferences.putString("ssid", wifi_ssid);
-    preferences.putString("pass", wifi_pass);
-    preferences.putInt("tz", timezone_index);
-    preferences.putString("ntp", ntp_server);
-    preferences.putInt("bright", display_brightness);
-    preferences.end();
-
-    config_saved = true;
-
-    String html = getHTMLHeader("Connecting");
-    html += "<h1>NTP Clock Setup</h1>";
-    html += "<div class='card'>";
-    html += "<h2 class='success'>Configuration Saved!</h2>";
-    html += "<div class='info'>";
-    html += "<p><strong>WiFi:</strong> " + wifi_ssid + "</p>";
-    html += "<p><strong>Timezone:</strong> " + String(timezones[timezone_index].name) + "</p>";
-    html += "<p><strong>NTP Server:</strong> " + ntp_server + "</p>";
-    html += "</div>";
-    html += "<p>The clock will now restart and connect to your WiFi network.</p>";
-    html += "<p>Once connected, you can access this configuration page at the clock's IP address.</p>";
-    html += "</div>";
-    html += getHTMLFooter();
-    sendHTML(200, html);
-
-    delay(2000);
-    ESP.restart();
-  } else {
-    server.sendHeader("Location", "/");
-    server.send(302);
+// 1 in bright light, 0 in the dark, from a smoothed sensor reading
+float ambientFraction() {
+  int raw = analogRead(PIN_LIGHT);
+  light_level = light_level < 0 ? raw : light_level + (raw - light_level) * 0.2f;
+  return constrain((light_level - LIGHT_SENSOR_DARK) / (LIGHT_SENSOR_BRIGHT - LIGHT_SENSOR_DARK), 0.0f, 1.0f);
+}
+
+void updateBrightness() {
+  unsigned long now = millis();
+  brightness_checked_at = now;
+  if (brightness_previewing && now - brightness_preview_at >= BRIGHTNESS_PREVIEW_MSEC) brightness_previewing = false;
+
+  int level = display_brightness;
+  if (!brightness_previewing && (light_sensor || (auto_brightness && time_valid))) {
+    float daylight = light_sensor ? ambientFraction() : daylightFraction(utcNowUs() / 1000000);
+    float target = night_brightness + (display_brightness - night_brightness) * daylight;
+    // Half a step of hysteresis so a level boundary does not flicker
+    level = fabsf(target - effective_brightness) > 0.75f ? lroundf(target) : effective_brightness;
+    level = constrain(level, min(night_brightness, display_brightness), max(night_brightness, display_brightness));
   }
+  if (level == effective_brightness) return;
+  effective_brightness = level;
+  publishDisplayState();
+  notifyDisplay();
+}
+
+void brightnessPoll() {
+  if (millis() - brightness_checked_at >= 1000) updateBrightness();
+}
+
+// Shows the configured level right away, overriding the schedule briefly
+void previewBrightness() {
+  brightness_previewing = true;
+  brightness_preview_at = millis();
+  updateBrightness();
 }
 
 // -----------------------------------------------
-// Web Handlers - Station Mode
+// Display Task
 // -----------------------------------------------
-void handleStatus() {
-  String html = getHTMLHeader("NTP Clock Status");
-  html += "<h1>NTP Clock</h1>";
-
-  html += "<div class='card'>";
-  html += "<h2>Status</h2>";
-  html += "<div class='info'>";
-  html += "<p><strong>WiFi Network:</strong> " + wifi_ssid + "</p>";
-  html += "<p><strong>IP Address:</strong> " + WiFi.localIP().toString() + "</p>";
-  html += "<p><strong>Signal Strength:</strong> " + String(WiFi.RSSI()) + " dBm</p>";
-  html += "<p><strong>Timezone:</strong> " + String(timezones[timezone_index].name) + "</p>";
-  html += "<p><strong>NTP Server:</strong> " + ntp_server + "</p>";
-  html += "<p><strong>Brightness:</strong> " + String(display_brightness) + "/7</p>";
-  html += "<p><strong>Current Time:</strong> " + String(ntp.hours()) + ":" +
-          (ntp.minutes() < 10 ? "0" : "") + String(ntp.minutes()) + ":" +
-          (ntp.seconds() < 10 ? "0" : "") + String(ntp.seconds()) + "</p>";
-  html += "<p><strong>NTP Sync:</strong> " + String(last_update ? "<span class='success'>OK</span>" : "<span class='error'>Failed</span>") + "</p>";
-  html += "</div>";
-  html += "</div>";
-
-  html += "<div class='card'>";
-  html += "<h2>Settings</h2>";
-  html += "<a href='/settings'><button>Change Settings</button></a>";
-  html += "<a href='/reset'><button class='btn-danger'>Reset & Reconfigure</button></a>";
-  html += "</div>";
-
-  html += getHTMLFooter();
-  sendHTML(200, html);
+// The display task owns the TM1640. It never touches network state: the
+// network task publishes a DisplayState snapshot and the display task
+// renders from its own copy, so a slow HTTP client or DNS lookup cannot
+// delay a tick and the display never blocks the network side.
+
+void publishDisplayState() {
+  DisplayState state;
+  state.clock = clock_state;
+  state.tz = tz_rule;
+  state.generation = time_generation;
+  state.show_time = time_valid && !ap_mode;
+  state.synced = last_update && wifi_connected;
+  state.verified = time_verified;
+  state.brightness = effective_brightness;
+  memcpy(state.text, display_text, sizeof(state.text));
+  display_state.publish(state);
 }
 
-void handleSettings() {
-  String html = getHTMLHeader("Clock Settings");
-  html += "<h1>Clock Settings</h1>";
+void readDisplayState(DisplayState& out) {
+  display_state.read(out);
+}
 
-  html += "<div class='card'>";
-  html += "<h2>Timezone & NTP</h2>";
-  html += "<form action='/updatesettings' method='post'>";
+void showText(const char* text) {
+  strncpy(display_text, text, sizeof(display_text) - 1);
+  publishDisplayState();
+}
 
-  html += "<label>Timezone:</label>";
-  html += "<select name='timezone'>";
-  for (int i = 0; i < NUM_TIMEZONES; i++) {
-    String selected = (i == timezone_index) ? " selected" : "";
-    html += "<option value='" + String(i) + "'" + selected + ">" + String(timezones[i].name) + "</option>";
-  }
-  html += "</select>";
+// Caches the displayed hour/minute at utc_us and schedules the next minute rollover
+void updateDisplayTime(const DisplayState& state, TzWindow& window, DisplayTime& shown, int64_t utc_us) {
+  time_t utc = utc_us / 1000000;
+  long secOfDay = (utc + tzOffset(state.tz, window, utc)) % 86400;
 
-  html += "<label>NTP Server:</label>";
-  html += "<input type='text' name='ntpserver' value='" + ntp_server + "'>";
+  int hour24 = secOfDay / 3600;
+  shown.hour12 = hour24 % 12;
+  if (shown.hour12 == 0) shown.hour12 = 12;
+  shown.pm = (hour24 >= 12);
+  shown.minute = (secOfDay / 60) % 60;
 
-  html += "<label>Display Brightness: <span id='brightval'>" + String(display_brightness) + "</span></label>";
-  html += "<input type='range' name='brightness' min='0' max='7' value='" + String(display_brightness) + "' oninput=\"document.getElementById('brightval').textContent=this.value\" style='width:100%'>";
+  int64_t us_into_minute = (secOfDay % 60) * 1000000LL + utc_us % 1000000;
+  shown.next_minute_utc_us = utc_us + 60000000LL - us_into_minute;
+}
 
-  html += "<input type='submit' value='Save Settings'>";
-  html += "</form>";
-  html += "<a href='/'><button class='btn-secondary'>Back</button></a>";
-  html += "</div>";
+// Fills the frame; the caller flushes it at the tick
+void renderTime(const DisplayTime& shown, bool synced, bool colon) {
+  const uint8_t* hour = TIME_GLYPHS.hour12[shown.hour12];
+  const uint8_t* minute = TIME_GLYPHS.minute[shown.minute];
+  const uint8_t* indicators = INDICATOR_GRIDS[shown.pm][synced];
+  uint8_t dot = colon ? SEG_DOT : 0;
+
+  uint8_t grids[DISPLAY_GRIDS];
+  grids[GRID_HOUR_TENS] = hour[0];
+  grids[GRID_HOUR_ONES] = hour[1] | dot;
+  grids[GRID_MINUTE_TENS] = minute[0] | dot;
+  grids[GRID_MINUTE_ONES] = minute[1];
+  grids[GRID_AM] = indicators[0];
+  grids[GRID_PM] = indicators[1];
+  frame.load(grids);
+}
 
-  html += getHTMLFooter();
-  sendHTML(200, html);
+// Left-aligned on the digits, indicators off
+void renderText(const char* text) {
+  uint8_t grids[DISPLAY_GRIDS] = {0};
+  for (int i = 0; i < DISPLAY_DIGITS && text[i]; i++) grids[i] = GLYPHS.segments[text[i] & 0x7f];
+  frame.load(grids);
 }
 
-void handleUpdateSettings() {
-  if (server.hasArg("timezone") && server.hasArg("ntpserver")) {
-    timezone_index = server.arg("timezone").toInt();
-    ntp_server = server.arg("ntpserver");
-    if (server.hasArg("brightness")) {
-      display_brightness = server.arg("brightness").toInt();
-      display_brightness = constrain(display_brightness, 0, 7);
+void recordDisplayTick(int64_t error_us) {
+  int64_t abs_us = llabs(error_us);
+  uint32_t err = abs_us > UINT32_MAX ? UINT32_MAX : (uint32_t)abs_us;
+  int bucket = 0;
+  while (bucket < DISPLAY_TICK_BUCKETS && err > DISPLAY_TICK_BUCKET_US[bucket]) bucket++;
+  display_tick_hist[bucket]++;
+  display_tick_sum_us += err;
+  if (err > display_tick_max_us) display_tick_max_us = err;
+  display_ticks++;
+  if (err > TELEMETRY_TICK_LATE_US) telemetryRecord(TEL_TICK_LATE, "display", error_us, 0);
+}
+
+void onDisplayTimer(void* arg) {
+  xTaskNotify(display_task_handle, DISPLAY_EVENT_TICK, eSetBits);
+}
+
+// Wakes the display task to apply a settings change without waiting for a tick
+void notifyDisplay() {
+  if (display_task_handle) xTaskNotify(display_task_handle, DISPLAY_EVENT_SETTINGS, eSetBits);
+}
+
+void applyBrightness(const DisplayState& state, int& brightness) {
+  if (state.brightness == brightness) return;
+  brightness = state.brightness;
+  module.setupDisplay(true, brightness);
+}
+
+// Each tick is scheduled on esp_timer for the next UTC half-second of the
+// disciplined clock. The frame is prepared before the deadline so the
+// only work left at the tick is the bus write: the colon lights on the
+// second and the minute changes at :00, on every clock synced to the
+// same servers.
+void displayTask(void* arg) {
+  DisplayState state;
+  TzWindow window = {0, 0, 0, false};
+  DisplayTime shown = {12, 0, false, 0};
+  uint32_t generation = 0;
+  int brightness = -1;
+  char text[sizeof(state.text)] = "";
+
+  const int64_t interval_us = displayinterval_Msec * 1000LL;
+  esp_timer_create_args_t timer_args = {};
+  timer_args.callback = onDisplayTimer;
+  timer_args.dispatch_method = ESP_TIMER_TASK;
+  timer_args.name = "display";
+  esp_timer_create(&timer_args, &display_timer);
+
+  for (;;) {
+    readDisplayState(state);
+    applyBrightness(state, brightness);
+
+    // Keep showing text ("CON") until the first sync
+    if (!state.show_time) {
+      if (strcmp(text, state.text) != 0) {
+        memcpy(text, state.text, sizeof(text));
+        renderText(text);
+        frame.flush();
+      }
+      uint32_t events;
+      xTaskNotifyWait(0, UINT32_MAX, &events, pdMS_TO_TICKS(displayinterval_Msec));
+      continue;
     }
+    text[0] = '\0';  // redraw text if it comes back
 
-    preferences.begin("ntpclock", false);
-    preferences.putInt("tz", timezone_index);
-    preferences.putString("ntp", ntp_server);
-    preferences.putInt("bright", display_brightness);
-    preferences.end();
-
-    // Apply new timezone and force NTP resync
-    applyTimezone();
-    ntp.stop();
-    ntp.begin();
-    last_update = ntp.update();
-
-    // Apply new brightness
-    module.setupDisplay(true, display_brightness);
-
-    String html = getHTMLHeader("Settings Saved");
-    html += "<h1>Settings Saved</h1>";
-    html += "<div class='card'>";
-    html += "<h2 class='success'>Settings Updated!</h2>";
-    html += "<p>Timezone: " + String(timezones[timezone_index].name) + "</p>";
-    html += "<p>NTP Server: " + ntp_server + "</p>";
-    html += "<p>Brightness: " + String(display_brightness) + "/7</p>";
-    html += "<a href='/'><button>Back to Status</button></a>";
-    html += "</div>";
-    html += getHTMLFooter();
-    sendHTML(200, html);
-  } else {
-    server.sendHeader("Location", "/settings");
-    server.send(302);
+    if (state.generation != generation) {
+      generation = state.generation;
+      window.from = window.until = 0;
+      shown.next_minute_utc_us = 0;
+    }
+
+    int64_t now = esp_timer_get_time();
+    int64_t tick_utc_us = (clockUtcAt(state.clock, now) / interval_us + 1) * interval_us;
+    int64_t tick_mono_us = clockMonoAt(state.clock, tick_utc_us, now);
+    if (tick_utc_us >= shown.next_minute_utc_us) {
+      updateDisplayTime(state, window, shown, tick_utc_us);
+    }
+    // On for the first half of each second; held on while unverified
+    bool colon = !state.verified || (tick_utc_us % 1000000) < interval_us;
+    renderTime(shown, state.synced, colon);
+
+    int64_t wait_us = tick_mono_us - esp_timer_get_time();
+    esp_timer_start_once(display_timer, wait_us > 0 ? wait_us : 1);
+    uint32_t events = 0;
+    while (!(events & DISPLAY_EVENT_TICK)) {
+      xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+      if (events & DISPLAY_EVENT_SETTINGS) {
+        DisplayState latest;
+        readDisplayState(latest);
+        applyBrightness(latest, brightness);
+      }
+    }
+    frame.flush();
+    if (display_first_time_us == 0) display_first_time_us = esp_timer_get_time();
+    recordDisplayTick(clockUtcAt(state.clock, esp_timer_get_time()) - tick_utc_us);
   }
 }
 
-void handleReset() {
-  String html = getHTMLHeader("Reset Clock");
-  html += "<h1>Reset Clock</h1>";
-  html += "<div class='card'>";
-  html += "<h2 class='error'>Confirm Reset</h2>";
-  html += "<p>This will erase all settings and restart the clock in setup mode.</p>";
-  html += "<form action='/doreset' method='post'>";
-  html += "<input type='submit' value='Yes, Reset Everything' class='btn-danger'>";
-  html += "</form>";
-  html += "<a href='/'><button class='btn-secondary'>Cancel</button></a>";
-  html += "</div>";
-  html += getHTMLFooter();
-  sendHTML(200, html);
+// -----------------------------------------------
+// Network Task
+// -----------------------------------------------
+// Accounts the busy part of a network pass, then sleeps so the CPU idles
+void loopIdle(int64_t loopStartUs, uint32_t idleMsec) {
+  loop_busy_us += esp_timer_get_time() - loopStartUs;
+  delay(idleMsec);
 }
 
-void handleDoReset() {
-  preferences.begin("ntpclock", false);
-  preferences.clear();
-  preferences.end();
+// One pass over everything but HTTP; returns how long to sleep after it
+uint32_t networkPass() {
+  if (ap_mode) {
+    pollWifiScan();
+    configPoll();
+    publishDisplayState();
+    telemetryPoll();
+    telemetrySerialPoll();
+    return loopidle_Msec;
+  }
+
+  // Station mode
+  wifiManagerPoll();
+  if (ap_mode) return loopidle_Msec;  // fell back to AP mode
+
+  if (network_services_started) {
+    TelemetryScope scope("ota");
+    ArduinoOTA.handle();
+  }
+
+  if (wifi_connected) {
+    TelemetryScope scope("ntp");
+    ntpClientPoll();
+    beaconPoll();
+  }
 
-  String html = getHTMLHeader("Resetting");
-  html += "<h1>Resetting...</h1>";
-  html += "<div class='card'>";
-  html += "<h2>Settings Cleared</h2>";
-  html += "<p>The clock will restart in setup mode.</p>";
-  html += "<p>Connect to WiFi network: <strong>" + String(AP_SSID) + "</strong></p>";
-  html += "<p>Password: <strong>" + String(AP_PASS) + "</strong></p>";
-  html += "</div>";
-  html += getHTMLFooter();
-  sendHTML(200, html);
+  brightnessPoll();
+  configPoll();
+  publishDisplayState();
+  publishNtpServerState();
+  telemetryPoll();
+  telemetrySerialPoll();
 
-  delay(2000);
-  ESP.restart();
+  // Poll every tick while an NTP reply or a beacon is due so its timestamp
+  // is accurate; never spin, the idle task on this core feeds the watchdog
+  return ntp_state == NTP_WAITING || beaconDue() ? 1 : loopidle_Msec;
 }
 
-void handleNotFound() {
-  if (ap_mode) {
-    // Captive portal - redirect all requests to root
-    server.sendHeader("Location", "http://192.168.4.1/");
-    server.send(302);
-  } else {
-    server.send(404, "text/plain", "Not Found");
+void networkLoop() {
+  int64_t loopStartUs = esp_timer_get_time();
+  loop_iterations++;
+  uint32_t idleMsec;
+  {
+    StateLock lock;
+    TelemetryScope scope("network_pass");
+    idleMsec = networkPass();
   }
+  loopIdle(loopStartUs, idleMsec);
+}
+
+void networkTask(void* arg) {
+  for (;;) networkLoop();
 }
 
 // -----------------------------------------------
-// Helper Functions
+// Web Task
 // -----------------------------------------------
-void applyTimezone() {
-  TimezoneInfo& tz = timezones[timezone_index];
-  if (tz.dstOffset == tz.stdOffset) {
-    // No DST
-    ntp.ruleDST(tz.dstAbbrev, Second, Sun, Mar, 2, tz.dstOffset);
-    ntp.ruleSTD(tz.stdAbbrev, First, Sun, Nov, 2, tz.stdOffset);
-  } else {
-    // Has DST
-    ntp.ruleDST(tz.dstAbbrev, Second, Sun, Mar, 2, tz.dstOffset);
-    ntp.ruleSTD(tz.stdAbbrev, First, Sun, Nov, 2, tz.stdOffset);
-  }
+// The web task owns the HTTP server: the network task only asks for a
+// route table. Handlers run under StateLock (see timedHandler()) since
+// they change settings the network task uses, but only while rendering;
+// waiting for requests and sending responses happen outside it, so a
+// slow browser delays neither NTP, beacons and OTA nor other browsers.
+
+// Milliseconds from now until at, 0 if it has passed
+uint32_t msecUntil(unsigned long at) {
+  long left = (long)(at - millis());
+  return left > 0 ? left : 0;
 }
 
-bool ntpUpdateReturnSuccess() {
-  unsigned long currentMillis = millis();
-  if (currentMillis - lastExecutedMillis_2 >= updateinterval_Msec) {
-    lastExecutedMillis_2 = currentMillis;
-    last_update = ntp.update();
-    return last_update;
-  } else {
-    if (currentMillis - lastExecutedMillis_3 >= 30000 && !last_update) {
-      lastExecutedMillis_3 = currentMillis;
-      last_update = ntp.update();
-      return last_update;
-    }
-    return last_update;
+void webLoop() {
+  uint8_t wanted = web_routes_wanted;
+  if (wanted != web_routes_active) {
+    server.clearRoutes();
+    if (wanted == WEB_ROUTES_AP) registerApRoutes();
+    else registerStationRoutes();
+    web_routes_active = wanted;
+  }
+  if (web_routes_active == WEB_ROUTES_NONE) {
+    delay(loopidle_Msec);
+    return;
   }
-}
 
-void blink_colon(int digit1, int digit2) {
-  if (blink_on) {
-    module.setDisplayDigit(digit1, 1, false);
-    module.setDisplayDigit(digit2, 2, false);
-    blink_on = false;
-  } else {
-    module.setDisplayDigit(digit1, 1, true);
-    module.setDisplayDigit(digit2, 2, true);
-    blink_on = true;
+  uint32_t wait_msec = 1000;
+  if (web_routes_active == WEB_ROUTES_STATION) wait_msec = msecUntil(lastExecutedMillis_sse + 1000);
+  if (web_restart_at != 0) wait_msec = min(wait_msec, msecUntil(web_restart_at));
+  server.wait(wait_msec);
+  {
+    TelemetryScope scope("http");
+    server.service();
+  }
+
+  if (web_routes_active == WEB_ROUTES_STATION && millis() - lastExecutedMillis_sse >= 1000) {
+    lastExecutedMillis_sse = millis();
+    pushEvents();
   }
+  if (web_restart_at != 0 && msecUntil(web_restart_at) == 0) ESP.restart();
+}
+
+void webTask(void* arg) {
+  for (;;) webLoop();
 }
 
 void startAPMode() {
@@ -522,21 +3738,15 @@ void startAPMode() {
   Serial.print("AP IP address: ");
   Serial.println(WiFi.softAPIP());
 
-  // Setup DNS server for captive portal
-  dnsServer.start(DNS_PORT, "*", WiFi.softAPIP());
-
-  // Setup web server routes
-  server.on("/", handleRoot);
-  server.on("/scan", handleScan);
-  server.on("/connect", HTTP_POST, handleConnect);
-  server.on("/save", HTTP_POST, handleSave);
-  server.onNotFound(handleNotFound);
+  // Every name resolves to the portal, answered from a task of its own
+  captiveDnsBegin(WiFi.softAPIP());
 
-  server.begin();
-  Serial.println("HTTP server started in AP mode");
+  // The web task registers the routes and starts serving
+  web_routes_wanted = WEB_ROUTES_AP;
 
   ap_mode = true;
-  module.setDisplayToString("CON");
+  startWifiScan();
+  showText("CON");
 }
 
 void startStationMode() {
@@ -544,86 +3754,190 @@ void startStationMode() {
   Serial.print("Connecting to: ");
   Serial.println(wifi_ssid);
 
+  ap_mode = false;
   WiFi.mode(WIFI_STA);
+  WiFi.setAutoReconnect(false);  // retries are paced by wifiManagerPoll()
+  WiFi.onEvent(onWifiEvent);
   WiFi.begin(wifi_ssid.c_str(), wifi_pass.c_str());
 
-  module.setDisplayToString("CON");
-
-  int attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && attempts < 30) {
-    delay(500);
-    Serial.print(".");
-    attempts++;
-  }
-
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("");
-    Serial.println("WiFi connected!");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
-
-    wifi_connected = true;
-    ap_mode = false;
-
-    // Setup OTA
-    ArduinoOTA.setPassword("admin");
-    ArduinoOTA
-      .onStart([]() {
-        String type = (ArduinoOTA.getCommand() == U_FLASH) ? "sketch" : "filesystem";
-        Serial.println("Start updating " + type);
-      })
-      .onEnd([]() { Serial.println("\nEnd"); })
-      .onProgress([](unsigned int progress, unsigned int total) {
-        Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
-      })
-      .onError([](ota_error_t error) {
-        Serial.printf("Error[%u]: ", error);
-        if (error == OTA_AUTH_ERROR) Serial.println("Auth Failed");
-        else if (error == OTA_BEGIN_ERROR) Serial.println("Begin Failed");
-        else if (error == OTA_CONNECT_ERROR) Serial.println("Connect Failed");
-        else if (error == OTA_RECEIVE_ERROR) Serial.println("Receive Failed");
-        else if (error == OTA_END_ERROR) Serial.println("End Failed");
-      });
-    ArduinoOTA.begin();
-
-    // Setup mDNS
-    if (MDNS.begin("ntpclock")) {
-      Serial.println("mDNS responder started: ntpclock.local");
-    }
-
-    // Setup NTP
-    applyTimezone();
-    ntp.updateInterval(10);
-    ntp.begin();
-    last_update = ntp.update();
-
-    // Setup web server for station mode
-    server.on("/", HTTP_GET, handleStatus);
-    server.on("/", HTTP_OPTIONS, handleOptions);
-    server.on("/settings", HTTP_GET, handleSettings);
-    server.on("/settings", HTTP_OPTIONS, handleOptions);
-    server.on("/updatesettings", HTTP_POST, handleUpdateSettings);
-    server.on("/updatesettings", HTTP_OPTIONS, handleOptions);
-    server.on("/reset", HTTP_GET, handleReset);
-    server.on("/reset", HTTP_OPTIONS, handleOptions);
-    server.on("/doreset", HTTP_POST, handleDoReset);
-    server.on("/doreset", HTTP_OPTIONS, handleOptions);
-    server.onNotFound(handleNotFound);
-
-    server.begin();
-    Serial.println("HTTP server started in Station mode");
-
-    module.clearDisplay();
-  } else {
-    Serial.println("");
+  wifi_connect_started = millis();
+  wifi_joining = true;
+  wifi_join_started = wifi_connect_started;
+
+  showText("CON");
+}
+
+// Started once, on the first connection; they survive later reconnects
+void startNetworkServices() {
+  // Setup OTA
+  ArduinoOTA.setPassword("admin");
+  ArduinoOTA
+    .onStart([]() {
+      String type = (ArduinoOTA.getCommand() == U_FLASH) ? "sketch" : "filesystem";
+      Serial.println("Start updating " + type);
+    })
+    .onEnd([]() {
+      Serial.println("\nEnd");
+      if (time_verified) persistClock();  // resume the display right after the update
+    })
+    .onProgress([](unsigned int progress, unsigned int total) {
+      Serial.printf("Progress: %u%%\r", (progress / (total / 100)));
+    })
+    .onError([](ota_error_t error) {
+      Serial.printf("Error[%u]: ", error);
+      if (error == OTA_AUTH_ERROR) Serial.println("Auth Failed");
+      else if (error == OTA_BEGIN_ERROR) Serial.println("Begin Failed");
+      else if (error == OTA_CONNECT_ERROR) Serial.println("Connect Failed");
+      else if (error == OTA_RECEIVE_ERROR) Serial.println("Receive Failed");
+      else if (error == OTA_END_ERROR) Serial.println("End Failed");
+    });
+  ArduinoOTA.begin();
+
+  // Setup mDNS
+  if (MDNS.begin("ntpclock")) {
+    Serial.println("mDNS responder started: ntpclock.local");
+  }
+
+  // Setup NTP; the first sync completes from the network loop
+  ntpClientBegin();
+  ntpServerBegin();
+  beaconBegin();
+
+  web_routes_wanted = WEB_ROUTES_STATION;
+  network_services_started = true;
+}
+
+void registerApRoutes() {
+  server.on("/", timedHandler("root", handleRoot));
+  server.on("/scan", timedHandler("scan", handleScan));
+  server.on("/connect", HTTP_POST, timedHandler("connect", handleConnect));
+  server.on("/save", HTTP_POST, timedHandler("save", handleSave));
+  server.on("/api/handlers", HTTP_GET, handleApiHandlers);
+  server.on("/api/telemetry", HTTP_GET, timedHandler("api_telemetry", handleApiTelemetry));
+  for (const char* path : CAPTIVE_PROBE_PATHS) server.on(path, timedHandler("captive_probe", handleNotFound));
+  registerStaticAssets();
+  server.onNotFound(timedHandler("not_found", handleNotFound));
+  server.begin();
+  Serial.println("HTTP server started in AP mode");
+}
+
+void registerStationRoutes() {
+  server.on("/", HTTP_GET, timedHandler("status", handleStatus));
+  server.on("/", HTTP_OPTIONS, handleOptions);
+  server.on("/settings", HTTP_GET, timedHandler("settings", handleSettings));
+  server.on("/settings", HTTP_OPTIONS, handleOptions);
+  server.on("/updatesettings", HTTP_POST, timedHandler("update_settings", handleUpdateSettings));
+  server.on("/updatesettings", HTTP_OPTIONS, handleOptions);
+  server.on("/reset", HTTP_GET, timedHandler("reset", handleReset));
+  server.on("/reset", HTTP_OPTIONS, handleOptions);
+  server.on("/doreset", HTTP_POST, timedHandler("do_reset", handleDoReset));
+  server.on("/doreset", HTTP_OPTIONS, handleOptions);
+  server.on("/api/status", HTTP_GET, timedHandler("api_status", handleApiStatus));
+  server.on("/metrics", HTTP_GET, timedHandler("metrics", handleMetrics));
+  server.on("/api/brightness", timedHandler("api_brightness", handleApiBrightness));
+  server.on("/events", HTTP_GET, timedHandler("events", handleEvents));
+  server.on("/api/handlers", HTTP_GET, handleApiHandlers);
+  server.on("/api/telemetry", HTTP_GET, timedHandler("api_telemetry", handleApiTelemetry));
+  registerStaticAssets();
+  server.onNotFound(timedHandler("not_found", handleNotFound));
+  server.begin();
+  Serial.println("HTTP server started in Station mode");
+}
+
+// -----------------------------------------------
+// WiFi Connection Manager
+// -----------------------------------------------
+// Wi-Fi events only set flags; wifiManagerPoll() acts on them from loop().
+// While disconnected the clock keeps running on the local timebase and
+// reconnects with exponential backoff. A join in progress is never cut
+// short: the backoff starts when it fails (DISCONNECTED) or times out.
+// AP mode is only entered if the saved network was never reached since
+// boot.
+
+void onWifiEvent(arduino_event_id_t event, arduino_event_info_t info) {
+  if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+    wifi_event_got_ip = true;
+  } else if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED || event == ARDUINO_EVENT_WIFI_STA_LOST_IP) {
+    wifi_event_disconnected = true;
+  }
+}
+
+void wifiManagerPoll() {
+  unsigned long now = millis();
+
+  if (wifi_event_disconnected) {
+    wifi_event_disconnected = false;
+    if (wifi_connected) {
+      Serial.println("WiFi connection lost, reconnecting...");
+      telemetryRecord(TEL_WIFI_DOWN, "wifi", 0, wifi_reconnects);
+      wifi_connected = false;
+      wifi_backoff_msec = wifiminbackoff_Msec;
+      wifi_retry_at = now + wifi_backoff_msec;
+    } else if (wifi_joining) {
+      wifi_joining = false;
+      wifi_retry_at = now + wifi_backoff_msec;
+      wifi_backoff_msec = min(wifi_backoff_msec * 2, wifimaxbackoff_Msec);
+    }
+  }
+
+  if (wifi_event_got_ip) {
+    wifi_event_got_ip = false;
+    if (WiFi.status() == WL_CONNECTED) {
+      wifi_joining = false;
+      Serial.print("WiFi connected! IP address: ");
+      Serial.println(WiFi.localIP());
+      telemetryRecord(TEL_WIFI_UP, "wifi", WiFi.RSSI(), wifi_reconnects);
+      wifi_connected = true;
+      wifi_ever_connected = true;
+      wifi_backoff_msec = wifiminbackoff_Msec;
+      if (!network_services_started) {
+        startNetworkServices();
+      } else {
+        ntp_force_update = true;  // resync right away after an outage
+      }
+    }
+  }
+
+  if (wifi_connected) return;
+
+  if (!wifi_ever_connected && now - wifi_connect_started >= wificonnecttimeout_Msec) {
     Serial.println("WiFi connection failed! Starting AP mode...");
+    WiFi.disconnect();
     startAPMode();
+    return;
+  }
+
+  if (wifi_joining) {
+    if (now - wifi_join_started < wifijointimeout_Msec) return;
+    Serial.println("WiFi join timed out.");
+    WiFi.disconnect();  // its DISCONNECTED event arrives with wifi_joining already clear
+    wifi_joining = false;
+    wifi_retry_at = now + wifi_backoff_msec;
+    wifi_backoff_msec = min(wifi_backoff_msec * 2, wifimaxbackoff_Msec);
+    return;
+  }
+
+  if ((long)(now - wifi_retry_at) >= 0) {
+    wifi_reconnects++;
+    wifi_joining = true;
+    wifi_join_started = now;
+    WiFi.begin(wifi_ssid.c_str(), wifi_pass.c_str());
   }
 }
 
 // -----------------------------------------------
 // Setup
 // -----------------------------------------------
+// Creates one of the firmware's tasks; false, with the reason logged, if
+// FreeRTOS could not (out of memory, or a core this chip lacks)
+bool startTask(TaskFunction_t fn, const char* name, uint32_t stack, UBaseType_t priority, TaskHandle_t* handle,
+               BaseType_t core) {
+  if (xTaskCreatePinnedToCore(fn, name, stack, NULL, priority, handle, core) == pdPASS) return true;
+  Serial.printf("Could not start the %s task on core %d (%lu bytes free)\n", name, (int)core,
+                (unsigned long)ESP.getFreeHeap());
+  return false;
+}
+
 void setup() {
   Serial.begin(115200);
   delay(100);
@@ -635,100 +3949,44 @@ void setup() {
   digitalWrite(PIN_power, HIGH);
   module.begin(true, display_brightness);
   module.clearDisplay();
-  module.setDisplayToString("CON");
 
-  // Load saved preferences
-  preferences.begin("ntpclock", true);
-  wifi_ssid = preferences.getString("ssid", "");
-  wifi_pass = preferences.getString("pass", "");
-  timezone_index = preferences.getInt("tz", 0);  // Default to Eastern
-  ntp_server = preferences.getString("ntp", "pool.ntp.org");
-  display_brightness = preferences.getInt("bright", 7);  // Default to max
-  preferences.end();
+  state_lock = xSemaphoreCreateMutex();
+  configLoad();
+  applyTimezone();
+  restoreClock();
 
   Serial.println("Loaded settings:");
   Serial.println("SSID: " + wifi_ssid);
-  Serial.println("TZ: " + String(timezones[timezone_index].name));
+  Serial.println("TZ: " + String(timezoneName()));
   Serial.println("NTP: " + ntp_server);
 
+  showText("CON");
+  bool started = startTask(displayTask, "display", DISPLAY_TASK_STACK, DISPLAY_TASK_PRIORITY, &display_task_handle,
+                           DISPLAY_TASK_CORE);
+
   // Decide mode based on saved credentials
   if (wifi_ssid.length() > 0) {
     startStationMode();
   } else {
     startAPMode();
   }
+
+  started = started && startTask(networkTask, "network", NETWORK_TASK_STACK, NETWORK_TASK_PRIORITY, NULL,
+                                 NETWORK_TASK_CORE);
+  started = started && startTask(webTask, "web", WEB_TASK_STACK, WEB_TASK_PRIORITY, NULL, NETWORK_TASK_CORE);
+  if (!started) {
+    // The clock would sit frozen or unreachable; a restart starts from a clean heap
+    Serial.println("Restarting.");
+    delay(1000);
+    ESP.restart();
+  }
 }
 
 // -----------------------------------------------
 // Main Loop
 // -----------------------------------------------
+// All work runs in displayTask and networkTask; the Arduino loop task is
+// not needed once setup() has started them.
 void loop() {
-  if (ap_mode) {
-    dnsServer.processNextRequest();
-    server.handleClient();
-    return;
-  }
-
-  // Station mode
-  server.handleClient();
-  ArduinoOTA.handle();
-
-  // Check WiFi connection
-  if (WiFi.status() != WL_CONNECTED) {
-    module.setDisplayToString("CON");
-    delay(5000);
-    ESP.restart();
-    return;
-  }
-
-  // Update time display
-  int hour24 = ntp.hours();
-  int hour12 = hour24 % 12;
-  if (hour12 == 0) hour12 = 12;
-  bool isPM = (hour24 >= 12);
-
-  if (hour12 < 10) {
-    digits[0] = 0;
-    digits[1] = hour12;
-  } else {
-    digits[0] = 1;
-    digits[1] = hour12 - 10;
-  }
-
-  digits[2] = floor(ntp.minutes() / 10);
-  digits[3] = ntp.minutes() % 10;
-
-  unsigned long currentMillis = millis();
-  if (currentMillis - lastExecutedMillis_1 >= 500) {
-    lastExecutedMillis_1 = currentMillis;
-
-    if (!ntpUpdateReturnSuccess()) {
-      Serial.println("Failed to obtain time.");
-      if (isPM) {
-        module.setSegments(0, 4);
-        module.setSegments(6, 5);
-      } else {
-        module.setSegments(6, 4);
-        module.setSegments(0, 5);
-      }
-    } else {
-      if (isPM) {
-        module.setSegments(0, 4);
-        module.setSegments(2, 5);
-      } else {
-        module.setSegments(2, 4);
-        module.setSegments(0, 5);
-      }
-    }
-
-    if (digits[0] == 0) {
-      module.setSegments(0x00, 0);
-    } else {
-      module.setDisplayDigit(digits[0], 0, false);
-    }
-    module.setDisplayDigit(digits[1], 1, true);
-    module.setDisplayDigit(digits[2], 2, true);
-    module.setDisplayDigit(digits[3], 3, false);
-    blink_colon(digits[1], digits[2]);
-  }
+  vTaskDelete(NULL);
 }
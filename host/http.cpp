@@ -0,0 +1,158 @@
+// Simulated browsers for the host build: HTTP/1.1 over the TCP model in
+// net.cpp; see sim.h
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
+#include "sim.h"
+
+const uint16_t HTTP_PORT = 80;
+
+static std::string urlEncode(const std::string& text) {
+  std::string out;
+  for (unsigned char c : text) {
+    if (isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+      out += c;
+    } else if (c == ' ') {
+      out += '+';
+    } else {
+      char hex[4];
+      snprintf(hex, sizeof(hex), "%%%02X", c);
+      out += hex;
+    }
+  }
+  return out;
+}
+
+static std::string encodeArgs(const SimHttpRequest& request) {
+  std::string out;
+  for (auto& arg : request.args) {
+    if (!out.empty()) out += '&';
+    out += urlEncode(arg.first) + "=" + urlEncode(arg.second);
+  }
+  return out;
+}
+
+// Value of name in "Name: value\r\n" lines, empty if absent
+static std::string findHeader(const std::string& headers, const char* name) {
+  size_t n = strlen(name);
+  for (size_t start = 0; start < headers.size();) {
+    size_t end = headers.find("\r\n", start);
+    if (end == std::string::npos) end = headers.size();
+    if (end - start > n && strncasecmp(headers.c_str() + start, name, n) == 0 && headers[start + n] == ':') {
+      size_t value = start + n + 1;
+      while (value < end && headers[value] == ' ') value++;
+      return headers.substr(value, end - value);
+    }
+    start = end + 2;
+  }
+  return "";
+}
+
+void SimHttpClient::request(const SimHttpRequest& request) {
+  queue.push_back({request, simNowUs()});
+  pump();
+}
+
+void SimHttpClient::pump() {
+  if (in_flight || queue.empty()) return;
+  if (conn < 0) {
+    conn = simTcpConnect(ip, HTTP_PORT, delay_us, bytes_per_ms, this);
+    conn_answered = 0;
+    connects++;
+  }
+  const SimHttpRequest& request = queue.front().first;
+  std::string args = encodeArgs(request);
+  bool post = request.method == "POST";
+  std::string text = request.method + " " + request.uri + (!post && !args.empty() ? "?" + args : "") + " HTTP/1.1\r\n";
+  text += "Host: " + simIpString(simDeviceIp()) + "\r\n";
+  if (request.event) text += "Accept: text/event-stream\r\n";
+  if (post) {
+    text += "Content-Type: application/x-www-form-urlencoded\r\n";
+    text += "Content-Length: " + std::to_string(args.size()) + "\r\n";
+  }
+  text += "\r\n";
+  if (post) text += args;
+  simTcpSend(conn, text);
+  in_flight = true;
+  headers_done = false;
+  streaming = false;
+  buffer.clear();
+  response = SimHttpResponse();
+  response.queued_us = queue.front().second;
+}
+
+void SimHttpClient::received(const uint8_t* data, size_t length) {
+  if (!in_flight) return;
+  buffer.append((const char*)data, length);
+  if (!headers_done) {
+    size_t end = buffer.find("\r\n\r\n");
+    if (end == std::string::npos) return;
+    headers_done = true;
+    response.code = atoi(buffer.c_str() + buffer.find(' ') + 1);
+    size_t line_end = buffer.find("\r\n");
+    response.headers = buffer.substr(line_end + 2, end - line_end);
+    buffer.erase(0, end + 4);
+    server_closes = strcasecmp(findHeader(response.headers, "Connection").c_str(), "close") == 0;
+    streaming = findHeader(response.headers, "Content-Type") == "text/event-stream";
+    chunked = strcasecmp(findHeader(response.headers, "Transfer-Encoding").c_str(), "chunked") == 0;
+    content_length = atol(findHeader(response.headers, "Content-Length").c_str());
+  }
+  const SimHttpRequest& request = queue.front().first;
+  if (streaming) {
+    for (size_t end; (end = buffer.find("\n\n")) != std::string::npos; buffer.erase(0, end + 2)) {
+      if (request.event) request.event(buffer.substr(0, end));
+    }
+    return;
+  }
+  if (chunked) {
+    // Size line, data and CRLF per chunk; the empty last chunk ends the body
+    for (;;) {
+      size_t line_end = buffer.find("\r\n");
+      if (line_end == std::string::npos) return;
+      size_t size = strtoul(buffer.c_str(), NULL, 16);
+      if (buffer.size() < line_end + 2 + size + 2) return;
+      response.body += buffer.substr(line_end + 2, size);
+      buffer.erase(0, line_end + 2 + size + 2);
+      if (size == 0) break;
+    }
+  } else {
+    if (buffer.size() < content_length) return;
+    response.body = buffer.substr(0, content_length);
+  }
+  response.finished_us = simNowUs();
+  conn_answered++;
+  if (server_closes) {
+    simTcpClose(conn);
+    conn = -1;
+  }
+  complete(response);
+}
+
+void SimHttpClient::closed() {
+  conn = -1;
+  if (!in_flight) return;
+  // Closed before any answer on a reused connection: the server reclaimed it
+  if (!headers_done && buffer.empty() && conn_answered > 0 && !retried) {
+    retried = true;
+    in_flight = false;
+    pump();
+    return;
+  }
+  response.finished_us = simNowUs();
+  if (!streaming) response.code = 0;
+  complete(response);
+}
+
+// Hands the response to the request's callback and starts the next one
+void SimHttpClient::complete(SimHttpResponse& finished) {
+  SimHttpResponse done_response = finished;
+  std::function<void(const SimHttpResponse&)> done = queue.front().first.done;
+  queue.erase(queue.begin());
+  in_flight = false;
+  retried = false;
+  if (done) done(done_response);
+  pump();
+}
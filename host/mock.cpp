@@ -0,0 +1,435 @@
+// Arduino core and library mocks for the host build; see mock/*.h
+#include <malloc.h>
+
+#include <deque>
+#include <map>
+#include <new>
+
+#include "sim.h"
+#include "ArduinoOTA.h"
+#include "ESPmDNS.h"
+#include "Preferences.h"
+#include "TM1640.h"
+#include "esp_heap_caps.h"
+#include "mbedtls/md.h"
+
+HardwareSerial Serial;
+EspClass ESP;
+MDNSResponder MDNS;
+ArduinoOTAClass ArduinoOTA;
+
+// -----------------------------------------------
+// Heap
+// -----------------------------------------------
+// The sketch's operator new allocates through heap_caps_malloc(), and so
+// does all host code linked with it. Allocations made from a task are
+// counted against a nominal ESP32 heap; each block carries its size and
+// whether it was counted. Driver callbacks that run on a task's stack
+// hold a SimHeapUncounted so the scorer's own bookkeeping is not charged
+// to the firmware, and so does the socket model in net.cpp where it
+// queues data, standing in for lwIP's buffers.
+const uint32_t HEAP_TOTAL = 300000;
+const uint32_t HEAP_LARGEST_BLOCK = 110592;
+const size_t HEAP_HEADER = 16;
+
+static uint64_t heap_live = 0;
+static uint64_t heap_peak = 0;
+static uint64_t heap_allocations = 0;
+static uint64_t heap_bytes = 0;         // allocated in total
+static uint64_t heap_window_peak = 0;   // since simHeapWindowBegin()
+static int heap_uncounted = 0;
+
+SimHeapUncounted::SimHeapUncounted() {
+  heap_uncounted++;
+}
+
+SimHeapUncounted::~SimHeapUncounted() {
+  heap_uncounted--;
+}
+
+bool simHeapCounted() {
+  return heap_uncounted == 0;
+}
+
+void* heap_caps_malloc(size_t size, uint32_t caps) {
+  char* block = (char*)malloc(size + HEAP_HEADER);
+  if (!block) return NULL;
+  bool counted = simCurrentTask() != NULL && simHeapCounted();
+  ((size_t*)block)[0] = size;
+  ((size_t*)block)[1] = counted;
+  if (counted) {
+    heap_live += size;
+    heap_allocations++;
+    heap_bytes += size;
+    if (heap_live > heap_peak) heap_peak = heap_live;
+    if (heap_live > heap_window_peak) heap_window_peak = heap_live;
+  }
+  return block + HEAP_HEADER;
+}
+
+size_t heap_caps_get_allocated_size(void* p) {
+  return ((size_t*)((char*)p - HEAP_HEADER))[0];
+}
+
+void heap_caps_free(void* p) {
+  if (!p) return;
+  char* block = (char*)p - HEAP_HEADER;
+  if (((size_t*)block)[1]) heap_live -= ((size_t*)block)[0];
+  free(block);
+}
+
+uint32_t simHeapFree() {
+  return heap_live >= HEAP_TOTAL ? 0 : HEAP_TOTAL - (uint32_t)heap_live;
+}
+
+uint32_t simHeapMinFree() {
+  return heap_peak >= HEAP_TOTAL ? 0 : HEAP_TOTAL - (uint32_t)heap_peak;
+}
+
+uint64_t simHeapAllocations() {
+  return heap_allocations;
+}
+
+SimHeapWindow simHeapWindowBegin() {
+  heap_window_peak = heap_live;
+  return SimHeapWindow{heap_allocations, heap_bytes, heap_live};
+}
+
+SimHeapWindow simHeapWindowEnd(const SimHeapWindow& begin) {
+  return SimHeapWindow{heap_allocations - begin.allocations, heap_bytes - begin.bytes, heap_window_peak - begin.peak};
+}
+
+void EspClass::restart() {
+  simRestart("ESP.restart()");
+}
+
+uint32_t EspClass::getFreeHeap() {
+  return simHeapFree();
+}
+
+uint32_t EspClass::getMinFreeHeap() {
+  return simHeapMinFree();
+}
+
+uint32_t EspClass::getMaxAllocHeap() {
+  uint32_t free_bytes = simHeapFree();
+  return free_bytes < HEAP_LARGEST_BLOCK ? free_bytes : HEAP_LARGEST_BLOCK;
+}
+
+// -----------------------------------------------
+// Core functions
+// -----------------------------------------------
+unsigned long millis() {
+  return esp_timer_get_time() / 1000;
+}
+
+unsigned long micros() {
+  return esp_timer_get_time();
+}
+
+void delay(uint32_t ms) {
+  vTaskDelay(ms);
+}
+
+void yield() {
+  simYield();
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t value) {}
+
+static std::function<int(int)> analog_reader;
+
+void simSetAnalog(std::function<int(int pin)> reader) {
+  analog_reader = reader;
+}
+
+int simAnalogRead(int pin) {
+  return analog_reader ? analog_reader(pin) : 2048;
+}
+
+int analogRead(uint8_t pin) {
+  return simAnalogRead(pin);
+}
+
+int simGettimeofday(struct timeval* tv, void* tz) {
+  int64_t utc_us = simSystemTimeGet();
+  tv->tv_sec = utc_us / 1000000;
+  tv->tv_usec = utc_us % 1000000;
+  return 0;
+}
+
+int simSettimeofday(const struct timeval* tv, const void* tz) {
+  simSystemTimeSet((int64_t)tv->tv_sec * 1000000 + tv->tv_usec);
+  return 0;
+}
+
+// -----------------------------------------------
+// Serial
+// -----------------------------------------------
+static bool serial_verbose = false;
+static std::string serial_line;
+static std::deque<char> serial_input;
+
+void simSerialVerbose(bool verbose) {
+  serial_verbose = verbose;
+}
+
+void simSerialWrite(const char* data, size_t length) {
+  for (size_t i = 0; i < length; i++) {
+    if (data[i] == '\r') continue;
+    if (data[i] != '\n') {
+      serial_line += data[i];
+      continue;
+    }
+    if (serial_verbose) fprintf(stderr, "[%10.3f] %s\n", simNowUs() / 1e6, serial_line.c_str());
+    serial_line.clear();
+  }
+}
+
+void simSerialInput(const std::string& text) {
+  serial_input.insert(serial_input.end(), text.begin(), text.end());
+}
+
+int simSerialAvailable() {
+  return serial_input.size();
+}
+
+int simSerialRead() {
+  if (serial_input.empty()) return -1;
+  char c = serial_input.front();
+  serial_input.pop_front();
+  return (uint8_t)c;
+}
+
+size_t HardwareSerial::write(const uint8_t* data, size_t length) {
+  simSerialWrite((const char*)data, length);
+  return length;
+}
+
+int HardwareSerial::available() {
+  return simSerialAvailable();
+}
+
+int HardwareSerial::read() {
+  return simSerialRead();
+}
+
+// -----------------------------------------------
+// Display bus
+// -----------------------------------------------
+static std::vector<SimDisplayListener> display_listeners;
+
+void simDisplayListen(SimDisplayListener listener) {
+  display_listeners.push_back(listener);
+}
+
+void simDisplayRecord(const SimDisplayWrite& write) {
+  SimHeapUncounted uncounted;
+  for (SimDisplayListener& listener : display_listeners) listener(write);
+}
+
+void simDisplayBusTransfer(const uint8_t* bytes, size_t length) {
+  if (length == 0) return;
+  SimDisplayWrite write;
+  write.mono_us = simNowUs();
+  write.command = bytes[0];
+  write.data.assign(bytes + 1, bytes + length);
+  simDisplayRecord(write);
+}
+
+// -----------------------------------------------
+// Preferences (NVS)
+// -----------------------------------------------
+struct NvsValue {
+  char type;  // 'b' blob, 's' string, 'i' int32
+  std::string data;
+};
+
+static std::map<std::string, std::map<std::string, NvsValue>> nvs;
+
+void simNvsPut(const char* ns, const char* key, const std::string& value, char type) {
+  nvs[ns][key] = NvsValue{type, value};
+}
+
+std::string simNvsSerialize() {
+  std::string out;
+  for (auto& space : nvs) {
+    for (auto& entry : space.second) {
+      uint32_t length = entry.second.data.size();
+      out += space.first + '\0' + entry.first + '\0' + entry.second.type;
+      out.append((const char*)&length, 4);
+      out += entry.second.data;
+    }
+  }
+  return out;
+}
+
+void simNvsDeserialize(const std::string& data) {
+  nvs.clear();
+  size_t pos = 0;
+  while (pos < data.size()) {
+    std::string ns = data.c_str() + pos;
+    pos += ns.size() + 1;
+    std::string key = data.c_str() + pos;
+    pos += key.size() + 1;
+    char type = data[pos++];
+    uint32_t length;
+    memcpy(&length, data.data() + pos, 4);
+    pos += 4;
+    nvs[ns][key] = NvsValue{type, data.substr(pos, length)};
+    pos += length;
+  }
+}
+
+static const NvsValue* nvsFind(const std::string& ns, const char* key, char type) {
+  auto space = nvs.find(ns);
+  if (space == nvs.end()) return NULL;
+  auto entry = space->second.find(key);
+  if (entry == space->second.end() || entry->second.type != type) return NULL;
+  return &entry->second;
+}
+
+bool Preferences::begin(const char* name, bool read_only) {
+  ns = name;
+  open = true;
+  this->read_only = read_only;
+  return true;
+}
+
+void Preferences::end() {
+  open = false;
+}
+
+bool Preferences::clear() {
+  if (!open || read_only) return false;
+  nvs.erase(ns);
+  return true;
+}
+
+bool Preferences::remove(const char* key) {
+  if (!open || read_only) return false;
+  return nvs[ns].erase(key) > 0;
+}
+
+bool Preferences::isKey(const char* key) {
+  return open && nvs.count(ns) && nvs[ns].count(key);
+}
+
+size_t Preferences::putBytes(const char* key, const void* value, size_t length) {
+  if (!open || read_only) return 0;
+  nvs[ns][key] = NvsValue{'b', std::string((const char*)value, length)};
+  return length;
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t max_length) {
+  const NvsValue* value = open ? nvsFind(ns, key, 'b') : NULL;
+  if (!value || value->data.size() > max_length) return 0;
+  memcpy(buf, value->data.data(), value->data.size());
+  return value->data.size();
+}
+
+size_t Preferences::getBytesLength(const char* key) {
+  const NvsValue* value = open ? nvsFind(ns, key, 'b') : NULL;
+  return value ? value->data.size() : 0;
+}
+
+size_t Preferences::putString(const char* key, const String& value) {
+  if (!open || read_only) return 0;
+  nvs[ns][key] = NvsValue{'s', value.c_str()};
+  return value.length();
+}
+
+String Preferences::getString(const char* key, const String& default_value) {
+  const NvsValue* value = open ? nvsFind(ns, key, 's') : NULL;
+  return value ? String(value->data) : default_value;
+}
+
+size_t Preferences::putInt(const char* key, int32_t value) {
+  if (!open || read_only) return 0;
+  nvs[ns][key] = NvsValue{'i', std::to_string(value)};
+  return 4;
+}
+
+int32_t Preferences::getInt(const char* key, int32_t default_value) {
+  const NvsValue* value = open ? nvsFind(ns, key, 'i') : NULL;
+  return value ? atoi(value->data.c_str()) : default_value;
+}
+
+// -----------------------------------------------
+// mbedtls: HMAC-SHA256
+// -----------------------------------------------
+struct mbedtls_md_info_t {
+  int type;
+};
+
+static const mbedtls_md_info_t sha256_info = {MBEDTLS_MD_SHA256};
+
+static const uint32_t SHA256_K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t rotr(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+static void sha256(const std::string& message, uint8_t* digest) {
+  uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+  std::string padded = message;
+  uint64_t bits = (uint64_t)message.size() * 8;
+  padded += (char)0x80;
+  while (padded.size() % 64 != 56) padded += (char)0;
+  for (int i = 7; i >= 0; i--) padded += (char)(bits >> (i * 8));
+
+  for (size_t chunk = 0; chunk < padded.size(); chunk += 64) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+      const uint8_t* p = (const uint8_t*)padded.data() + chunk + i * 4;
+      w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+    }
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t t1 = k + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+      uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      k = g, g = f, f = e, e = d + t1, d = c, c = b, b = a, a = t1 + t2;
+    }
+    h[0] += a, h[1] += b, h[2] += c, h[3] += d, h[4] += e, h[5] += f, h[6] += g, h[7] += k;
+  }
+  for (int i = 0; i < 8; i++) {
+    for (int j = 0; j < 4; j++) digest[i * 4 + j] = h[i] >> (24 - j * 8);
+  }
+}
+
+const mbedtls_md_info_t* mbedtls_md_info_from_type(mbedtls_md_type_t md_type) {
+  return md_type == MBEDTLS_MD_SHA256 ? &sha256_info : NULL;
+}
+
+int mbedtls_md_hmac(const mbedtls_md_info_t* md_info, const unsigned char* key, size_t keylen,
+                    const unsigned char* input, size_t ilen, unsigned char* output) {
+  if (md_info != &sha256_info) return -1;
+  uint8_t block[64] = {0};
+  if (keylen > 64) sha256(std::string((const char*)key, keylen), block);
+  else memcpy(block, key, keylen);
+  std::string inner, outer;
+  for (int i = 0; i < 64; i++) {
+    inner += (char)(block[i] ^ 0x36);
+    outer += (char)(block[i] ^ 0x5c);
+  }
+  uint8_t inner_digest[32];
+  sha256(inner + std::string((const char*)input, ilen), inner_digest);
+  sha256(outer + std::string((const char*)inner_digest, 32), output);
+  return 0;
+}
@@ -0,0 +1,196 @@
+// Host mock of the ESP32 Arduino core: the subset the sketch uses, backed
+// by the simulator (../sim.h) for time, tasks and peripherals
+#pragma once
+
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include <algorithm>
+#include <functional>
+#include <string>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define PROGMEM
+#define PGM_P const char*
+#define F(x) (x)
+#define IRAM_ATTR
+#define RTC_DATA_ATTR __attribute__((section("rtc_noinit")))
+#define RTC_NOINIT_ATTR __attribute__((section("rtc_noinit")))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+
+#define ARDUINO_RUNNING_CORE (portNUM_PROCESSORS > 1 ? 1 : 0)
+
+#define OUTPUT 0x03
+#define INPUT 0x01
+#define LOW 0
+#define HIGH 1
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+using std::max;
+using std::min;
+
+class String {
+ public:
+  String(const char* text = "") : s(text ? text : "") {}
+  String(const std::string& text) : s(text) {}
+  explicit String(char c) : s(1, c) {}
+  explicit String(int v) : s(std::to_string(v)) {}
+  explicit String(unsigned v) : s(std::to_string(v)) {}
+  explicit String(long v) : s(std::to_string(v)) {}
+  explicit String(unsigned long v) : s(std::to_string(v)) {}
+
+  String& operator+=(const String& o) { s += o.s; return *this; }
+  String& operator+=(const char* o) { s += o; return *this; }
+  String& operator+=(char o) { s += o; return *this; }
+  friend String operator+(const String& a, const String& b) { return String(a.s + b.s); }
+  friend String operator+(const String& a, const char* b) { return String(a.s + b); }
+  friend String operator+(const char* a, const String& b) { return String(a + b.s); }
+  bool operator==(const String& o) const { return s == o.s; }
+  bool operator!=(const String& o) const { return s != o.s; }
+  bool operator==(const char* o) const { return s == o; }
+  bool operator!=(const char* o) const { return s != o; }
+  char operator[](unsigned i) const { return i < s.size() ? s[i] : 0; }
+
+  unsigned length() const { return s.size(); }
+  const char* c_str() const { return s.c_str(); }
+  long toInt() const { return atol(s.c_str()); }
+  float toFloat() const { return atof(s.c_str()); }
+  bool reserve(unsigned size) { s.reserve(size); return true; }
+
+ private:
+  std::string s;
+};
+
+class IPAddress;
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(const uint8_t* data, size_t length) = 0;
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const char* text, size_t length) { return write((const uint8_t*)text, length); }
+
+  size_t print(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+  size_t print(const String& text) { return print(text.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(int v) { return printf("%d", v); }
+  size_t print(unsigned v) { return printf("%u", v); }
+  size_t print(long v) { return printf("%ld", v); }
+  size_t print(unsigned long v) { return printf("%lu", v); }
+  size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+  size_t print(const IPAddress& ip);
+  template <typename T>
+  size_t println(const T& v) { return print(v) + println(); }
+  size_t println() { return print("\r\n"); }
+
+  size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (n < 0) return 0;
+    return write((const uint8_t*)buf, (size_t)n < sizeof(buf) ? n : sizeof(buf) - 1);
+  }
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+};
+
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long baud) {}
+  size_t write(const uint8_t* data, size_t length) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  operator bool() const { return true; }
+};
+
+extern HardwareSerial Serial;
+
+// Bytes in network order, as on the device
+class IPAddress {
+ public:
+  IPAddress() : bytes{0, 0, 0, 0} {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : bytes{a, b, c, d} {}
+  IPAddress(uint32_t address) { memcpy(bytes, &address, 4); }
+
+  uint8_t operator[](int i) const { return bytes[i]; }
+  uint8_t& operator[](int i) { return bytes[i]; }
+  operator uint32_t() const {
+    uint32_t v;
+    memcpy(&v, bytes, 4);
+    return v;
+  }
+  bool operator==(const IPAddress& o) const { return memcmp(bytes, o.bytes, 4) == 0; }
+  bool operator!=(const IPAddress& o) const { return !(*this == o); }
+
+  bool fromString(const char* text) {
+    unsigned a, b, c, d;
+    char extra;
+    if (sscanf(text, "%u.%u.%u.%u%c", &a, &b, &c, &d, &extra) != 4 || a > 255 || b > 255 || c > 255 || d > 255) {
+      return false;
+    }
+    bytes[0] = a, bytes[1] = b, bytes[2] = c, bytes[3] = d;
+    return true;
+  }
+  bool fromString(const String& text) { return fromString(text.c_str()); }
+  String toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", bytes[0], bytes[1], bytes[2], bytes[3]);
+    return String(buf);
+  }
+
+ private:
+  uint8_t bytes[4];
+};
+
+inline size_t Print::print(const IPAddress& ip) {
+  return print(ip.toString());
+}
+
+class EspClass {
+ public:
+  [[noreturn]] void restart();
+  uint32_t getFreeHeap();
+  uint32_t getMinFreeHeap();
+  uint32_t getMaxAllocHeap();
+  uint32_t getCpuFreqMHz() { return 240; }
+};
+
+extern EspClass ESP;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void yield();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int analogRead(uint8_t pin);
+
+// System time is the simulator's, not the host's
+int simGettimeofday(struct timeval* tv, void* tz);
+int simSettimeofday(const struct timeval* tv, const void* tz);
+#define gettimeofday simGettimeofday
+#define settimeofday simSettimeofday
+
+void setup();
+void loop();
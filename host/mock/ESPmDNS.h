@@ -0,0 +1,9 @@
+#pragma once
+#include "Arduino.h"
+
+class MDNSResponder {
+ public:
+  bool begin(const char* hostname) { return true; }
+};
+
+extern MDNSResponder MDNS;
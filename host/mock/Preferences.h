@@ -0,0 +1,25 @@
+// NVS namespaces in memory; the simulator carries them across restarts
+#pragma once
+#include "Arduino.h"
+
+class Preferences {
+ public:
+  bool begin(const char* name, bool read_only = false);
+  void end();
+  bool clear();
+  bool remove(const char* key);
+  bool isKey(const char* key);
+
+  size_t putBytes(const char* key, const void* value, size_t length);
+  size_t getBytes(const char* key, void* buf, size_t max_length);
+  size_t getBytesLength(const char* key);
+  size_t putString(const char* key, const String& value);
+  String getString(const char* key, const String& default_value = String());
+  size_t putInt(const char* key, int32_t value);
+  int32_t getInt(const char* key, int32_t default_value = 0);
+
+ private:
+  std::string ns;
+  bool open = false;
+  bool read_only = true;
+};
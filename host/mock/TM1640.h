@@ -0,0 +1,67 @@
+// TM16xx/TM1640 library with the bus replaced by a recorder: every
+// start..stop transfer is handed to the simulator with its bytes
+#pragma once
+#include "Arduino.h"
+
+#define TM16XX_CMD_DATA_AUTO 0x40
+#define TM16XX_CMD_DATA_READ 0x42
+#define TM16XX_CMD_DATA_FIXED 0x44
+#define TM16XX_CMD_DISPLAY 0x80
+#define TM16XX_CMD_ADDRESS 0xC0
+
+void simDisplayBusTransfer(const uint8_t* bytes, size_t length);
+
+class TM16xx {
+ public:
+  TM16xx(byte dataPin, byte clockPin, byte strobePin, byte maxDisplays, byte nDigitsUsed, bool activateDisplay = true,
+         byte intensity = 7)
+      : digits(nDigitsUsed), maxDisplays(maxDisplays) {}
+  virtual ~TM16xx() {}
+
+  virtual void begin(bool activateDisplay = true, byte intensity = 7) {
+    clearDisplay();
+    setupDisplay(activateDisplay, intensity);
+  }
+  virtual void setupDisplay(bool active, byte intensity) {
+    sendCommand(TM16XX_CMD_DISPLAY | (active ? 8 : 0) | min((byte)7, intensity));
+  }
+  virtual void clearDisplay() {
+    sendCommand(TM16XX_CMD_DATA_AUTO);
+    start();
+    send(TM16XX_CMD_ADDRESS);
+    for (int i = 0; i < maxDisplays; i++) send(0);
+    stop();
+  }
+
+ protected:
+  virtual void sendCommand(byte cmd) {
+    start();
+    send(cmd);
+    stop();
+  }
+  virtual void sendData(byte address, byte data) {
+    sendCommand(TM16XX_CMD_DATA_FIXED);
+    start();
+    send(TM16XX_CMD_ADDRESS | address);
+    send(data);
+    stop();
+  }
+  virtual void send(byte data) {
+    if (transfer_length < sizeof(transfer)) transfer[transfer_length++] = data;
+  }
+  virtual void start() { transfer_length = 0; }
+  virtual void stop() { simDisplayBusTransfer(transfer, transfer_length); }
+
+  byte digits;
+  byte maxDisplays;
+
+ private:
+  uint8_t transfer[32];
+  size_t transfer_length = 0;
+};
+
+class TM1640 : public TM16xx {
+ public:
+  TM1640(byte dataPin, byte clockPin, byte numDigits = 16, bool activateDisplay = true, byte intensity = 7)
+      : TM16xx(dataPin, clockPin, dataPin, 16, numDigits, activateDisplay, intensity) {}
+};
@@ -0,0 +1,70 @@
+// Station and soft-AP Wi-Fi as scripted by the scenario (sim.h,
+// simWifiConfigure); events are delivered like the ESP32 event task does
+#pragma once
+#include "Arduino.h"
+#include "WiFiUdp.h"
+
+typedef enum { WIFI_OFF = 0, WIFI_STA = 1, WIFI_AP = 2, WIFI_AP_STA = 3 } wifi_mode_t;
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6,
+} wl_status_t;
+
+#define WIFI_SCAN_RUNNING (-1)
+#define WIFI_SCAN_FAILED (-2)
+
+typedef enum {
+  ARDUINO_EVENT_WIFI_READY = 0,
+  ARDUINO_EVENT_WIFI_STA_START = 2,
+  ARDUINO_EVENT_WIFI_STA_CONNECTED = 4,
+  ARDUINO_EVENT_WIFI_STA_DISCONNECTED = 5,
+  ARDUINO_EVENT_WIFI_STA_GOT_IP = 7,
+  ARDUINO_EVENT_WIFI_STA_LOST_IP = 8,
+} arduino_event_id_t;
+
+typedef struct {
+  struct {
+    uint8_t ssid[33];
+    uint8_t ssid_len;
+    uint8_t reason;
+  } wifi_sta_disconnected;
+} arduino_event_info_t;
+
+typedef enum {
+  WIFI_REASON_ASSOC_LEAVE = 8,
+  WIFI_REASON_BEACON_TIMEOUT = 200,
+  WIFI_REASON_NO_AP_FOUND = 201,
+  WIFI_REASON_AUTH_FAIL = 202,
+} wifi_err_reason_t;
+
+typedef void (*WiFiEventFuncCb)(arduino_event_id_t event, arduino_event_info_t info);
+typedef int wifi_event_id_t;
+
+class WiFiClass {
+ public:
+  bool mode(wifi_mode_t mode);
+  wl_status_t begin(const char* ssid, const char* passphrase = NULL);
+  bool disconnect(bool wifioff = false, bool eraseap = false);
+  bool setAutoReconnect(bool autoReconnect) { return true; }
+  wl_status_t status();
+  IPAddress localIP();
+  int8_t RSSI();
+  wifi_event_id_t onEvent(WiFiEventFuncCb callback);
+
+  bool softAP(const char* ssid, const char* passphrase = NULL);
+  IPAddress softAPIP();
+
+  int16_t scanNetworks(bool async = false);
+  int16_t scanComplete();
+  void scanDelete();
+  String SSID(uint8_t index);
+  int32_t RSSI(uint8_t index);
+};
+
+extern WiFiClass WiFi;
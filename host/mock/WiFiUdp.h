@@ -0,0 +1,41 @@
+// WiFiUDP over a simulator socket
+#pragma once
+#include <vector>
+
+#include "Arduino.h"
+
+class WiFiUDP : public Stream {
+ public:
+  ~WiFiUDP() { stop(); }
+
+  uint8_t begin(uint16_t port);
+  uint8_t beginMulticast(IPAddress group, uint16_t port);
+  void stop();
+
+  int beginPacket(IPAddress ip, uint16_t port);
+  int beginMulticastPacket();
+  int endPacket();
+  size_t write(const uint8_t* data, size_t length) override;
+  using Print::write;
+
+  int parsePacket();
+  int available() override { return rx.size() - rx_pos; }
+  int read() override { return rx_pos < rx.size() ? rx[rx_pos++] : -1; }
+  int read(unsigned char* buffer, size_t length);
+  int read(char* buffer, size_t length) { return read((unsigned char*)buffer, length); }
+  void flush() { rx_pos = rx.size(); }
+  IPAddress remoteIP() { return remote_ip; }
+  uint16_t remotePort() { return remote_port; }
+
+ private:
+  int fd = -1;
+  IPAddress multicast_ip;
+  uint16_t multicast_port = 0;
+  IPAddress tx_ip;
+  uint16_t tx_port = 0;
+  std::vector<uint8_t> tx;
+  std::vector<uint8_t> rx;
+  size_t rx_pos = 0;
+  IPAddress remote_ip;
+  uint16_t remote_port = 0;
+};
@@ -0,0 +1,10 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// The nominal device heap in mock.cpp; the sketch's operator new comes here
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+void* heap_caps_malloc(size_t size, uint32_t caps);
+void heap_caps_free(void* p);
+size_t heap_caps_get_allocated_size(void* p);
@@ -0,0 +1,48 @@
+// FreeRTOS as ESP-IDF configures it (1 kHz tick); tasks are simulator coroutines
+#pragma once
+#include <stdint.h>
+
+#ifndef SIM_CORES
+#define SIM_CORES 2
+#endif
+#define portNUM_PROCESSORS SIM_CORES
+
+typedef struct SimTask* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef void* SemaphoreHandle_t;
+
+// One task runs at a time, so critical sections need no lock
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) ((void)(mux))
+#define portEXIT_CRITICAL(mux) ((void)(mux))
+
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY 0xffffffffUL
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY (-1)
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define configMAX_PRIORITIES 25
+
+typedef enum { eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite } eNotifyAction;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack, void* arg, UBaseType_t priority,
+                       TaskHandle_t* handle);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
+TaskHandle_t xTaskGetCurrentTaskHandle();
+BaseType_t xPortGetCoreID();
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t* value, TickType_t ticks);
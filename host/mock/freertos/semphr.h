@@ -0,0 +1,7 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t semaphore);
@@ -0,0 +1,7 @@
+#pragma once
+#include "lwip/ip_addr.h"
+
+typedef void (*dns_found_callback)(const char* name, const ip_addr_t* ipaddr, void* callback_arg);
+
+// Must be called from the lwIP thread (tcpip_callback)
+err_t dns_gethostbyname(const char* hostname, ip_addr_t* addr, dns_found_callback found, void* callback_arg);
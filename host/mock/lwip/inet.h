@@ -0,0 +1,17 @@
+#pragma once
+#include <stdint.h>
+
+struct in_addr {
+  uint32_t s_addr;  // network order
+};
+
+#define INADDR_ANY ((uint32_t)0x00000000UL)
+
+inline uint16_t lwip_htons(uint16_t v) { return (uint16_t)((v << 8) | (v >> 8)); }
+inline uint32_t lwip_htonl(uint32_t v) {
+  return ((v & 0xff) << 24) | ((v & 0xff00) << 8) | ((v >> 8) & 0xff00) | (v >> 24);
+}
+#define htons(v) lwip_htons(v)
+#define ntohs(v) lwip_htons(v)
+#define htonl(v) lwip_htonl(v)
+#define ntohl(v) lwip_htonl(v)
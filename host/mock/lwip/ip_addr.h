@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+
+typedef int8_t err_t;
+#define ERR_OK 0
+#define ERR_MEM -1
+#define ERR_INPROGRESS -5
+#define ERR_ARG -16
+
+typedef struct {
+  uint32_t addr;  // network order
+} ip4_addr_t;
+
+typedef struct {
+  union {
+    ip4_addr_t ip4;
+  } u_addr;
+  uint8_t type;
+} ip_addr_t;
+
+#define IPADDR_TYPE_V4 0
+#define IP_IS_V4(ipaddr) ((ipaddr)->type == IPADDR_TYPE_V4)
+#define ip_2_ip4(ipaddr) (&((ipaddr)->u_addr.ip4))
+#define ip4_addr_get_u32(src_ipaddr) ((src_ipaddr)->addr)
@@ -0,0 +1,78 @@
+// lwIP's BSD socket API over the simulator's network. Like ESP-IDF, the
+// POSIX names are inline wrappers rather than macros, except select(),
+// which the host's <sys/select.h> already declares.
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/select.h>
+#include <sys/types.h>
+
+#include "lwip/inet.h"
+
+typedef uint32_t socklen_t;
+typedef uint8_t sa_family_t;
+typedef uint16_t in_port_t;
+
+#define AF_INET 2
+#define PF_INET AF_INET
+#define SOCK_STREAM 1
+#define SOCK_DGRAM 2
+#define IPPROTO_IP 0
+#define IPPROTO_TCP 6
+#define IPPROTO_UDP 17
+#define SOL_SOCKET 0xfff
+#define SO_REUSEADDR 0x0004
+#define SO_RCVTIMEO 0x1006
+#define IP_ADD_MEMBERSHIP 3
+#define TCP_NODELAY 0x01
+#define MSG_DONTWAIT 0x08
+
+struct sockaddr {
+  uint8_t sa_len;
+  sa_family_t sa_family;
+  char sa_data[14];
+};
+
+struct sockaddr_in {
+  uint8_t sin_len;
+  sa_family_t sin_family;
+  in_port_t sin_port;
+  struct in_addr sin_addr;
+  char sin_zero[8];
+};
+
+struct ip_mreq {
+  struct in_addr imr_multiaddr;
+  struct in_addr imr_interface;
+};
+
+int lwip_socket(int domain, int type, int protocol);
+int lwip_bind(int s, const struct sockaddr* name, socklen_t namelen);
+ssize_t lwip_recvfrom(int s, void* mem, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen);
+ssize_t lwip_sendto(int s, const void* data, size_t size, int flags, const struct sockaddr* to, socklen_t tolen);
+int lwip_setsockopt(int s, int level, int optname, const void* optval, socklen_t optlen);
+int lwip_listen(int s, int backlog);
+int lwip_accept(int s, struct sockaddr* addr, socklen_t* addrlen);
+ssize_t lwip_recv(int s, void* mem, size_t len, int flags);
+ssize_t lwip_send(int s, const void* data, size_t size, int flags);
+int lwip_select(int maxfdp1, fd_set* readset, fd_set* writeset, fd_set* exceptset, struct timeval* timeout);
+int lwip_close(int s);
+
+inline int socket(int domain, int type, int protocol) { return lwip_socket(domain, type, protocol); }
+inline int bind(int s, const struct sockaddr* name, socklen_t namelen) { return lwip_bind(s, name, namelen); }
+inline ssize_t recvfrom(int s, void* mem, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen) {
+  return lwip_recvfrom(s, mem, len, flags, from, fromlen);
+}
+inline ssize_t sendto(int s, const void* data, size_t size, int flags, const struct sockaddr* to, socklen_t tolen) {
+  return lwip_sendto(s, data, size, flags, to, tolen);
+}
+inline int setsockopt(int s, int level, int optname, const void* optval, socklen_t optlen) {
+  return lwip_setsockopt(s, level, optname, optval, optlen);
+}
+inline int listen(int s, int backlog) { return lwip_listen(s, backlog); }
+inline int accept(int s, struct sockaddr* addr, socklen_t* addrlen) { return lwip_accept(s, addr, addrlen); }
+inline ssize_t recv(int s, void* mem, size_t len, int flags) { return lwip_recv(s, mem, len, flags); }
+inline ssize_t send(int s, const void* data, size_t size, int flags) { return lwip_send(s, data, size, flags); }
+#define select(maxfdp1, readset, writeset, exceptset, timeout) \
+  lwip_select(maxfdp1, readset, writeset, exceptset, timeout)
+inline int closesocket(int s) { return lwip_close(s); }
@@ -0,0 +1,7 @@
+#pragma once
+#include "lwip/ip_addr.h"
+
+typedef void (*tcpip_callback_fn)(void* ctx);
+
+// Queues fn to run on the lwIP thread
+err_t tcpip_callback(tcpip_callback_fn fn, void* ctx);
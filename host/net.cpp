@@ -0,0 +1,844 @@
+// Simulated network for the host build: datagram and stream sockets,
+// remote hosts, DNS and the Wi-Fi link; see sim.h
+#include <errno.h>
+
+#include <deque>
+#include <map>
+
+#include "sim.h"
+#include "WiFi.h"
+#include "lwip/dns.h"
+#include "lwip/sockets.h"
+#include "lwip/tcpip.h"
+
+const size_t SOCKET_RX_QUEUE = 16;   // datagrams buffered per socket, as lwIP's receive mailbox
+const int MAX_SOCKETS = 16;          // CONFIG_LWIP_MAX_SOCKETS
+const int FIRST_FD = 54;             // LWIP_SOCKET_OFFSET on the ESP32
+const size_t TCP_SEND_BUFFER = 5744; // CONFIG_LWIP_TCP_SND_BUF_DEFAULT, 4 segments
+const int64_t DNS_LOOKUP_US = 30000;
+const int64_t SCAN_DURATION_US = 2200000;
+const int64_t BEACON_LOSS_US = 3000000;  // AP gone to the station noticing
+const uint32_t SOFT_AP_IP = simIp(192, 168, 4, 1);
+
+struct SimSocket {
+  int type;
+  uint16_t port;
+  std::vector<uint32_t> groups;
+  std::deque<SimDatagram> rx;
+  int64_t timeout_us;  // 0 blocks forever
+  bool listening = false;
+  size_t backlog_max = 0;
+  std::deque<int> backlog;  // connections waiting for accept()
+  int conn = -1;            // accepted connection
+};
+
+// A TCP connection from a driver-side peer to the clock. Bytes the clock
+// sends reach the peer at its read speed, and leave the clock's send
+// buffer only when the peer's ACK comes back, so a slow reader fills it.
+struct SimTcpConn {
+  uint32_t ip;
+  uint16_t port;
+  int64_t delay_us;       // one way
+  uint32_t bytes_per_ms;  // peer read speed, 0 for unlimited
+  SimTcpPeer* peer;       // NULL once the peer has let go
+  int fd = -1;            // clock's socket once accepted
+  std::string rx;         // arrived at the clock, not yet read
+  bool peer_fin = false;  // the peer's close has arrived
+  bool device_closed = false;
+  size_t unacked = 0;     // in the clock's send buffer
+  int64_t reader_free_us = 0;  // when the peer has read everything sent so far
+};
+
+static std::map<int, SimSocket*> sockets;
+static std::map<int, SimTcpConn*> tcp_conns;
+static int next_conn = 1;
+static uint16_t next_ephemeral_port = 49152;
+static uint16_t next_client_port = 30000;
+static int select_channel;  // select() waits on this; every socket event wakes it
+static std::vector<SimHost*> hosts;
+static std::map<std::string, uint32_t> names;
+static uint32_t device_ip = 0;
+static SimNetStats net_stats = {0, 0, 0};
+
+static void tcpDeviceClose(int id);
+
+static bool isMulticast(uint32_t ip) {
+  return (ip >> 28) == 0xE;
+}
+
+std::string simIpString(uint32_t ip) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", ip >> 24, (ip >> 16) & 255, (ip >> 8) & 255, ip & 255);
+  return buf;
+}
+
+uint32_t simDeviceIp() {
+  return device_ip;
+}
+
+void simSetDeviceIp(uint32_t ip) {
+  device_ip = ip;
+}
+
+// -----------------------------------------------
+// Delivery
+// -----------------------------------------------
+static void socketEvent(SimSocket* socket) {
+  simWake(socket);
+  simWake(&select_channel);
+}
+
+static bool socketWants(const SimSocket* socket, const SimDatagram& packet) {
+  if (socket->type != SOCK_DGRAM || socket->port != packet.dst_port) return false;
+  if (!isMulticast(packet.dst_ip)) return true;
+  for (uint32_t group : socket->groups) {
+    if (group == packet.dst_ip) return true;
+  }
+  return false;
+}
+
+static void deliverToDevice(const SimDatagram& packet) {
+  if (device_ip == 0 || (!isMulticast(packet.dst_ip) && packet.dst_ip != device_ip)) {
+    net_stats.dropped++;
+    return;
+  }
+  bool delivered = false;
+  for (auto& entry : sockets) {
+    SimSocket* socket = entry.second;
+    if (!socketWants(socket, packet)) continue;
+    if (socket->rx.size() >= SOCKET_RX_QUEUE) continue;
+    socket->rx.push_back(packet);
+    socketEvent(socket);
+    delivered = true;
+  }
+  if (delivered) net_stats.delivered++;
+  else net_stats.dropped++;
+}
+
+static void deliverToHost(SimHost* host, const SimDatagram& packet) {
+  simAt(simNowUs() + host->oneWayDelayUs(), [host, packet]() {
+    if (host->online) host->receive(packet);
+    else net_stats.dropped++;
+  });
+}
+
+SimHost::SimHost(uint32_t ip, int64_t delay_us, int64_t jitter_us) : ip(ip), delay_us(delay_us), jitter_us(jitter_us) {}
+
+int64_t SimHost::oneWayDelayUs() {
+  return delay_us + (jitter_us > 0 ? (int64_t)(simUniform() * jitter_us) : 0);
+}
+
+void SimHost::send(uint16_t src_port, uint32_t dst_ip, uint16_t dst_port, const uint8_t* data, size_t length) {
+  if (!online) return;
+  SimDatagram packet{ip, src_port, dst_ip, dst_port, std::vector<uint8_t>(data, data + length)};
+  net_stats.sent++;
+  simAt(simNowUs() + oneWayDelayUs(), [packet]() { deliverToDevice(packet); });
+  if (isMulticast(dst_ip)) {
+    for (SimHost* host : hosts) {
+      if (host == this) continue;
+      for (uint32_t group : host->groups) {
+        if (group == dst_ip) deliverToHost(host, packet);
+      }
+    }
+  }
+}
+
+void simNetAddHost(SimHost* host) {
+  hosts.push_back(host);
+}
+
+void simNetAddName(const char* name, uint32_t ip) {
+  names[name] = ip;
+}
+
+uint32_t simNetResolve(const char* name) {
+  auto it = names.find(name);
+  return it == names.end() ? 0 : it->second;
+}
+
+SimNetStats simNetStats() {
+  return net_stats;
+}
+
+// -----------------------------------------------
+// Sockets
+// -----------------------------------------------
+static SimSocket* findSocket(int fd) {
+  auto it = sockets.find(fd);
+  return it == sockets.end() ? NULL : it->second;
+}
+
+// Lowest free descriptor, as lwIP reuses them
+int simSocketOpen(int type) {
+  int fd = FIRST_FD;
+  while (sockets.count(fd)) fd++;
+  if (fd >= FIRST_FD + MAX_SOCKETS) {
+    errno = ENFILE;
+    return -1;
+  }
+  SimSocket* socket = new SimSocket();
+  socket->type = type;
+  socket->port = 0;
+  socket->timeout_us = 0;
+  sockets[fd] = socket;
+  return fd;
+}
+
+int simSocketBind(int fd, uint16_t port) {
+  SimSocket* socket = findSocket(fd);
+  if (!socket) return -1;
+  for (auto& entry : sockets) {
+    SimSocket* other = entry.second;
+    if (other != socket && port != 0 && other->type == socket->type && other->port == port && other->groups.empty()) {
+      errno = EADDRINUSE;
+      return -1;
+    }
+  }
+  socket->port = port ? port : next_ephemeral_port++;
+  return 0;
+}
+
+int simSocketJoin(int fd, uint32_t group) {
+  SimSocket* socket = findSocket(fd);
+  if (!socket) return -1;
+  socket->groups.push_back(group);
+  return 0;
+}
+
+int simSocketSendTo(int fd, uint32_t dst_ip, uint16_t dst_port, const uint8_t* data, size_t length) {
+  SimHeapUncounted uncounted;
+  SimSocket* socket = findSocket(fd);
+  if (!socket) return -1;
+  if (device_ip == 0) {
+    net_stats.dropped++;
+    errno = ENETUNREACH;
+    return -1;
+  }
+  if (socket->port == 0) simSocketBind(fd, 0);
+  SimDatagram packet{device_ip, socket->port, dst_ip, dst_port, std::vector<uint8_t>(data, data + length)};
+  net_stats.sent++;
+  bool to_host = false;
+  for (SimHost* host : hosts) {
+    bool match = host->ip == dst_ip;
+    for (uint32_t group : host->groups) match = match || group == dst_ip;
+    if (!match) continue;
+    deliverToHost(host, packet);
+    to_host = true;
+  }
+  if (isMulticast(dst_ip)) {
+    simAt(simNowUs(), [packet]() { deliverToDevice(packet); });  // multicast loops back
+  } else if (!to_host) {
+    net_stats.dropped++;
+  }
+  return length;
+}
+
+int simSocketRecvFrom(int fd, uint8_t* data, size_t capacity, uint32_t* src_ip, uint16_t* src_port, bool block) {
+  SimSocket* socket = findSocket(fd);
+  if (!socket) return -1;
+  if (socket->rx.empty() && block) {
+    int64_t deadline = socket->timeout_us > 0 ? simNowUs() + socket->timeout_us : INT64_MAX;
+    while (socket->rx.empty() && simBlock(socket, deadline)) {
+      if (!findSocket(fd)) return -1;  // closed meanwhile
+    }
+  }
+  if (socket->rx.empty()) {
+    errno = EAGAIN;
+    return -1;
+  }
+  SimDatagram packet = socket->rx.front();
+  socket->rx.pop_front();
+  size_t n = packet.data.size() < capacity ? packet.data.size() : capacity;
+  memcpy(data, packet.data.data(), n);
+  if (src_ip) *src_ip = packet.src_ip;
+  if (src_port) *src_port = packet.src_port;
+  return n;
+}
+
+int simSocketSetTimeout(int fd, int64_t timeout_us) {
+  SimSocket* socket = findSocket(fd);
+  if (!socket) return -1;
+  socket->timeout_us = timeout_us;
+  return 0;
+}
+
+int simSocketClose(int fd) {
+  SimSocket* socket = findSocket(fd);
+  if (!socket) return -1;
+  sockets.erase(fd);
+  for (int id : socket->backlog) tcpDeviceClose(id);  // refused
+  if (socket->conn >= 0) tcpDeviceClose(socket->conn);
+  socketEvent(socket);
+  delete socket;
+  return 0;
+}
+
+uint16_t simSocketPort(int fd) {
+  SimSocket* socket = findSocket(fd);
+  return socket ? socket->port : 0;
+}
+
+// -----------------------------------------------
+// TCP
+// -----------------------------------------------
+static SimTcpConn* findConn(int id) {
+  auto it = tcp_conns.find(id);
+  return it == tcp_conns.end() ? NULL : it->second;
+}
+
+static void tcpForget(int id) {
+  SimTcpConn* conn = findConn(id);
+  if (!conn || conn->peer || !conn->device_closed) return;
+  tcp_conns.erase(id);
+  delete conn;
+}
+
+// The clock closes (or refuses) a connection: the peer sees the close
+// once everything sent before it has been read
+static void tcpDeviceClose(int id) {
+  SimTcpConn* conn = findConn(id);
+  if (!conn || conn->device_closed) return;
+  conn->device_closed = true;
+  conn->fd = -1;
+  int64_t at = std::max(simNowUs() + conn->delay_us, conn->reader_free_us);
+  simAt(at, [id]() {
+    SimTcpConn* conn = findConn(id);
+    if (!conn) return;
+    SimTcpPeer* peer = conn->peer;
+    conn->peer = NULL;
+    if (peer) peer->closed();
+    tcpForget(id);
+  });
+}
+
+static SimSocket* findListener(uint16_t port) {
+  for (auto& entry : sockets) {
+    if (entry.second->listening && entry.second->port == port) return entry.second;
+  }
+  return NULL;
+}
+
+int simTcpConnect(uint32_t ip, uint16_t port, int64_t delay_us, uint32_t bytes_per_ms, SimTcpPeer* peer) {
+  int id = next_conn++;
+  SimTcpConn* conn = new SimTcpConn();
+  conn->ip = ip;
+  conn->port = next_client_port++;
+  conn->delay_us = delay_us;
+  conn->bytes_per_ms = bytes_per_ms;
+  conn->peer = peer;
+  tcp_conns[id] = conn;
+  simAt(simNowUs() + delay_us, [id, port]() {
+    SimTcpConn* conn = findConn(id);
+    if (!conn) return;
+    SimSocket* listener = device_ip ? findListener(port) : NULL;
+    if (!listener || listener->backlog.size() >= listener->backlog_max) {
+      tcpDeviceClose(id);  // refused
+      return;
+    }
+    listener->backlog.push_back(id);
+    socketEvent(listener);
+  });
+  return id;
+}
+
+void simTcpSend(int id, const std::string& data) {
+  SimTcpConn* conn = findConn(id);
+  if (!conn) return;
+  simAt(simNowUs() + conn->delay_us, [id, data]() {
+    SimTcpConn* conn = findConn(id);
+    if (!conn || conn->device_closed) return;  // reset
+    conn->rx += data;
+    SimSocket* socket = conn->fd >= 0 ? findSocket(conn->fd) : NULL;
+    if (socket) socketEvent(socket);
+    else simWake(&select_channel);
+  });
+}
+
+void simTcpClose(int id) {
+  SimTcpConn* conn = findConn(id);
+  if (!conn || !conn->peer) return;
+  conn->peer = NULL;
+  simAt(simNowUs() + conn->delay_us, [id]() {
+    SimTcpConn* conn = findConn(id);
+    if (!conn) return;
+    conn->peer_fin = true;
+    SimSocket* socket = conn->fd >= 0 ? findSocket(conn->fd) : NULL;
+    if (socket) socketEvent(socket);
+    tcpForget(id);
+  });
+}
+
+static SimTcpConn* connOf(int fd) {
+  SimSocket* socket = findSocket(fd);
+  return socket && socket->conn >= 0 ? findConn(socket->conn) : NULL;
+}
+
+static bool socketReadable(SimSocket* socket) {
+  if (socket->listening) return !socket->backlog.empty();
+  if (socket->type == SOCK_DGRAM) return !socket->rx.empty();
+  SimTcpConn* conn = findConn(socket->conn);
+  return !conn || !conn->rx.empty() || conn->peer_fin;
+}
+
+static bool socketWritable(SimSocket* socket) {
+  if (socket->type == SOCK_DGRAM) return true;
+  SimTcpConn* conn = findConn(socket->conn);
+  return !conn || conn->peer_fin || conn->unacked < TCP_SEND_BUFFER;
+}
+
+// -----------------------------------------------
+// lwIP
+// -----------------------------------------------
+int lwip_socket(int domain, int type, int protocol) {
+  if (domain != AF_INET || (type != SOCK_DGRAM && type != SOCK_STREAM)) {
+    errno = EAFNOSUPPORT;
+    return -1;
+  }
+  return simSocketOpen(type);
+}
+
+int lwip_bind(int s, const struct sockaddr* name, socklen_t namelen) {
+  const sockaddr_in* addr = (const sockaddr_in*)name;
+  return simSocketBind(s, ntohs(addr->sin_port));
+}
+
+ssize_t lwip_recvfrom(int s, void* mem, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen) {
+  uint32_t src_ip;
+  uint16_t src_port;
+  int n = simSocketRecvFrom(s, (uint8_t*)mem, len, &src_ip, &src_port, true);
+  if (n >= 0 && from) {
+    sockaddr_in* addr = (sockaddr_in*)from;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(src_port);
+    addr->sin_addr.s_addr = htonl(src_ip);
+    if (fromlen) *fromlen = sizeof(*addr);
+  }
+  return n;
+}
+
+ssize_t lwip_sendto(int s, const void* data, size_t size, int flags, const struct sockaddr* to, socklen_t tolen) {
+  const sockaddr_in* addr = (const sockaddr_in*)to;
+  return simSocketSendTo(s, ntohl(addr->sin_addr.s_addr), ntohs(addr->sin_port), (const uint8_t*)data, size);
+}
+
+int lwip_setsockopt(int s, int level, int optname, const void* optval, socklen_t optlen) {
+  if (level == SOL_SOCKET && optname == SO_RCVTIMEO) {
+    const struct timeval* tv = (const struct timeval*)optval;
+    return simSocketSetTimeout(s, (int64_t)tv->tv_sec * 1000000 + tv->tv_usec);
+  }
+  if (level == IPPROTO_IP && optname == IP_ADD_MEMBERSHIP) {
+    const ip_mreq* mreq = (const ip_mreq*)optval;
+    return simSocketJoin(s, ntohl(mreq->imr_multiaddr.s_addr));
+  }
+  return 0;
+}
+
+int lwip_listen(int s, int backlog) {
+  SimSocket* socket = findSocket(s);
+  if (!socket || socket->type != SOCK_STREAM) return -1;
+  socket->listening = true;
+  socket->backlog_max = backlog > 0 ? backlog : 1;
+  return 0;
+}
+
+int lwip_accept(int s, struct sockaddr* addr, socklen_t* addrlen) {
+  SimSocket* listener = findSocket(s);
+  if (!listener || !listener->listening) return -1;
+  while (listener->backlog.empty()) {
+    if (!simBlock(listener, INT64_MAX) || !findSocket(s)) return -1;
+  }
+  SimHeapUncounted uncounted;
+  int fd = simSocketOpen(SOCK_STREAM);
+  if (fd < 0) return -1;
+  int id = listener->backlog.front();
+  listener->backlog.pop_front();
+  SimTcpConn* conn = findConn(id);
+  SimSocket* socket = findSocket(fd);
+  socket->port = listener->port;
+  socket->conn = id;
+  if (conn) conn->fd = fd;
+  if (conn && addr) {
+    sockaddr_in* in = (sockaddr_in*)addr;
+    memset(in, 0, sizeof(*in));
+    in->sin_family = AF_INET;
+    in->sin_port = htons(conn->port);
+    in->sin_addr.s_addr = htonl(conn->ip);
+    if (addrlen) *addrlen = sizeof(*in);
+  }
+  return fd;
+}
+
+ssize_t lwip_recv(int s, void* mem, size_t len, int flags) {
+  SimSocket* socket = findSocket(s);
+  if (socket && socket->type == SOCK_DGRAM) {
+    return simSocketRecvFrom(s, (uint8_t*)mem, len, NULL, NULL, !(flags & MSG_DONTWAIT));
+  }
+  SimTcpConn* conn = connOf(s);
+  if (!conn) {
+    errno = ENOTCONN;
+    return -1;
+  }
+  while (conn->rx.empty() && !conn->peer_fin) {
+    if (flags & MSG_DONTWAIT) {
+      errno = EAGAIN;
+      return -1;
+    }
+    simBlock(socket, INT64_MAX);
+    if (!(conn = connOf(s))) return -1;
+  }
+  size_t n = std::min(len, conn->rx.size());
+  memcpy(mem, conn->rx.data(), n);
+  conn->rx.erase(0, n);
+  return n;
+}
+
+ssize_t lwip_send(int s, const void* data, size_t size, int flags) {
+  SimSocket* socket = findSocket(s);
+  SimTcpConn* conn = connOf(s);
+  if (!conn) {
+    errno = ENOTCONN;
+    return -1;
+  }
+  while (conn->unacked >= TCP_SEND_BUFFER && !conn->peer_fin) {
+    if (flags & MSG_DONTWAIT) {
+      errno = EAGAIN;
+      return -1;
+    }
+    simBlock(socket, INT64_MAX);
+    if (!(conn = connOf(s))) return -1;
+  }
+  if (conn->peer_fin) {
+    errno = ECONNRESET;
+    return -1;
+  }
+  SimHeapUncounted uncounted;
+  size_t n = std::min(size, TCP_SEND_BUFFER - conn->unacked);
+  conn->unacked += n;
+  int id = socket->conn;
+  int64_t arrive = std::max(simNowUs() + conn->delay_us, conn->reader_free_us);
+  int64_t read_us = conn->bytes_per_ms ? (int64_t)n * 1000 / conn->bytes_per_ms : 0;
+  conn->reader_free_us = arrive + read_us;
+  std::string bytes((const char*)data, n);
+  simAt(conn->reader_free_us, [id, bytes]() {
+    SimTcpConn* conn = findConn(id);
+    if (!conn) return;
+    if (conn->peer) conn->peer->received((const uint8_t*)bytes.data(), bytes.size());
+    simAt(simNowUs() + conn->delay_us, [id, n = bytes.size()]() {
+      SimTcpConn* conn = findConn(id);
+      if (!conn) return;
+      conn->unacked -= n;
+      SimSocket* socket = conn->fd >= 0 ? findSocket(conn->fd) : NULL;
+      if (socket) socketEvent(socket);
+    });
+  });
+  return n;
+}
+
+// Waits on select_channel until a watched socket is ready or the timeout
+int lwip_select(int maxfdp1, fd_set* readset, fd_set* writeset, fd_set* exceptset, struct timeval* timeout) {
+  int64_t deadline = timeout ? simNowUs() + (int64_t)timeout->tv_sec * 1000000 + timeout->tv_usec : INT64_MAX;
+  fd_set want_read, want_write;
+  FD_ZERO(&want_read);
+  FD_ZERO(&want_write);
+  if (readset) want_read = *readset;
+  if (writeset) want_write = *writeset;
+  for (;;) {
+    int ready = 0;
+    if (readset) FD_ZERO(readset);
+    if (writeset) FD_ZERO(writeset);
+    if (exceptset) FD_ZERO(exceptset);
+    for (int fd = 0; fd < maxfdp1; fd++) {
+      bool r = FD_ISSET(fd, &want_read), w = FD_ISSET(fd, &want_write);
+      if (!r && !w) continue;
+      SimSocket* socket = findSocket(fd);
+      if (!socket) {
+        errno = EBADF;
+        return -1;
+      }
+      if (r && socketReadable(socket)) FD_SET(fd, readset), ready++;
+      if (w && socketWritable(socket)) FD_SET(fd, writeset), ready++;
+    }
+    if (ready > 0 || simNowUs() >= deadline) return ready;
+    simBlock(&select_channel, deadline);
+  }
+}
+
+int lwip_close(int s) {
+  return simSocketClose(s);
+}
+
+err_t tcpip_callback(tcpip_callback_fn fn, void* ctx) {
+  simAt(simNowUs(), [fn, ctx]() { fn(ctx); });
+  return ERR_OK;
+}
+
+err_t dns_gethostbyname(const char* hostname, ip_addr_t* addr, dns_found_callback found, void* callback_arg) {
+  IPAddress literal;
+  if (literal.fromString(hostname)) {
+    addr->type = IPADDR_TYPE_V4;
+    addr->u_addr.ip4.addr = (uint32_t)literal;
+    return ERR_OK;
+  }
+  std::string name = hostname;
+  simAt(simNowUs() + DNS_LOOKUP_US, [name, found, callback_arg]() {
+    uint32_t ip = device_ip ? simNetResolve(name.c_str()) : 0;
+    if (!ip) {
+      found(name.c_str(), NULL, callback_arg);
+      return;
+    }
+    ip_addr_t result;
+    result.type = IPADDR_TYPE_V4;
+    result.u_addr.ip4.addr = htonl(ip);
+    found(name.c_str(), &result, callback_arg);
+  });
+  return ERR_INPROGRESS;
+}
+
+// -----------------------------------------------
+// WiFiUDP
+// -----------------------------------------------
+static IPAddress toIPAddress(uint32_t ip) {
+  return IPAddress(ip >> 24, (ip >> 16) & 255, (ip >> 8) & 255, ip & 255);
+}
+
+static uint32_t fromIPAddress(IPAddress ip) {
+  return simIp(ip[0], ip[1], ip[2], ip[3]);
+}
+
+uint8_t WiFiUDP::begin(uint16_t port) {
+  stop();
+  fd = simSocketOpen(SOCK_DGRAM);
+  if (simSocketBind(fd, port) != 0) {
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+uint8_t WiFiUDP::beginMulticast(IPAddress group, uint16_t port) {
+  if (!begin(port)) return 0;
+  simSocketJoin(fd, fromIPAddress(group));
+  multicast_ip = group;
+  multicast_port = port;
+  return 1;
+}
+
+void WiFiUDP::stop() {
+  if (fd >= 0) simSocketClose(fd);
+  fd = -1;
+  rx.clear();
+  rx_pos = 0;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+  if (fd < 0 && !begin(0)) return 0;
+  tx_ip = ip;
+  tx_port = port;
+  tx.clear();
+  return 1;
+}
+
+int WiFiUDP::beginMulticastPacket() {
+  return multicast_port ? beginPacket(multicast_ip, multicast_port) : 0;
+}
+
+size_t WiFiUDP::write(const uint8_t* data, size_t length) {
+  tx.insert(tx.end(), data, data + length);
+  return length;
+}
+
+int WiFiUDP::endPacket() {
+  int n = simSocketSendTo(fd, fromIPAddress(tx_ip), tx_port, tx.data(), tx.size());
+  tx.clear();
+  return n >= 0 ? 1 : 0;
+}
+
+int WiFiUDP::parsePacket() {
+  if (fd < 0) return 0;
+  uint8_t buf[1500];
+  uint32_t src_ip;
+  uint16_t src_port;
+  int n = simSocketRecvFrom(fd, buf, sizeof(buf), &src_ip, &src_port, false);
+  if (n <= 0) return 0;
+  rx.assign(buf, buf + n);
+  rx_pos = 0;
+  remote_ip = toIPAddress(src_ip);
+  remote_port = src_port;
+  return n;
+}
+
+int WiFiUDP::read(unsigned char* buffer, size_t length) {
+  size_t n = rx.size() - rx_pos < length ? rx.size() - rx_pos : length;
+  memcpy(buffer, rx.data() + rx_pos, n);
+  rx_pos += n;
+  return n;
+}
+
+// -----------------------------------------------
+// Wi-Fi
+// -----------------------------------------------
+enum SimStationState { STATION_IDLE, STATION_JOINING, STATION_CONNECTED };
+
+static SimWifiConfig wifi_config = {"", "", 3000000, 2000000, simIp(192, 168, 1, 50), -58};
+static SimWifiStats wifi_stats = {0, 0, 0, -1};
+static SimStationState station = STATION_IDLE;
+static uint64_t station_generation = 0;
+static wl_status_t station_status = WL_IDLE_STATUS;
+static std::vector<WiFiEventFuncCb> wifi_callbacks;
+static std::vector<std::pair<int64_t, int64_t>> wifi_outages;
+static bool soft_ap = false;
+static int scan_state = WIFI_SCAN_FAILED;  // running, failed or the result count
+static std::vector<std::pair<std::string, int>> scan_results;
+
+WiFiClass WiFi;
+
+void simWifiConfigure(const SimWifiConfig& config) {
+  wifi_config = config;
+}
+
+void simWifiOutage(int64_t mono_us, int64_t duration_us) {
+  wifi_outages.push_back({mono_us, mono_us + duration_us});
+  simAt(mono_us, []() {
+    if (station != STATION_CONNECTED) return;
+    uint64_t generation = station_generation;
+    simAt(simNowUs() + BEACON_LOSS_US, [generation]() {
+      if (station != STATION_CONNECTED || station_generation != generation) return;
+      station = STATION_IDLE;
+      station_status = WL_CONNECTION_LOST;
+      device_ip = 0;
+      arduino_event_info_t info = {};
+      info.wifi_sta_disconnected.reason = WIFI_REASON_BEACON_TIMEOUT;
+      for (WiFiEventFuncCb callback : wifi_callbacks) callback(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, info);
+    });
+  });
+}
+
+SimWifiStats simWifiStats() {
+  return wifi_stats;
+}
+
+static bool accessPointUp(int64_t mono_us) {
+  for (auto& outage : wifi_outages) {
+    if (mono_us >= outage.first && mono_us < outage.second) return false;
+  }
+  return true;
+}
+
+static void raiseWifiEvent(arduino_event_id_t event, uint8_t reason) {
+  arduino_event_info_t info = {};
+  info.wifi_sta_disconnected.reason = reason;
+  simAt(simNowUs() + 1000, [event, info]() {
+    for (WiFiEventFuncCb callback : wifi_callbacks) callback(event, info);
+  });
+}
+
+bool WiFiClass::mode(wifi_mode_t mode) {
+  soft_ap = mode == WIFI_AP || mode == WIFI_AP_STA;
+  if (soft_ap) device_ip = SOFT_AP_IP;
+  return true;
+}
+
+wl_status_t WiFiClass::begin(const char* ssid, const char* passphrase) {
+  wifi_stats.begins++;
+  if (station == STATION_JOINING) wifi_stats.aborted_joins++;
+  if (station == STATION_CONNECTED) device_ip = 0;
+  station = STATION_JOINING;
+  station_status = WL_DISCONNECTED;
+  uint64_t generation = ++station_generation;
+
+  bool known = wifi_config.ssid == ssid && wifi_config.pass == (passphrase ? passphrase : "");
+  int64_t join_at = simNowUs() + wifi_config.join_us;
+  if (known && accessPointUp(simNowUs()) && accessPointUp(join_at)) {
+    simAt(join_at, [generation]() {
+      if (station != STATION_JOINING || station_generation != generation) return;
+      station = STATION_CONNECTED;
+      station_status = WL_CONNECTED;
+      device_ip = wifi_config.device_ip;
+      wifi_stats.joins++;
+      if (wifi_stats.first_join_us < 0) wifi_stats.first_join_us = simNowUs();
+      for (WiFiEventFuncCb callback : wifi_callbacks) callback(ARDUINO_EVENT_WIFI_STA_CONNECTED, {});
+      for (WiFiEventFuncCb callback : wifi_callbacks) callback(ARDUINO_EVENT_WIFI_STA_GOT_IP, {});
+    });
+  } else {
+    uint8_t reason = known ? WIFI_REASON_NO_AP_FOUND : WIFI_REASON_AUTH_FAIL;
+    simAt(simNowUs() + wifi_config.fail_us, [generation, reason]() {
+      if (station != STATION_JOINING || station_generation != generation) return;
+      station = STATION_IDLE;
+      station_status = reason == WIFI_REASON_NO_AP_FOUND ? WL_NO_SSID_AVAIL : WL_CONNECT_FAILED;
+      arduino_event_info_t info = {};
+      info.wifi_sta_disconnected.reason = reason;
+      for (WiFiEventFuncCb callback : wifi_callbacks) callback(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, info);
+    });
+  }
+  return station_status;
+}
+
+bool WiFiClass::disconnect(bool wifioff, bool eraseap) {
+  if (station == STATION_IDLE) return true;
+  if (station == STATION_JOINING) wifi_stats.aborted_joins++;
+  if (station == STATION_CONNECTED && !soft_ap) device_ip = 0;
+  station = STATION_IDLE;
+  station_status = WL_DISCONNECTED;
+  station_generation++;
+  raiseWifiEvent(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, WIFI_REASON_ASSOC_LEAVE);
+  return true;
+}
+
+wl_status_t WiFiClass::status() {
+  return station_status;
+}
+
+IPAddress WiFiClass::localIP() {
+  return station == STATION_CONNECTED ? toIPAddress(wifi_config.device_ip) : IPAddress();
+}
+
+int8_t WiFiClass::RSSI() {
+  return station == STATION_CONNECTED ? wifi_config.rssi : 0;
+}
+
+wifi_event_id_t WiFiClass::onEvent(WiFiEventFuncCb callback) {
+  wifi_callbacks.push_back(callback);
+  return wifi_callbacks.size();
+}
+
+bool WiFiClass::softAP(const char* ssid, const char* passphrase) {
+  soft_ap = true;
+  device_ip = SOFT_AP_IP;
+  return true;
+}
+
+IPAddress WiFiClass::softAPIP() {
+  return soft_ap ? toIPAddress(SOFT_AP_IP) : IPAddress();
+}
+
+int16_t WiFiClass::scanNetworks(bool async) {
+  scan_state = WIFI_SCAN_RUNNING;
+  simAt(simNowUs() + SCAN_DURATION_US, []() {
+    scan_results.clear();
+    if (!wifi_config.ssid.empty()) scan_results.push_back({wifi_config.ssid, wifi_config.rssi});
+    scan_results.push_back({"Neighbour", -71});
+    scan_results.push_back({"Neighbour", -80});  // second access point, same SSID
+    scan_results.push_back({"", -66});           // hidden
+    scan_results.push_back({"Cafe Guest", -84});
+    scan_state = scan_results.size();
+  });
+  return WIFI_SCAN_RUNNING;
+}
+
+int16_t WiFiClass::scanComplete() {
+  return scan_state;
+}
+
+void WiFiClass::scanDelete() {
+  scan_results.clear();
+  scan_state = WIFI_SCAN_FAILED;
+}
+
+String WiFiClass::SSID(uint8_t index) {
+  return index < scan_results.size() ? String(scan_results[index].first) : String();
+}
+
+int32_t WiFiClass::RSSI(uint8_t index) {
+  return index < scan_results.size() ? scan_results[index].second : 0;
+}
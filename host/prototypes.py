@@ -0,0 +1,55 @@
+#!/usr/bin/env python3
+"""Write the sketch as a C++ translation unit, the way arduino-cli does.
+
+The Arduino builder declares every top-level function ahead of the first
+definition so a sketch can call functions defined further down. This
+does the same for the host build; #line directives keep compiler
+messages pointing into the sketch itself.
+
+    python3 prototypes.py ../esp_ntp_clock.c build/sketch.cpp
+"""
+import re
+import sys
+
+# A top-level function definition: return type at column 0, name, arguments, brace
+DEFINITION = re.compile(
+    r"^((?:inline\s+)?[A-Za-z_][\w:<>\*&]*(?:\s+[\*&]?[A-Za-z_][\w:]*)*?\s*[\*&]?\s*)"
+    r"([A-Za-z_]\w*)\(([^;{}]*)\)\s*(?:const\s*)?\{",
+    re.M,
+)
+KEYWORDS = {"if", "for", "while", "switch", "return", "else"}
+NOT_FUNCTIONS = {"static", "constexpr", "template", "struct", "class", "typedef", "enum", "union"}
+
+
+def prototypes(source):
+    found = []
+    first = None
+    for match in DEFINITION.finditer(source):
+        ret, name, args = match.group(1).strip(), match.group(2), match.group(3)
+        if not ret or name in KEYWORDS or ret in KEYWORDS:
+            continue
+        if ret.split()[0] in NOT_FUNCTIONS or "::" in ret.split()[-1]:
+            continue
+        if first is None:
+            first = match.start()
+        args = re.sub(r"\s*=\s*[^,]+", "", args)  # default arguments stay on the definition
+        found.append("%s %s(%s);" % (ret, name, " ".join(args.split())))
+    return first, found
+
+
+def main():
+    sketch, output = sys.argv[1], sys.argv[2]
+    with open(sketch) as f:
+        source = f.read()
+    first, found = prototypes(source)
+    line = source.count("\n", 0, first) + 1
+    with open(output, "w") as f:
+        f.write('#line 1 "%s"\n' % sketch)
+        f.write(source[:first])
+        f.write("\n".join(found) + "\n")
+        f.write('#line %d "%s"\n' % (line, sketch))
+        f.write(source[first:])
+
+
+if __name__ == "__main__":
+    main()
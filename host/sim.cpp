@@ -0,0 +1,559 @@
+// Scheduler, virtual clock, timers and restart for the host build; see sim.h
+#include "sim.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <queue>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+// Bounds of the RTC_NOINIT_ATTR section, provided by the linker when the
+// sketch has any such variable
+extern "C" char __start_rtc_noinit[] __attribute__((weak));
+extern "C" char __stop_rtc_noinit[] __attribute__((weak));
+
+const size_t TASK_STACK_BYTES = 1 << 20;   // host code needs far more than the device's
+const int64_t RESTART_GAP_US = 400000;     // reset to setup(), as on the device
+
+struct SimTask {
+  ucontext_t context;
+  void (*fn)(void*);
+  void* arg;
+  std::string name;
+  unsigned priority;
+  int core;
+  char* stack;
+  bool ready;
+  bool dead;
+  const void* waiting_on;
+  int64_t deadline_us;
+  bool woken;
+  uint64_t ready_seq;
+  uint32_t notify_value;
+  bool notify_pending;
+  uint64_t switches;
+  double host_seconds;
+};
+
+struct SimEvent {
+  int64_t at_us;
+  uint64_t seq;
+  std::function<void()> fn;
+};
+
+struct SimEventLater {
+  bool operator()(const SimEvent& a, const SimEvent& b) const {
+    return a.at_us != b.at_us ? a.at_us > b.at_us : a.seq > b.seq;
+  }
+};
+
+static int64_t now_us = 0;
+static SimClockConfig clock_config = {0, 0, 0};
+static int64_t boot_true_utc_us = 0;  // reference UTC at this boot's device time 0
+static std::vector<SimTask*> tasks;
+static SimTask* current = NULL;
+static ucontext_t scheduler_context;
+static double segment_start = 0;
+static uint64_t ready_counter = 0;
+static std::priority_queue<SimEvent, std::vector<SimEvent>, SimEventLater> events;
+static uint64_t event_counter = 0;
+static bool stopped = false;
+static uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+
+static int boot_number = 1;
+static int64_t elapsed_before_boot_us = 0;
+static std::vector<std::string> process_args;
+static bool system_time_set = false;
+static int64_t system_time_offset_us = 0;  // system time minus device time
+
+static double hostSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// -----------------------------------------------
+// Time
+// -----------------------------------------------
+int64_t simNowUs() {
+  if (current && clock_config.cpu_scale > 0) {
+    return now_us + (int64_t)((hostSeconds() - segment_start) * clock_config.cpu_scale * 1e6);
+  }
+  return now_us;
+}
+
+int64_t simTrueUtcAt(int64_t mono_us) {
+  return boot_true_utc_us + (int64_t)(mono_us / (1.0 + clock_config.drift_ppm * 1e-6));
+}
+
+int64_t simTrueUtcUs() {
+  return simTrueUtcAt(simNowUs());
+}
+
+void simAt(int64_t mono_us, std::function<void()> fn) {
+  events.push(SimEvent{mono_us, event_counter++, fn});
+}
+
+void simConfigureClock(const SimClockConfig& config) {
+  clock_config = config;
+  boot_true_utc_us = config.start_utc_us + elapsed_before_boot_us;
+}
+
+// -----------------------------------------------
+// Tasks
+// -----------------------------------------------
+static void makeReady(SimTask* task, bool woken) {
+  task->ready = true;
+  task->woken = woken;
+  task->waiting_on = NULL;
+  task->ready_seq = ready_counter++;
+}
+
+static void taskEntry() {
+  current->fn(current->arg);
+  simTaskExit();  // a FreeRTOS task must not return; treat it as deleting itself
+}
+
+SimTask* simTaskCreate(void (*fn)(void*), const char* name, uint32_t stack, void* arg, unsigned priority, int core) {
+  SimTask* task = new SimTask();
+  task->fn = fn;
+  task->arg = arg;
+  task->name = name;
+  task->priority = priority;
+  task->core = core;
+  task->stack = (char*)malloc(TASK_STACK_BYTES);
+  getcontext(&task->context);
+  task->context.uc_stack.ss_sp = task->stack;
+  task->context.uc_stack.ss_size = TASK_STACK_BYTES;
+  task->context.uc_link = NULL;
+  makecontext(&task->context, taskEntry, 0);
+  makeReady(task, false);
+  tasks.push_back(task);
+  return task;
+}
+
+SimTask* simCurrentTask() {
+  return current;
+}
+
+const char* simTaskName(SimTask* task) {
+  return task ? task->name.c_str() : "scheduler";
+}
+
+unsigned simTaskCount() {
+  unsigned n = 0;
+  for (SimTask* task : tasks) n += !task->dead;
+  return n;
+}
+
+static void requireTask(const char* what) {
+  if (current) return;
+  fprintf(stderr, "sim: %s called outside a task\n", what);
+  abort();
+}
+
+bool simBlock(const void* on, int64_t deadline_us) {
+  requireTask("blocking call");
+  SimTask* task = current;
+  task->ready = false;
+  task->waiting_on = on;
+  task->deadline_us = deadline_us;
+  task->woken = false;
+  swapcontext(&task->context, &scheduler_context);
+  return task->woken;
+}
+
+void simWake(const void* on) {
+  if (!on) return;
+  for (SimTask* task : tasks) {
+    if (!task->dead && !task->ready && task->waiting_on == on) makeReady(task, true);
+  }
+}
+
+void simYield() {
+  requireTask("yield");
+  makeReady(current, false);
+  swapcontext(&current->context, &scheduler_context);
+}
+
+void simTaskExit() {
+  requireTask("task exit");
+  current->dead = true;
+  current->ready = false;
+  swapcontext(&current->context, &scheduler_context);
+  abort();  // never resumed
+}
+
+// Highest priority first, round robin among equals
+static SimTask* pickReady() {
+  SimTask* best = NULL;
+  for (SimTask* task : tasks) {
+    if (task->dead || !task->ready) continue;
+    if (!best || task->priority > best->priority ||
+        (task->priority == best->priority && task->ready_seq < best->ready_seq)) {
+      best = task;
+    }
+  }
+  return best;
+}
+
+// Fires everything due at the current time: events, then task timeouts
+static void fireDue() {
+  while (!events.empty() && events.top().at_us <= now_us) {
+    std::function<void()> fn = events.top().fn;
+    events.pop();
+    fn();
+  }
+  for (SimTask* task : tasks) {
+    if (!task->dead && !task->ready && task->deadline_us <= now_us) makeReady(task, false);
+  }
+}
+
+static int64_t nextDeadline() {
+  int64_t next = events.empty() ? INT64_MAX : events.top().at_us;
+  for (SimTask* task : tasks) {
+    if (!task->dead && !task->ready && task->deadline_us < next) next = task->deadline_us;
+  }
+  return next;
+}
+
+static void runTask(SimTask* task) {
+  current = task;
+  task->ready = false;
+  task->switches++;
+  segment_start = hostSeconds();
+  swapcontext(&scheduler_context, &task->context);
+  double elapsed = hostSeconds() - segment_start;
+  task->host_seconds += elapsed;
+  if (clock_config.cpu_scale > 0) now_us += (int64_t)(elapsed * clock_config.cpu_scale * 1e6);
+  current = NULL;
+  if (task->dead) free(task->stack), task->stack = NULL;
+}
+
+bool simRun(int64_t until_us) {
+  stopped = false;
+  while (!stopped) {
+    fireDue();
+    SimTask* next = pickReady();
+    if (next) {
+      runTask(next);
+      continue;
+    }
+    int64_t deadline = nextDeadline();
+    if (deadline == INT64_MAX) return false;  // every task blocked forever
+    if (deadline > until_us) {
+      now_us = until_us;
+      return true;
+    }
+    if (deadline > now_us) now_us = deadline;
+  }
+  return true;
+}
+
+void simStop() {
+  stopped = true;
+}
+
+std::vector<SimTaskStats> simTaskStats() {
+  std::vector<SimTaskStats> stats;
+  for (SimTask* task : tasks) stats.push_back(SimTaskStats{task->name.c_str(), task->switches, task->host_seconds});
+  return stats;
+}
+
+// -----------------------------------------------
+// Random numbers
+// -----------------------------------------------
+void simSeed(uint64_t seed) {
+  random_state = seed ? seed : 1;
+}
+
+uint64_t simRandom() {
+  // xorshift64*
+  random_state ^= random_state >> 12;
+  random_state ^= random_state << 25;
+  random_state ^= random_state >> 27;
+  return random_state * 2685821657736338717ULL;
+}
+
+double simUniform() {
+  return (simRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// -----------------------------------------------
+// FreeRTOS
+// -----------------------------------------------
+struct SimMutex {
+  SimTask* owner;
+};
+
+static int64_t tickDeadline(TickType_t ticks) {
+  return ticks == portMAX_DELAY ? INT64_MAX : simNowUs() + (int64_t)ticks * 1000;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack, void* arg,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core) {
+  if (core != tskNO_AFFINITY && (core < 0 || core >= portNUM_PROCESSORS)) {
+    fprintf(stderr, "sim: task \"%s\" pinned to core %d of %d\n", name, (int)core, portNUM_PROCESSORS);
+    return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+  }
+  SimTask* task = simTaskCreate(fn, name, stack, arg, priority, core);
+  if (handle) *handle = task;
+  return pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char* name, uint32_t stack, void* arg, UBaseType_t priority,
+                       TaskHandle_t* handle) {
+  return xTaskCreatePinnedToCore(fn, name, stack, arg, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t handle) {
+  SimTask* task = handle ? (SimTask*)handle : current;
+  if (task == current) simTaskExit();
+  task->dead = true;
+  task->ready = false;
+}
+
+void vTaskDelay(TickType_t ticks) {
+  simBlock(NULL, simNowUs() + (int64_t)ticks * 1000);
+}
+
+TickType_t xTaskGetTickCount() {
+  return (TickType_t)(simNowUs() / 1000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+  return simHeapCounted() ? current : NULL;
+}
+
+BaseType_t xPortGetCoreID() {
+  return current && current->core != tskNO_AFFINITY ? current->core : 0;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t handle) {
+  return 1024;  // host stacks are not comparable
+}
+
+BaseType_t xTaskNotify(TaskHandle_t handle, uint32_t value, eNotifyAction action) {
+  SimTask* task = (SimTask*)handle;
+  switch (action) {
+    case eSetBits: task->notify_value |= value; break;
+    case eIncrement: task->notify_value++; break;
+    case eSetValueWithOverwrite: task->notify_value = value; break;
+    case eNoAction: break;
+  }
+  task->notify_pending = true;
+  simWake(&task->notify_value);
+  return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t* value, TickType_t ticks) {
+  requireTask("xTaskNotifyWait");
+  SimTask* task = current;
+  if (!task->notify_pending) {
+    task->notify_value &= ~clear_on_entry;
+    int64_t deadline = tickDeadline(ticks);
+    while (!task->notify_pending && simBlock(&task->notify_value, deadline)) {
+    }
+  }
+  if (!task->notify_pending) return pdFALSE;
+  if (value) *value = task->notify_value;
+  task->notify_value &= ~clear_on_exit;
+  task->notify_pending = false;
+  return pdTRUE;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex() {
+  return new SimMutex{NULL};
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t handle, TickType_t ticks) {
+  requireTask("xSemaphoreTake");
+  SimMutex* mutex = (SimMutex*)handle;
+  if (mutex->owner == current) {
+    fprintf(stderr, "sim: task \"%s\" took a mutex it already holds\n", current->name.c_str());
+    abort();
+  }
+  int64_t deadline = tickDeadline(ticks);
+  while (mutex->owner && simBlock(mutex, deadline)) {
+  }
+  if (mutex->owner) return pdFALSE;
+  mutex->owner = current;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t handle) {
+  SimMutex* mutex = (SimMutex*)handle;
+  if (mutex->owner != current) return pdFALSE;
+  mutex->owner = NULL;
+  simWake(mutex);
+  return pdTRUE;
+}
+
+TaskHandle_t xSemaphoreGetMutexHolder(SemaphoreHandle_t handle) {
+  return ((SimMutex*)handle)->owner;
+}
+
+// -----------------------------------------------
+// esp_timer
+// -----------------------------------------------
+struct SimTimer {
+  esp_timer_create_args_t args;
+  uint64_t generation;
+  bool active;
+};
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle) {
+  *handle = (esp_timer_handle_t) new SimTimer{*args, 0, false};
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t handle, uint64_t timeout_us) {
+  SimTimer* timer = (SimTimer*)handle;
+  if (timer->active) return ESP_ERR_INVALID_STATE;
+  timer->active = true;
+  uint64_t generation = ++timer->generation;
+  simAt(simNowUs() + (int64_t)timeout_us, [timer, generation]() {
+    if (!timer->active || timer->generation != generation) return;
+    timer->active = false;
+    timer->args.callback(timer->args.arg);
+  });
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t handle) {
+  SimTimer* timer = (SimTimer*)handle;
+  if (!timer->active) return ESP_ERR_INVALID_STATE;
+  timer->active = false;
+  timer->generation++;
+  return ESP_OK;
+}
+
+int64_t esp_timer_get_time() {
+  return simNowUs();
+}
+
+// -----------------------------------------------
+// System time
+// -----------------------------------------------
+void simSystemTimeSet(int64_t utc_us) {
+  system_time_set = true;
+  system_time_offset_us = utc_us - simNowUs();
+}
+
+int64_t simSystemTimeGet() {
+  return system_time_set ? system_time_offset_us + simNowUs() : simNowUs();  // from 1970 on a cold boot
+}
+
+// -----------------------------------------------
+// Restart
+// -----------------------------------------------
+static std::function<void(const char*)> restart_hook;
+
+// "-" stands for empty so every state line keeps its value field
+static std::string hexEncode(const std::string& data) {
+  static const char* digits = "0123456789abcdef";
+  if (data.empty()) return "-";
+  std::string out;
+  for (unsigned char c : data) {
+    out += digits[c >> 4];
+    out += digits[c & 15];
+  }
+  return out;
+}
+
+static std::string hexDecode(const std::string& text) {
+  std::string out;
+  for (size_t i = 0; i + 1 < text.size(); i += 2) out += (char)strtol(text.substr(i, 2).c_str(), NULL, 16);
+  return out;
+}
+
+void simSetArgs(int argc, char** argv) {
+  process_args.clear();
+  for (int i = 0; i < argc; i++) {
+    if (strcmp(argv[i], "--resume") == 0 && i + 1 < argc) {
+      i++;
+      continue;
+    }
+    process_args.push_back(argv[i]);
+  }
+}
+
+void simOnRestart(std::function<void(const char* reason)> hook) {
+  restart_hook = hook;
+}
+
+void simRestart(const char* reason) {
+  if (restart_hook) restart_hook(reason);
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/ntpclock-sim-%d.state", (int)getpid());
+  FILE* f = fopen(path, "w");
+  if (!f) {
+    perror("sim: restart state");
+    exit(2);
+  }
+  int64_t elapsed = simTrueUtcUs() + RESTART_GAP_US - clock_config.start_utc_us;
+  std::string rtc;
+  if (__start_rtc_noinit && __stop_rtc_noinit) rtc.assign(__start_rtc_noinit, __stop_rtc_noinit - __start_rtc_noinit);
+  fprintf(f, "boot %d\n", boot_number + 1);
+  fprintf(f, "elapsed_us %lld\n", (long long)elapsed);
+  fprintf(f, "system_time_set %d\n", system_time_set ? 1 : 0);
+  fprintf(f, "system_time_us %lld\n", (long long)(simSystemTimeGet() + RESTART_GAP_US));
+  fprintf(f, "rtc %s\n", hexEncode(rtc).c_str());
+  fprintf(f, "nvs %s\n", hexEncode(simNvsSerialize()).c_str());
+  fclose(f);
+
+  fprintf(stderr, "sim: restart at %.3f s (%s)\n", simNowUs() / 1e6, reason);
+  fflush(stdout);
+  fflush(stderr);
+  std::vector<char*> argv;
+  for (std::string& arg : process_args) argv.push_back((char*)arg.c_str());
+  argv.push_back((char*)"--resume");
+  argv.push_back(path);
+  argv.push_back(NULL);
+  execv("/proc/self/exe", argv.data());
+  perror("sim: restart exec");
+  exit(2);
+}
+
+int simResume(const char* state_path) {
+  FILE* f = fopen(state_path, "r");
+  if (!f) {
+    perror("sim: resume state");
+    exit(2);
+  }
+  char key[32];
+  static char value[1 << 20];
+  while (fscanf(f, "%31s %1048575s", key, value) == 2) {
+    if (strcmp(key, "boot") == 0) boot_number = atoi(value);
+    else if (strcmp(key, "elapsed_us") == 0) elapsed_before_boot_us = atoll(value);
+    else if (strcmp(key, "system_time_set") == 0) system_time_set = atoi(value) != 0;
+    else if (strcmp(key, "system_time_us") == 0) system_time_offset_us = atoll(value);  // device time is 0 at boot
+    else if (strcmp(key, "rtc") == 0) {
+      std::string rtc = hexDecode(value);
+      if (__start_rtc_noinit && rtc.size() == (size_t)(__stop_rtc_noinit - __start_rtc_noinit)) {
+        memcpy(__start_rtc_noinit, rtc.data(), rtc.size());
+      }
+    } else if (strcmp(key, "nvs") == 0) {
+      simNvsDeserialize(hexDecode(value));
+    }
+  }
+  fclose(f);
+  unlink(state_path);
+  return boot_number;
+}
+
+int simBootNumber() {
+  return boot_number;
+}
+
+int64_t simElapsedBeforeBootUs() {
+  return elapsed_before_boot_us;
+}
@@ -0,0 +1,302 @@
+// Virtual-time kernel for the host build. The sketch's FreeRTOS tasks
+// run as coroutines on one thread and switch only where the firmware
+// blocks (delay, task notifications, semaphores, socket reads), so a run
+// is deterministic and idle time costs nothing: when every task is
+// blocked the clock jumps to the next deadline. Hours of device time
+// take seconds.
+//
+// The mock headers in mock/ forward to the functions below; the scenario
+// driver (sim_main.cpp) uses them to script the network around the
+// clock and to score what it displays.
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------
+// Time
+// -----------------------------------------------
+// Device monotonic time (esp_timer) since boot. With a CPU scale set,
+// host time spent inside the running task is charged to it as well.
+int64_t simNowUs();
+// Reference UTC at the current device time: the scenario's start
+// instant plus elapsed time, corrected for the device crystal's error
+int64_t simTrueUtcUs();
+int64_t simTrueUtcAt(int64_t mono_us);
+
+// Runs fn from the scheduler, not from a task, once device time reaches mono_us
+void simAt(int64_t mono_us, std::function<void()> fn);
+
+struct SimClockConfig {
+  int64_t start_utc_us;   // true UTC at power-on of the first boot
+  double drift_ppm;       // device crystal error, positive runs fast
+  double cpu_scale;       // device time charged per host second in a task, 0 for none
+};
+void simConfigureClock(const SimClockConfig& config);
+
+// -----------------------------------------------
+// Tasks
+// -----------------------------------------------
+struct SimTask;
+SimTask* simTaskCreate(void (*fn)(void*), const char* name, uint32_t stack, void* arg, unsigned priority, int core);
+SimTask* simCurrentTask();
+const char* simTaskName(SimTask* task);
+unsigned simTaskCount();
+
+// Suspends the running task until simWake(on) or deadline_us (device
+// time, INT64_MAX for none); true if woken, false on timeout
+bool simBlock(const void* on, int64_t deadline_us);
+void simWake(const void* on);
+void simYield();
+[[noreturn]] void simTaskExit();
+
+// Runs the scheduler until device time reaches until_us or stopped; false if it deadlocked
+bool simRun(int64_t until_us);
+void simStop();
+
+struct SimTaskStats {
+  const char* name;
+  uint64_t switches;
+  double host_seconds;  // host CPU time spent in the task
+};
+std::vector<SimTaskStats> simTaskStats();
+
+// -----------------------------------------------
+// Random numbers (deterministic per seed)
+// -----------------------------------------------
+void simSeed(uint64_t seed);
+uint64_t simRandom();
+double simUniform();  // [0, 1)
+
+// -----------------------------------------------
+// Network
+// -----------------------------------------------
+// IPv4 addresses are host-order integers here: simIp(192, 168, 1, 50)
+constexpr uint32_t simIp(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+  return ((uint32_t)a << 24) | ((uint32_t)b << 16) | ((uint32_t)c << 8) | d;
+}
+std::string simIpString(uint32_t ip);
+
+struct SimDatagram {
+  uint32_t src_ip;
+  uint16_t src_port;
+  uint32_t dst_ip;
+  uint16_t dst_port;
+  std::vector<uint8_t> data;
+};
+
+// A machine on the simulated network. It receives datagrams addressed to
+// its IP (or to a multicast group it joined) and answers with send().
+class SimHost {
+ public:
+  SimHost(uint32_t ip, int64_t delay_us, int64_t jitter_us);
+  virtual ~SimHost() {}
+  virtual void receive(const SimDatagram& packet) = 0;
+
+  // Sends to the clock after this host's one-way delay
+  void send(uint16_t src_port, uint32_t dst_ip, uint16_t dst_port, const uint8_t* data, size_t length);
+  int64_t oneWayDelayUs();
+  void join(uint32_t group) { groups.push_back(group); }
+
+  uint32_t ip;
+  int64_t delay_us;   // one way
+  int64_t jitter_us;  // added uniformly on top, per packet
+  bool online = true;
+  std::vector<uint32_t> groups;
+};
+
+void simNetAddHost(SimHost* host);
+void simNetAddName(const char* name, uint32_t ip);  // answered by dns_gethostbyname()
+uint32_t simNetResolve(const char* name);           // 0 if unknown
+
+// The clock's own address; 0 while it has none
+uint32_t simDeviceIp();
+void simSetDeviceIp(uint32_t ip);
+
+// Sockets behind the lwip/sockets.h mock
+int simSocketOpen(int type);
+int simSocketBind(int fd, uint16_t port);
+int simSocketJoin(int fd, uint32_t group);
+int simSocketSendTo(int fd, uint32_t dst_ip, uint16_t dst_port, const uint8_t* data, size_t length);
+// Blocks per the socket's timeout; -1 when there is nothing
+int simSocketRecvFrom(int fd, uint8_t* data, size_t capacity, uint32_t* src_ip, uint16_t* src_port, bool block);
+int simSocketSetTimeout(int fd, int64_t timeout_us);
+int simSocketClose(int fd);
+uint16_t simSocketPort(int fd);
+
+// Stream sockets: the clock listens and accepts, the scenario driver
+// plays the client end through a SimTcpPeer
+class SimTcpPeer {
+ public:
+  virtual ~SimTcpPeer() {}
+  // Bytes from the clock, as fast as the peer reads them
+  virtual void received(const uint8_t* data, size_t length) = 0;
+  // The clock closed the connection or refused it; no calls follow
+  virtual void closed() = 0;
+};
+// Connects ip to the clock's port with delay_us each way, reading
+// bytes_per_ms (0 for unlimited); returns the connection's handle
+int simTcpConnect(uint32_t ip, uint16_t port, int64_t delay_us, uint32_t bytes_per_ms, SimTcpPeer* peer);
+void simTcpSend(int conn, const std::string& data);
+void simTcpClose(int conn);  // the peer is not called again
+
+struct SimNetStats {
+  uint64_t sent;
+  uint64_t delivered;
+  uint64_t dropped;  // no link, no listener or host offline
+};
+SimNetStats simNetStats();
+
+// -----------------------------------------------
+// HTTP clients
+// -----------------------------------------------
+// Browsers on the LAN speaking HTTP/1.1 to the clock over the TCP model.
+// Each client sends its queued requests one at a time over a kept-alive
+// connection; a request the server closes without answering, as it may
+// when reclaiming an idle connection, is retried once on a new one.
+struct SimHttpResponse {
+  int code = 0;            // 0: refused, reset or closed before an answer
+  std::string headers;     // "Name: value\r\n" lines
+  std::string body;
+  int64_t queued_us = 0;
+  int64_t finished_us = 0; // last byte read
+};
+
+struct SimHttpRequest {
+  std::string method = "GET";
+  std::string uri;
+  std::vector<std::pair<std::string, std::string>> args;  // query string, or the form body of a POST
+  std::function<void(const SimHttpResponse&)> done;
+  // Set for an event stream: called with each event's text; done runs when it ends
+  std::function<void(const std::string& event)> event;
+};
+
+class SimHttpClient : public SimTcpPeer {
+ public:
+  SimHttpClient(uint32_t ip, int64_t delay_us, uint32_t bytes_per_ms)
+      : ip(ip), delay_us(delay_us), bytes_per_ms(bytes_per_ms) {}
+
+  void request(const SimHttpRequest& request);
+  size_t pending() const { return queue.size(); }
+
+  void received(const uint8_t* data, size_t length) override;
+  void closed() override;
+
+  uint32_t ip;
+  int64_t delay_us;
+  uint32_t bytes_per_ms;
+  uint64_t connects = 0;
+
+ private:
+  void pump();
+  void complete(SimHttpResponse& response);
+
+  std::vector<std::pair<SimHttpRequest, int64_t>> queue;  // with the time it was queued
+  int conn = -1;
+  uint32_t conn_answered = 0;  // responses on the current connection
+  bool in_flight = false;
+  bool retried = false;
+  bool headers_done = false;
+  bool server_closes = false;
+  bool streaming = false;
+  bool chunked = false;
+  size_t content_length = 0;
+  std::string buffer;
+  SimHttpResponse response;
+};
+
+// -----------------------------------------------
+// Wi-Fi
+// -----------------------------------------------
+struct SimWifiConfig {
+  std::string ssid;
+  std::string pass;
+  int64_t join_us;      // association plus DHCP after WiFi.begin()
+  int64_t fail_us;      // time to report a failed join
+  uint32_t device_ip;
+  int rssi;
+};
+void simWifiConfigure(const SimWifiConfig& config);
+// Takes the access point away for duration_us starting at mono_us
+void simWifiOutage(int64_t mono_us, int64_t duration_us);
+struct SimWifiStats {
+  uint32_t begins;         // WiFi.begin() calls
+  uint32_t aborted_joins;  // joins cut short by disconnect() or a new begin()
+  uint32_t joins;          // successful
+  int64_t first_join_us;   // device time of the first GOT_IP, -1 if none
+};
+SimWifiStats simWifiStats();
+
+// -----------------------------------------------
+// Restart
+// -----------------------------------------------
+// ESP.restart() re-executes the simulator with the state that survives a
+// software reset on the device: RTC memory (RTC_NOINIT_ATTR variables),
+// NVS, the RTC-backed system time and the reference clock. The new
+// process continues the same scenario from its next boot.
+[[noreturn]] void simRestart(const char* reason);
+// Called just before the process is replaced, e.g. to report the boot
+void simOnRestart(std::function<void(const char* reason)> hook);
+void simSetArgs(int argc, char** argv);
+// Loads the carried-over state if this process is a restart; returns the boot number
+int simResume(const char* state_path);
+int simBootNumber();
+int64_t simElapsedBeforeBootUs();  // true time from first power-on to this boot
+
+// Persistent stores the restart carries over (owned by mock.cpp)
+std::string simNvsSerialize();
+void simNvsDeserialize(const std::string& data);
+void simNvsPut(const char* ns, const char* key, const std::string& value, char type);
+
+// System time as settimeofday()/gettimeofday() see it: RTC backed, so it
+// survives a software reset
+void simSystemTimeSet(int64_t utc_us);
+int64_t simSystemTimeGet();
+
+// -----------------------------------------------
+// Peripherals
+// -----------------------------------------------
+// Every TM1640 bus transaction, as the pins would show it
+struct SimDisplayWrite {
+  int64_t mono_us;
+  uint8_t command;        // first byte after start
+  std::vector<uint8_t> data;
+};
+typedef std::function<void(const SimDisplayWrite&)> SimDisplayListener;
+void simDisplayListen(SimDisplayListener listener);
+void simDisplayRecord(const SimDisplayWrite& write);
+
+// Ambient light as the ADC sees it, 0-4095
+void simSetAnalog(std::function<int(int pin)> reader);
+int simAnalogRead(int pin);
+
+// Serial console: output lines, optional injected input
+void simSerialWrite(const char* data, size_t length);
+void simSerialVerbose(bool verbose);
+int simSerialAvailable();
+int simSerialRead();
+void simSerialInput(const std::string& text);
+
+// Heap as the firmware sees it (host allocations, counted)
+uint32_t simHeapFree();
+uint32_t simHeapMinFree();
+uint64_t simHeapAllocations();
+// Allocations, bytes allocated and the peak above the starting level
+// between the two calls; windows do not nest
+struct SimHeapWindow {
+  uint64_t allocations;
+  uint64_t bytes;
+  uint64_t peak;
+};
+SimHeapWindow simHeapWindowBegin();
+SimHeapWindow simHeapWindowEnd(const SimHeapWindow& begin);
+// Held by driver code running inside a task: its allocations are not the
+// firmware's, and xTaskGetCurrentTaskHandle() reports no task meanwhile,
+// as lwIP's own work runs in its tcpip task on the device
+struct SimHeapUncounted {
+  SimHeapUncounted();
+  ~SimHeapUncounted();
+};
+bool simHeapCounted();
@@ -0,0 +1,1012 @@
+// Scenario driver for the host build: boots the sketch on the simulated
+// network, runs it for the requested span of device time and scores
+// what the display showed against the reference clock.
+//
+//   build/sim --hours 6 --drift 40 --servers 4 --falseticker 1 --check
+//
+// One JSON report per boot goes to stdout; with --check the process
+// exits nonzero when a boot misses a threshold. See readme.md "Host
+// Simulation" for the options.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "sim.h"
+#include "Arduino.h"
+#include "mbedtls/md.h"
+
+void setup();
+void loop();
+
+// -----------------------------------------------
+// Options
+// -----------------------------------------------
+struct Outage {
+  double start_sec;
+  double duration_sec;
+};
+
+struct Options {
+  double hours = 6;
+  uint64_t seed = 1;
+  double cpu_scale = 0;
+  bool verbose = false;
+  int64_t start_utc_sec = 1772946000;  // 2026-03-08 05:00 UTC, two hours before the US spring-forward
+  std::string tz = "EST5EDT,M3.2.0,M11.1.0";
+  bool tz_custom = false;
+  double drift_ppm = 20;
+  int servers = 2;
+  int falsetickers = 0;
+  double falseticker_sec = 3;
+  double delay_ms = 15;
+  double jitter_ms = 2;
+  double loss_pct = 0;
+  double wifi_join_sec = 3;
+  std::vector<Outage> outages;
+  std::vector<double> restarts;  // scenario seconds
+  double http_interval_sec = 30;
+  uint32_t http_bytes_per_ms = 0;
+  int load_clients = 0;
+  int load_slow_clients = 0;
+  double load_start_sec = 60;
+  double load_sec = 60;
+  int bench_pages = 0;
+  const char* frames_path = NULL;
+  bool serve_ntp = false;
+  bool beacon = false;
+  double beacon_replay_sec = -1;
+  bool check = false;
+};
+
+static Options options;
+
+static void usage() {
+  fprintf(stderr,
+          "usage: sim [options]\n"
+          "  --hours H            device time to simulate (6)\n"
+          "  --seed N             random seed (1)\n"
+          "  --cpu-scale X        charge host CPU time x X to the device (0, off)\n"
+          "  --verbose            print the serial console\n"
+          "  --start UNIX         reference UTC at power-on (1772946000)\n"
+          "  --tz POSIX           custom time zone; default is the sketch's Eastern entry\n"
+          "  --drift PPM          device crystal error (20)\n"
+          "  --servers N          NTP servers (2)\n"
+          "  --falseticker N      how many of them are wrong by --falseticker-sec (0, 3)\n"
+          "  --delay MS           one-way network delay (15)\n"
+          "  --jitter MS          extra delay, uniform per packet (2)\n"
+          "  --loss PCT           NTP requests and replies lost (0)\n"
+          "  --wifi-join SEC      association plus DHCP time (3)\n"
+          "  --wifi-outage S:D    access point down for D seconds from S (repeatable)\n"
+          "  --restart-at SEC     ESP.restart() at this scenario second (repeatable)\n"
+          "  --http-interval SEC  status page polling period, 0 for none (30)\n"
+          "  --http-slow B        polling client reads B bytes per ms (0, unlimited)\n"
+          "  --load N             N browsers fetching pages back to back, plus an event stream (0)\n"
+          "  --load-slow N        and N more reading 1 byte per ms (0)\n"
+          "  --load-at S:D        load from scenario second S for D seconds (60:60)\n"
+          "  --bench-pages N      fetch every page N times from scenario second 60, one at a\n"
+          "                       time, and report allocations and peak heap per page (0)\n"
+          "  --frames FILE        append every display frame as CSV\n"
+          "  --serve-ntp          turn on the NTP server and query it from a LAN client\n"
+          "  --beacon             follow a time beacon leader on the LAN\n"
+          "  --beacon-replay SEC  leader silent for a minute from SEC while old beacons are replayed\n"
+          "  --check              exit 1 when a boot misses a threshold\n");
+  exit(2);
+}
+
+static void parseOptions(int argc, char** argv) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    auto value = [&]() -> const char* {
+      if (i + 1 >= argc) usage();
+      return argv[++i];
+    };
+    if (arg == "--hours") options.hours = atof(value());
+    else if (arg == "--seed") options.seed = strtoull(value(), NULL, 10);
+    else if (arg == "--cpu-scale") options.cpu_scale = atof(value());
+    else if (arg == "--verbose") options.verbose = true;
+    else if (arg == "--start") options.start_utc_sec = atoll(value());
+    else if (arg == "--tz") options.tz = value(), options.tz_custom = true;
+    else if (arg == "--drift") options.drift_ppm = atof(value());
+    else if (arg == "--servers") options.servers = atoi(value());
+    else if (arg == "--falseticker") options.falsetickers = atoi(value());
+    else if (arg == "--falseticker-sec") options.falseticker_sec = atof(value());
+    else if (arg == "--delay") options.delay_ms = atof(value());
+    else if (arg == "--jitter") options.jitter_ms = atof(value());
+    else if (arg == "--loss") options.loss_pct = atof(value());
+    else if (arg == "--wifi-join") options.wifi_join_sec = atof(value());
+    else if (arg == "--wifi-outage") {
+      Outage outage;
+      if (sscanf(value(), "%lf:%lf", &outage.start_sec, &outage.duration_sec) != 2) usage();
+      options.outages.push_back(outage);
+    } else if (arg == "--restart-at") options.restarts.push_back(atof(value()));
+    else if (arg == "--http-interval") options.http_interval_sec = atof(value());
+    else if (arg == "--http-slow") options.http_bytes_per_ms = atoi(value());
+    else if (arg == "--load") options.load_clients = atoi(value());
+    else if (arg == "--load-slow") options.load_slow_clients = atoi(value());
+    else if (arg == "--load-at") {
+      if (sscanf(value(), "%lf:%lf", &options.load_start_sec, &options.load_sec) != 2) usage();
+    }
+    else if (arg == "--bench-pages") options.bench_pages = atoi(value());
+    else if (arg == "--frames") options.frames_path = value();
+    else if (arg == "--serve-ntp") options.serve_ntp = true;
+    else if (arg == "--beacon") options.beacon = true;
+    else if (arg == "--beacon-replay") options.beacon = true, options.beacon_replay_sec = atof(value());
+    else if (arg == "--check") options.check = true;
+    else if (arg == "--resume") value();  // handled in main()
+    else usage();
+  }
+  if (options.servers < 1 || options.servers > 4 || options.falsetickers > options.servers) usage();
+}
+
+// -----------------------------------------------
+// Statistics
+// -----------------------------------------------
+struct Samples {
+  std::vector<double> values;
+
+  void add(double v) { values.push_back(v); }
+  // Nearest rank, as the sketch's /api/handlers
+  double percentile(int p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t rank = (values.size() * p + 99) / 100;
+    return values[rank > 0 ? rank - 1 : 0];
+  }
+  double max() { return values.empty() ? 0 : *std::max_element(values.begin(), values.end()); }
+};
+
+// -----------------------------------------------
+// NTP servers
+// -----------------------------------------------
+const uint16_t NTP_PORT = 123;
+const int64_t NTP_UNIX_OFFSET = 2208988800LL;
+
+static void writeTimestamp(uint8_t* p, int64_t unix_us) {
+  uint64_t seconds = (uint64_t)(unix_us / 1000000 + NTP_UNIX_OFFSET);
+  uint64_t fraction = ((uint64_t)(unix_us % 1000000) << 32) / 1000000;
+  uint64_t v = (seconds << 32) | fraction;
+  for (int i = 7; i >= 0; i--, v >>= 8) p[i] = v & 0xFF;
+}
+
+// A stratum 2 server whose clock is off by error_us
+class NtpServerHost : public SimHost {
+ public:
+  NtpServerHost(uint32_t ip, int64_t delay_us, int64_t jitter_us, int64_t error_us)
+      : SimHost(ip, delay_us, jitter_us), error_us(error_us) {}
+
+  void receive(const SimDatagram& packet) override {
+    if (packet.dst_port != NTP_PORT || packet.data.size() < 48 || (packet.data[0] & 0x07) != 3) return;
+    // Either leg can be lost; the client sees the same silence
+    if (options.loss_pct > 0 && (simUniform() * 100 < options.loss_pct || simUniform() * 100 < options.loss_pct)) {
+      lost++;
+      return;
+    }
+    uint8_t reply[48] = {0};
+    reply[0] = 0x24;  // LI 0, version 4, mode 4 (server)
+    reply[1] = 2;
+    reply[2] = packet.data[2];
+    reply[3] = (uint8_t)-20;
+    reply[6] = 0x04;  // root delay ~15 ms
+    reply[10] = 0x01; // root dispersion ~4 ms
+    memcpy(reply + 12, "SIM", 3);
+    int64_t now_us = simTrueUtcUs() + error_us;
+    writeTimestamp(reply + 16, now_us - 16000000);
+    memcpy(reply + 24, packet.data.data() + 40, 8);
+    writeTimestamp(reply + 32, now_us);
+    writeTimestamp(reply + 40, now_us + 30);
+    requests++;
+    send(NTP_PORT, packet.src_ip, packet.src_port, reply, sizeof(reply));
+  }
+
+  int64_t error_us;
+  uint64_t requests = 0;
+  uint64_t lost = 0;
+};
+
+static std::vector<NtpServerHost*> ntp_hosts;
+
+static int64_t readTimestamp(const uint8_t* p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) v = (v << 8) | p[i];
+  int64_t seconds = (int64_t)(v >> 32) - NTP_UNIX_OFFSET;
+  return seconds * 1000000 + (int64_t)(((v & 0xFFFFFFFFULL) * 1000000) >> 32);
+}
+
+static uint32_t readShortUs(const uint8_t* p) {
+  uint32_t v = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+  return (uint32_t)(((uint64_t)v * 1000000) >> 16);
+}
+
+// A LAN machine polling the clock's own NTP server (--serve-ntp): the
+// offset it measures against the reference clock, and the root delay and
+// dispersion the clock claims
+class NtpClientHost : public SimHost {
+ public:
+  NtpClientHost(uint32_t ip, int64_t delay_us, int64_t jitter_us) : SimHost(ip, delay_us, jitter_us) {}
+
+  void query() {
+    uint8_t request[48] = {0};
+    request[0] = 0x23;  // version 4, mode 3 (client)
+    sent_us = simTrueUtcUs();
+    writeTimestamp(request + 40, sent_us);
+    memcpy(sent_stamp, request + 40, 8);
+    send(NTP_CLIENT_PORT, simDeviceIp(), NTP_PORT, request, sizeof(request));
+    requests++;
+  }
+
+  void receive(const SimDatagram& packet) override {
+    const uint8_t* reply = packet.data.data();
+    if (packet.src_port != NTP_PORT || packet.data.size() < 48 || (reply[0] & 0x07) != 4) return;
+    if (memcmp(reply + 24, sent_stamp, 8) != 0) return;  // not an answer to the last query
+    replies++;
+    if (reply[1] >= 16) return;  // not synchronized yet
+    synced++;
+    int64_t t1 = sent_us, t2 = readTimestamp(reply + 32), t3 = readTimestamp(reply + 40), t4 = simTrueUtcUs();
+    offset_ms.add(llabs((t2 - t1) + (t3 - t4)) / 2 / 1000.0);
+    root_delay_ms.add(readShortUs(reply + 4) / 1000.0);
+    root_disp_ms.add(readShortUs(reply + 8) / 1000.0);
+  }
+
+  static const uint16_t NTP_CLIENT_PORT = 50123;
+  int64_t sent_us = 0;
+  uint8_t sent_stamp[8] = {0};
+  uint64_t requests = 0;
+  uint64_t replies = 0;
+  uint64_t synced = 0;
+  Samples offset_ms;
+  Samples root_delay_ms;
+  Samples root_disp_ms;
+};
+
+static NtpClientHost* ntp_client = NULL;
+
+const double SERVED_DISP_LIMIT_MS = 100;  // --check: root dispersion the NTP server may claim
+
+static void pollDeviceNtp(int64_t at_us, int64_t interval_us) {
+  simAt(at_us, [at_us, interval_us]() {
+    ntp_client->query();
+    pollDeviceNtp(at_us + interval_us, interval_us);
+  });
+}
+
+// -----------------------------------------------
+// Time beacons
+// -----------------------------------------------
+const uint32_t BEACON_GROUP = simIp(239, 255, 78, 84);
+const uint16_t BEACON_PORT = 12390;
+const char* BEACON_KEY = "room-key";
+const int64_t BEACON_GAP_US = 60000000;
+
+// Another clock leading the room (--beacon), packed and signed as
+// beaconSend() does. With --beacon-replay it goes quiet for a minute and
+// an attacker on the LAN replays the beacons it sent first, which a
+// follower must not take back in time.
+class BeaconLeaderHost : public SimHost {
+ public:
+  BeaconLeaderHost(uint32_t ip) : SimHost(ip, 1000, 500) {}
+
+  void receive(const SimDatagram& packet) override {}
+
+  void tick(int64_t replay_from_us) {
+    int64_t now = simNowUs();
+    bool silent = replay_from_us >= 0 && now >= replay_from_us && now < replay_from_us + BEACON_GAP_US;
+    if (silent) {
+      if (replayed < recorded.size()) {
+        const std::vector<uint8_t>& old = recorded[replayed++];
+        send(BEACON_PORT, BEACON_GROUP, BEACON_PORT, old.data(), old.size());
+      }
+      return;
+    }
+    uint8_t packet[32] = {0};
+    writeBigEndian(packet, 0x4e544342, 4);  // "NTCB"
+    packet[4] = 1;
+    packet[5] = 0x01;  // synced
+    packet[6] = 3;
+    writeBigEndian(packet + 8, ++seq, 4);
+    writeBigEndian(packet + 12, (uint64_t)simTrueUtcUs(), 8);
+    uint8_t digest[32];
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), (const uint8_t*)BEACON_KEY, strlen(BEACON_KEY),
+                    packet, 24, digest);
+    memcpy(packet + 24, digest, 8);
+    if (recorded.size() < 120) recorded.push_back(std::vector<uint8_t>(packet, packet + sizeof(packet)));
+    send(BEACON_PORT, BEACON_GROUP, BEACON_PORT, packet, sizeof(packet));
+    sent++;
+  }
+
+  static void writeBigEndian(uint8_t* p, uint64_t v, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--, v >>= 8) p[i] = v & 0xFF;
+  }
+
+  uint32_t seq = 0;
+  uint64_t sent = 0;
+  size_t replayed = 0;
+  std::vector<std::vector<uint8_t>> recorded;
+};
+
+static BeaconLeaderHost* beacon_leader = NULL;
+
+static void scheduleBeacons(int64_t at_us, int64_t replay_from_us) {
+  simAt(at_us, [at_us, replay_from_us]() {
+    beacon_leader->tick(replay_from_us);
+    scheduleBeacons(at_us + 1000000, replay_from_us);
+  });
+}
+
+// -----------------------------------------------
+// Display scoring
+// -----------------------------------------------
+// Decodes the TM1640 grid writes back into the time shown and compares
+// each change with the reference clock: minute changes against the
+// minute boundary, colon edges against the half second, and every
+// quarter second whether the shown minute is the true local minute.
+const int GRIDS = 6;
+const uint8_t DIGIT_SHAPES[10] = {0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F};
+const uint8_t SEG_DOT = 0x80;
+const uint8_t LAMP_AMPM = 0x02;
+const uint8_t LAMP_ALARM = 0x04;
+const int64_t SAMPLE_US = 250000;
+const int64_t MINUTE_TOLERANCE_US = 1000000;  // a shown minute this close to the boundary is not wrong
+// --check: the sketch's own tick error, update vs the half second its
+// clock scheduled it for. Against the reference, minute changes and
+// colon edges may be off by this plus the clock's residual error.
+const uint32_t DISPLAY_TICK_LIMIT_US = 1000;
+// --check: the colon alone changes the frame twice a second, one burst
+// each; the per-digit writes this replaced took some 57600 transactions
+// an hour
+const double BUS_TRANSACTIONS_PER_HOUR_LIMIT = 7500;
+
+struct Shown {
+  bool valid = false;  // a time, not text
+  int hour12 = 0;
+  int minute = 0;
+  bool pm = false;
+  bool colon = false;
+  bool alarm = false;
+};
+
+static int decodeDigit(uint8_t segments, bool blank_is_zero) {
+  segments &= ~SEG_DOT;
+  if (segments == 0) return blank_is_zero ? 0 : -1;
+  for (int d = 0; d < 10; d++) {
+    if (DIGIT_SHAPES[d] == segments) return d;
+  }
+  return -1;
+}
+
+static Shown decodeFrame(const uint8_t* grids) {
+  Shown shown;
+  int h1 = decodeDigit(grids[0], true), h0 = decodeDigit(grids[1], false);
+  int m1 = decodeDigit(grids[2], false), m0 = decodeDigit(grids[3], false);
+  bool am = grids[4] & LAMP_AMPM, pm = grids[5] & LAMP_AMPM;
+  if (h1 < 0 || h0 < 0 || m1 < 0 || m0 < 0 || am == pm) return shown;
+  shown.hour12 = h1 * 10 + h0;
+  shown.minute = m1 * 10 + m0;
+  if (shown.hour12 < 1 || shown.hour12 > 12 || shown.minute > 59) return shown;
+  shown.valid = true;
+  shown.pm = pm;
+  shown.colon = grids[1] & SEG_DOT;
+  shown.alarm = (grids[4] | grids[5]) & LAMP_ALARM;
+  return shown;
+}
+
+static Shown trueLocal(int64_t utc_us) {
+  time_t utc = utc_us / 1000000;
+  struct tm local;
+  localtime_r(&utc, &local);
+  Shown shown;
+  shown.valid = true;
+  shown.hour12 = local.tm_hour % 12 == 0 ? 12 : local.tm_hour % 12;
+  shown.minute = local.tm_min;
+  shown.pm = local.tm_hour >= 12;
+  return shown;
+}
+
+static bool sameMinute(const Shown& a, const Shown& b) {
+  return a.hour12 == b.hour12 && a.minute == b.minute && a.pm == b.pm;
+}
+
+static int64_t nearestMultipleError(int64_t value, int64_t step) {
+  int64_t r = ((value % step) + step) % step;
+  return r > step / 2 ? r - step : r;
+}
+
+struct DisplayScore {
+  uint8_t grids[16] = {0};
+  Shown shown;
+  int64_t first_time_us = -1;
+  uint64_t transactions = 0;
+  uint64_t frames = 0;
+  bool auto_increment = false;  // the data command the chip last latched
+  uint64_t fixed_bursts = 0;    // multi-grid writes without auto-increment
+  Samples minute_error_ms;
+  uint32_t minute_jumps = 0;  // minute changes far from any boundary (steps)
+  Samples colon_error_us;
+  uint64_t wrong_samples = 0;
+  uint64_t unsynced_samples = 0;
+  uint64_t dark_samples = 0;  // no time shown after the first one
+  FILE* frames_file = NULL;
+
+  void onWrite(const SimDisplayWrite& write) {
+    transactions++;
+    if ((write.command & 0xC0) == 0x40) auto_increment = (write.command & 0x04) == 0;
+    if ((write.command & 0xC0) != 0xC0) return;  // only address commands carry grid data
+    if (write.data.size() > 1 && !auto_increment) fixed_bursts++;
+    int address = write.command & 0x0F;
+    for (size_t i = 0; i < write.data.size() && address + i < sizeof(grids); i++) grids[address + i] = write.data[i];
+    frames++;
+    int64_t utc_us = simTrueUtcAt(write.mono_us);
+    if (frames_file) {
+      fprintf(frames_file, "%d,%lld,%lld", simBootNumber(), (long long)write.mono_us, (long long)utc_us);
+      for (int g = 0; g < GRIDS; g++) fprintf(frames_file, ",%02x", grids[g]);
+      fprintf(frames_file, "\n");
+    }
+
+    Shown next = decodeFrame(grids);
+    if (next.valid && first_time_us < 0) first_time_us = write.mono_us;
+    if (next.valid && shown.valid) {
+      if (!sameMinute(next, shown)) {
+        int64_t error_us = nearestMultipleError(utc_us, 60000000);
+        if (llabs(error_us) < 30000000) minute_error_ms.add(llabs(error_us) / 1000.0);
+        else minute_jumps++;
+      }
+      // The colon blinks only once the time is verified; edges sit on the half second
+      if (next.colon != shown.colon && !next.alarm) {
+        colon_error_us.add(llabs(nearestMultipleError(utc_us, 500000)));
+      }
+    }
+    shown = next;
+  }
+
+  void sample() {
+    if (first_time_us < 0) return;
+    if (!shown.valid) {
+      dark_samples++;
+      return;
+    }
+    int64_t utc_us = simTrueUtcUs();
+    if (shown.alarm) unsynced_samples++;
+    if (sameMinute(shown, trueLocal(utc_us))) return;
+    if (llabs(nearestMultipleError(utc_us, 60000000)) < MINUTE_TOLERANCE_US) return;
+    wrong_samples++;
+  }
+};
+
+static DisplayScore display;
+
+extern volatile uint32_t display_ticks;
+extern volatile uint32_t display_tick_max_us;
+
+static void scheduleSample(int64_t at_us) {
+  simAt(at_us, [at_us]() {
+    display.sample();
+    scheduleSample(at_us + SAMPLE_US);
+  });
+}
+
+// -----------------------------------------------
+// Clock discipline
+// -----------------------------------------------
+// Once a second, the sketch's disciplined clock against the reference;
+// the first minutes after it gets a time are the initial lock-in, not
+// residual error
+extern bool time_valid;
+int64_t utcNowUs();
+
+const int64_t CLOCK_SAMPLE_US = 1000000;
+const int64_t CLOCK_SETTLE_US = 600000000;
+const double CLOCK_RESIDUAL_LIMIT_MS = 30;  // --check
+
+struct ClockScore {
+  int64_t valid_since_us = -1;
+  Samples error_ms;
+
+  void sample() {
+    if (!time_valid) return;
+    int64_t now_us = simNowUs();
+    if (valid_since_us < 0) valid_since_us = now_us;
+    if (now_us - valid_since_us < CLOCK_SETTLE_US) return;
+    error_ms.add(llabs(utcNowUs() - simTrueUtcUs()) / 1000.0);
+  }
+};
+
+static ClockScore clock_score;
+
+static void scheduleClockSample(int64_t at_us) {
+  simAt(at_us, [at_us]() {
+    clock_score.sample();
+    scheduleClockSample(at_us + CLOCK_SAMPLE_US);
+  });
+}
+
+// -----------------------------------------------
+// Network loop
+// -----------------------------------------------
+// Samples the sketch's pass counter; a gap is how long it stood still,
+// i.e. how long HTTP, OTA and the NTP reply went unserved
+extern uint32_t loop_iterations;
+
+const int64_t LOOP_SAMPLE_US = 10000;
+const double LOOP_GAP_LIMIT_MS = 100;  // --check
+
+struct LoopScore {
+  uint32_t last_iterations = 0;
+  int64_t last_change_us = -1;
+  int64_t max_gap_us = 0;
+
+  void sample() {
+    int64_t now_us = simNowUs();
+    if (loop_iterations == last_iterations) return;
+    last_iterations = loop_iterations;
+    if (last_change_us >= 0) max_gap_us = std::max(max_gap_us, now_us - last_change_us);
+    last_change_us = now_us;
+  }
+};
+
+static LoopScore network_loop;
+
+static void scheduleLoopSample(int64_t at_us) {
+  simAt(at_us, [at_us]() {
+    network_loop.sample();
+    scheduleLoopSample(at_us + LOOP_SAMPLE_US);
+  });
+}
+
+// -----------------------------------------------
+// HTTP clients
+// -----------------------------------------------
+const int64_t LAN_DELAY_US = 2000;            // one way, browsers on the same Wi-Fi
+const uint32_t SLOW_CLIENT_BYTES_PER_MS = 1;  // --load-slow: a phone at the edge of coverage
+const double LOAD_P99_LIMIT_MS = 250;         // --check: page latency of the fast browsers under load
+
+struct HttpScore {
+  Samples latency_ms;
+  uint64_t requests = 0;
+  uint64_t errors = 0;
+  uint64_t unreachable = 0;  // no answer at all, as while the access point is down
+  std::string handlers_json;
+  std::string beacon_json;  // /api/status "beacon" at the end of the run
+};
+
+static HttpScore http;
+static SimHttpClient* browser = NULL;  // polls the status page
+static SimHttpClient* admin = NULL;    // settings, handler stats, beacon status
+
+static void pollStatus(int64_t at_us, int64_t interval_us, int n) {
+  simAt(at_us, [at_us, interval_us, n]() {
+    SimHttpRequest request;
+    request.uri = n % 2 ? "/api/status" : "/";
+    request.done = [](const SimHttpResponse& response) {
+      http.requests++;
+      if (response.code == 0) http.unreachable++;
+      else if (response.code != 200) http.errors++;
+      if (response.code != 0) http.latency_ms.add((response.finished_us - response.queued_us) / 1000.0);
+    };
+    browser->request(request);
+    pollStatus(at_us + interval_us, interval_us, n + 1);
+  });
+}
+
+static void fetchHandlerStats(int64_t at_us) {
+  simAt(at_us, []() {
+    SimHttpRequest request;
+    request.uri = "/api/handlers";
+    request.done = [](const SimHttpResponse& response) {
+      if (response.code == 200) http.handlers_json = response.body;
+    };
+    admin->request(request);
+  });
+}
+
+static void fetchBeaconStatus(int64_t at_us) {
+  simAt(at_us, []() {
+    SimHttpRequest request;
+    request.uri = "/api/status";
+    request.done = [](const SimHttpResponse& response) {
+      size_t start = response.body.find("\"beacon\":{");
+      if (response.code != 200 || start == std::string::npos) return;
+      start += strlen("\"beacon\":");
+      http.beacon_json = response.body.substr(start, response.body.find('}', start) + 1 - start);
+    };
+    admin->request(request);
+  });
+}
+
+// --load: browsers fetching the status page and JSON back to back over
+// kept-alive connections, slow ones among them, and an event stream.
+// More of them than the clock's connection pool, so they take turns.
+struct LoadScore {
+  Samples fast_ms;
+  Samples slow_ms;
+  uint64_t errors = 0;
+  uint64_t events = 0;
+  uint64_t connects = 0;
+};
+
+static LoadScore load;
+static std::vector<SimHttpClient*> load_clients;
+static int64_t load_end_us = 0;
+
+// The settings page is longer than the sketch's per-connection buffer,
+// so it goes out chunked
+const char* const LOAD_URIS[] = {"/", "/api/status", "/settings", "/api/status"};
+
+static bool completePage(const SimHttpResponse& response) {
+  const std::string end = "</html>";
+  return response.code == 200 && (response.body.compare(0, 1, "{") == 0 ||
+                                  (response.body.size() >= end.size() &&
+                                   response.body.compare(response.body.size() - end.size(), end.size(), end) == 0));
+}
+
+static void loadFetch(SimHttpClient* client, bool slow, int64_t end_us, int n) {
+  SimHttpRequest request;
+  request.uri = LOAD_URIS[n % 4];
+  request.done = [client, slow, end_us, n](const SimHttpResponse& response) {
+    if (!completePage(response)) load.errors++;
+    else (slow ? load.slow_ms : load.fast_ms).add((response.finished_us - response.queued_us) / 1000.0);
+    if (simNowUs() < end_us) loadFetch(client, slow, end_us, n + 1);
+  };
+  client->request(request);
+}
+
+static void startLoad(int64_t start_us, int64_t end_us) {
+  load_end_us = end_us;
+  for (int i = 0; i < options.load_clients + options.load_slow_clients; i++) {
+    bool slow = i >= options.load_clients;
+    SimHttpClient* client = new SimHttpClient(simIp(192, 168, 1, 100 + i), LAN_DELAY_US, slow ? SLOW_CLIENT_BYTES_PER_MS : 0);
+    load_clients.push_back(client);
+    simAt(start_us + i * 10000, [client, slow, end_us]() { loadFetch(client, slow, end_us, 0); });
+  }
+  SimHttpClient* listener = new SimHttpClient(simIp(192, 168, 1, 99), LAN_DELAY_US, 0);
+  load_clients.push_back(listener);
+  simAt(start_us, [listener, start_us, end_us]() {
+    SimHttpRequest request;
+    request.uri = "/events";
+    request.event = [start_us, end_us](const std::string& event) {
+      if (event.compare(0, 5, "data:") == 0 && simNowUs() >= start_us && simNowUs() < end_us) load.events++;
+    };
+    request.done = [](const SimHttpResponse& response) { load.errors++; };  // the stream should outlast the run
+    listener->request(request);
+  });
+}
+
+// --bench-pages: one browser fetching each page in turn with nothing
+// else asking. The heap window runs from the request to the last byte
+// and is device-wide, so it also sees what the network task allocates.
+const char* const BENCH_URIS[] = {"/", "/settings", "/reset", "/api/status", "/metrics",
+                                  "/api/handlers", "/api/telemetry", "/style.css"};
+const int BENCH_PAGES = sizeof(BENCH_URIS) / sizeof(BENCH_URIS[0]);
+// --check: pages render through the connection's fixed buffer; buffering
+// a whole page on the heap took 1-6 KB per request
+const uint64_t PAGE_PEAK_LIMIT = 512;
+
+struct PageBench {
+  uint64_t requests = 0;
+  uint64_t errors = 0;
+  size_t bytes = 0;         // body of the last response
+  uint64_t allocations = 0;
+  uint64_t alloc_bytes = 0;
+  uint64_t peak = 0;        // the most heap held above the starting level by one request
+};
+
+static PageBench bench[BENCH_PAGES];
+static SimHttpClient* bench_client = NULL;
+
+static void benchFetch(int n) {
+  if (n >= options.bench_pages * BENCH_PAGES) return;
+  int page = n % BENCH_PAGES;
+  SimHttpRequest request;
+  request.uri = BENCH_URIS[page];
+  SimHeapWindow begin = simHeapWindowBegin();
+  request.done = [n, page, begin](const SimHttpResponse& response) {
+    SimHeapWindow used = simHeapWindowEnd(begin);
+    PageBench& b = bench[page];
+    b.requests++;
+    if (response.code != 200) b.errors++;
+    b.bytes = response.body.size();
+    b.allocations += used.allocations;
+    b.alloc_bytes += used.bytes;
+    b.peak = std::max(b.peak, used.peak);
+    benchFetch(n + 1);
+  };
+  bench_client->request(request);
+}
+
+// -----------------------------------------------
+// Report
+// -----------------------------------------------
+struct Check {
+  std::string name;
+  bool passed;
+};
+
+// --check: the nominal heap is 300000 bytes; a leak of a few hundred
+// bytes a minute crosses these within the default six hours
+const uint32_t HEAP_FREE_FLOOR = 200000;
+const uint32_t HEAP_MIN_FREE_FLOOR = 150000;
+
+const int64_t OUTAGE_REJOIN_US = 300000000;  // --check: backoff allowance after the access point returns
+
+static std::vector<Check> checks;
+static uint32_t outages_ended = 0;  // this boot, with OUTAGE_REJOIN_US left after them
+static bool deadlocked = false;
+
+static void expect(const char* name, bool passed) {
+  checks.push_back(Check{name, passed});
+}
+
+static void evaluate(int64_t run_us) {
+  bool first_boot = simBootNumber() == 1;
+  double first_time_s = display.first_time_us / 1e6;
+  // A warm restart shows the saved time right away; a cold boot waits for Wi-Fi and NTP
+  double first_time_limit = first_boot ? 30 + options.wifi_join_sec : 2;
+  // Host CPU time charged with --cpu-scale varies from run to run; the
+  // millisecond timing checks need the pure virtual clock
+  bool exact_timing = options.cpu_scale == 0;
+  expect("no deadlock", !deadlocked);
+  if (run_us > first_time_limit * 1e6) {
+    expect("time shown", display.first_time_us >= 0 && first_time_s <= first_time_limit);
+  }
+  expect("no wrong minute", display.wrong_samples == 0);
+  double shown_limit_ms = CLOCK_RESIDUAL_LIMIT_MS + DISPLAY_TICK_LIMIT_US / 1000.0;
+  if (exact_timing) {
+    expect("minute changes on time", display.minute_error_ms.max() < shown_limit_ms);
+    expect("colon on time", display.colon_error_us.max() < shown_limit_ms * 1000);
+    expect("ticks within 1 ms", display_tick_max_us < DISPLAY_TICK_LIMIT_US);
+  }
+  expect("no display downtime", display.dark_samples == 0);
+  expect("no aborted joins", simWifiStats().aborted_joins == 0);
+  if (outages_ended > 0) expect("rejoined after outage", simWifiStats().joins > outages_ended);
+  if (run_us >= 3600000000LL) {
+    expect("bus transactions", display.transactions * 3.6e9 / run_us <= BUS_TRANSACTIONS_PER_HOUR_LIMIT);
+  }
+  expect("bursts auto-increment", display.fixed_bursts == 0);
+  expect("clock error", clock_score.error_ms.max() < CLOCK_RESIDUAL_LIMIT_MS);
+  if (exact_timing) expect("network loop never stalls", network_loop.max_gap_us < LOOP_GAP_LIMIT_MS * 1000);
+  if (options.http_interval_sec > 0) {
+    expect("http answered", http.errors == 0 && (http.unreachable == 0 || !options.outages.empty()));
+  }
+  if (!load_clients.empty() && run_us > load_end_us) {
+    expect("load answered", load.errors == 0);
+    expect("load p99", load.fast_ms.percentile(99) < LOAD_P99_LIMIT_MS);
+    expect("events under load", load.events >= options.load_sec * 0.9);
+  }
+  if (bench_client) {
+    uint64_t requests = 0, errors = 0, peak = 0;
+    for (const PageBench& b : bench) requests += b.requests, errors += b.errors, peak = std::max(peak, b.peak);
+    expect("pages answered", requests == (uint64_t)options.bench_pages * BENCH_PAGES && errors == 0);
+    expect("page heap", peak <= PAGE_PEAK_LIMIT);
+  }
+  if (beacon_leader && run_us > 300000000) {
+    expect("beacon locked", http.beacon_json.find("\"locked\":true") != std::string::npos);
+  }
+  if (ntp_client && run_us > 300000000) {
+    expect("ntp served", ntp_client->synced > 0);
+    expect("served offset", ntp_client->offset_ms.max() < CLOCK_RESIDUAL_LIMIT_MS);
+    expect("served root dispersion", ntp_client->root_disp_ms.max() < SERVED_DISP_LIMIT_MS);
+  }
+  expect("heap free", simHeapFree() >= HEAP_FREE_FLOOR);
+  expect("min free heap", simHeapMinFree() >= HEAP_MIN_FREE_FLOOR);
+}
+
+static void report(const char* ended, int64_t run_us) {
+  evaluate(run_us);
+  SimWifiStats wifi = simWifiStats();
+  SimNetStats net = simNetStats();
+  printf("{\"boot\":%d,\"ended\":\"%s\",\"device_seconds\":%.3f,\"scenario_seconds\":%.3f,", simBootNumber(), ended,
+         run_us / 1e6, (simElapsedBeforeBootUs() + simTrueUtcAt(run_us) - simTrueUtcAt(0)) / 1e6);
+  printf("\"first_time_display_s\":%.3f,", display.first_time_us / 1e6);
+  printf("\"minute_changes\":{\"count\":%zu,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f,\"jumps\":%u},",
+         display.minute_error_ms.values.size(), display.minute_error_ms.percentile(50),
+         display.minute_error_ms.percentile(99), display.minute_error_ms.max(), display.minute_jumps);
+  printf("\"colon_edges\":{\"count\":%zu,\"p50_us\":%.0f,\"p99_us\":%.0f,\"max_us\":%.0f},",
+         display.colon_error_us.values.size(), display.colon_error_us.percentile(50),
+         display.colon_error_us.percentile(99), display.colon_error_us.max());
+  printf("\"ticks\":{\"count\":%u,\"max_us\":%u},", display_ticks, display_tick_max_us);
+  printf("\"clock_error\":{\"count\":%zu,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f},",
+         clock_score.error_ms.values.size(), clock_score.error_ms.percentile(50), clock_score.error_ms.percentile(99),
+         clock_score.error_ms.max());
+  printf("\"wrong_minute_s\":%.2f,\"unsynced_s\":%.2f,\"dark_s\":%.2f,", display.wrong_samples * SAMPLE_US / 1e6,
+         display.unsynced_samples * SAMPLE_US / 1e6, display.dark_samples * SAMPLE_US / 1e6);
+  printf("\"bus\":{\"transactions\":%llu,\"frames\":%llu,\"per_hour\":%.1f},", (unsigned long long)display.transactions,
+         (unsigned long long)display.frames, run_us > 0 ? display.transactions * 3.6e9 / run_us : 0.0);
+  printf("\"http\":{\"requests\":%llu,\"errors\":%llu,\"unreachable\":%llu,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f},",
+         (unsigned long long)http.requests, (unsigned long long)http.errors, (unsigned long long)http.unreachable,
+         http.latency_ms.percentile(50), http.latency_ms.percentile(99), http.latency_ms.max());
+  printf("\"loop\":{\"passes\":%u,\"max_gap_ms\":%.1f},", loop_iterations, network_loop.max_gap_us / 1e3);
+  if (!load_clients.empty()) {
+    uint64_t connects = 0;
+    for (SimHttpClient* client : load_clients) connects += client->connects;
+    printf("\"load\":{\"clients\":%d,\"slow_clients\":%d,\"requests\":%zu,\"errors\":%llu,\"req_per_s\":%.1f,"
+           "\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f,", options.load_clients, options.load_slow_clients,
+           load.fast_ms.values.size(), (unsigned long long)load.errors, load.fast_ms.values.size() / options.load_sec,
+           load.fast_ms.percentile(50), load.fast_ms.percentile(99), load.fast_ms.max());
+    printf("\"slow\":{\"requests\":%zu,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f},", load.slow_ms.values.size(),
+           load.slow_ms.percentile(50), load.slow_ms.percentile(99), load.slow_ms.max());
+    printf("\"events\":%llu,\"connects\":%llu},", (unsigned long long)load.events, (unsigned long long)connects);
+  }
+  if (bench_client) {
+    printf("\"pages\":[");
+    for (int i = 0; i < BENCH_PAGES; i++) {
+      const PageBench& b = bench[i];
+      double n = b.requests ? b.requests : 1;
+      printf("%s{\"uri\":\"%s\",\"requests\":%llu,\"bytes\":%zu,\"allocs\":%.1f,\"alloc_bytes\":%.0f,\"peak\":%llu}",
+             i ? "," : "", BENCH_URIS[i], (unsigned long long)b.requests, b.bytes, b.allocations / n, b.alloc_bytes / n,
+             (unsigned long long)b.peak);
+    }
+    printf("],");
+  }
+  printf("\"handlers\":%s,", http.handlers_json.empty() ? "null" : http.handlers_json.c_str());
+  printf("\"wifi\":{\"begins\":%u,\"aborted_joins\":%u,\"joins\":%u,\"first_join_s\":%.3f},", wifi.begins,
+         wifi.aborted_joins, wifi.joins, wifi.first_join_us / 1e6);
+  printf("\"net\":{\"sent\":%llu,\"delivered\":%llu,\"dropped\":%llu},", (unsigned long long)net.sent,
+         (unsigned long long)net.delivered, (unsigned long long)net.dropped);
+  printf("\"ntp_requests\":[");
+  for (size_t i = 0; i < ntp_hosts.size(); i++) printf("%s%llu", i ? "," : "", (unsigned long long)ntp_hosts[i]->requests);
+  printf("],\"ntp_lost\":[");
+  for (size_t i = 0; i < ntp_hosts.size(); i++) printf("%s%llu", i ? "," : "", (unsigned long long)ntp_hosts[i]->lost);
+  printf("],");
+  if (ntp_client) {
+    printf("\"ntp_served\":{\"requests\":%llu,\"replies\":%llu,\"synced\":%llu,\"offset_max_ms\":%.3f,"
+           "\"root_delay_max_ms\":%.3f,\"root_disp_p50_ms\":%.3f,\"root_disp_max_ms\":%.3f},",
+           (unsigned long long)ntp_client->requests, (unsigned long long)ntp_client->replies,
+           (unsigned long long)ntp_client->synced, ntp_client->offset_ms.max(), ntp_client->root_delay_ms.max(),
+           ntp_client->root_disp_ms.percentile(50), ntp_client->root_disp_ms.max());
+  }
+  if (beacon_leader) {
+    printf("\"beacon\":{\"sent\":%llu,\"replayed\":%zu,\"status\":%s},", (unsigned long long)beacon_leader->sent,
+           beacon_leader->replayed, http.beacon_json.empty() ? "null" : http.beacon_json.c_str());
+  }
+  printf("\"tasks\":[");
+  std::vector<SimTaskStats> tasks = simTaskStats();
+  for (size_t i = 0; i < tasks.size(); i++) {
+    printf("%s{\"name\":\"%s\",\"switches\":%llu,\"host_s\":%.3f}", i ? "," : "", tasks[i].name,
+           (unsigned long long)tasks[i].switches, tasks[i].host_seconds);
+  }
+  printf("],\"heap\":{\"free\":%u,\"min_free\":%u},\"checks\":{", simHeapFree(), simHeapMinFree());
+  for (size_t i = 0; i < checks.size(); i++) {
+    printf("%s\"%s\":%s", i ? "," : "", checks[i].name.c_str(), checks[i].passed ? "true" : "false");
+  }
+  printf("}}\n");
+  fflush(stdout);
+
+  if (!options.check) return;
+  bool failed = false;
+  for (Check& check : checks) {
+    if (check.passed) continue;
+    fprintf(stderr, "sim: boot %d failed check: %s\n", simBootNumber(), check.name.c_str());
+    failed = true;
+  }
+  if (failed) {
+    fflush(stderr);
+    _exit(1);
+  }
+}
+
+// -----------------------------------------------
+// Scenario
+// -----------------------------------------------
+// Scenario seconds are true time since the first power-on; this boot's
+// device time starts after simElapsedBeforeBootUs()
+static int64_t scenarioToDevice(double scenario_sec) {
+  return (int64_t)((scenario_sec * 1e6 - simElapsedBeforeBootUs()) * (1.0 + options.drift_ppm * 1e-6));
+}
+
+static void seedSettings(const std::string& ntp_names) {
+  simNvsPut("ntpclock", "ssid", "HomeNet", 's');
+  simNvsPut("ntpclock", "pass", "correct-horse", 's');
+  simNvsPut("ntpclock", "tz", "0", 'i');  // Eastern
+  if (options.tz_custom) simNvsPut("ntpclock", "tzposix", options.tz, 's');
+  simNvsPut("ntpclock", "ntp", ntp_names, 's');
+  simNvsPut("ntpclock", "bright", "7", 'i');
+}
+
+// What the settings page posts to turn on the NTP server or beacon following
+static void saveSettings(int64_t at_us, const std::string& ntp_names) {
+  simAt(at_us, [ntp_names]() {
+    SimHttpRequest request;
+    request.method = "POST";
+    request.uri = "/updatesettings";
+    request.args = {{"timezone", "0"}, {"tzposix", options.tz_custom ? options.tz : ""}, {"ntpserver", ntp_names},
+                    {"beacon", options.beacon ? "2" : "0"}, {"beaconkey", options.beacon ? BEACON_KEY : ""},
+                    {"brightness", "7"}};
+    if (options.serve_ntp) request.args.push_back({"serventp", "on"});
+    admin->request(request);
+  });
+}
+
+static void loopTask(void* arg) {
+  setup();
+  for (;;) loop();
+}
+
+int main(int argc, char** argv) {
+  parseOptions(argc, argv);
+  simSetArgs(argc, argv);
+  for (int i = 1; i + 1 < argc; i++) {
+    if (strcmp(argv[i], "--resume") == 0) simResume(argv[i + 1]);
+  }
+  simSeed(options.seed * 1000 + simBootNumber());
+  simSerialVerbose(options.verbose);
+  simConfigureClock(SimClockConfig{options.start_utc_sec * 1000000, options.drift_ppm, options.cpu_scale});
+  setenv("TZ", options.tz.c_str(), 1);
+  tzset();
+
+  simWifiConfigure(SimWifiConfig{"HomeNet", "correct-horse", (int64_t)(options.wifi_join_sec * 1e6), 2000000,
+                                 simIp(192, 168, 1, 50), -58});
+  int64_t until_us = scenarioToDevice(options.hours * 3600);
+  for (Outage& outage : options.outages) {
+    int64_t start = scenarioToDevice(outage.start_sec);
+    int64_t duration = (int64_t)(outage.duration_sec * 1e6);
+    if (start + duration > 0) simWifiOutage(std::max<int64_t>(start, 0), duration + std::min<int64_t>(start, 0));
+    if (start > 0 && start + duration + OUTAGE_REJOIN_US < until_us) outages_ended++;
+  }
+
+  std::string ntp_names;
+  for (int i = 0; i < options.servers; i++) {
+    uint32_t ip = simIp(10, 0, 0, 1 + i);
+    int64_t error_us = i < options.falsetickers ? (int64_t)(options.falseticker_sec * 1e6) : 0;
+    NtpServerHost* host = new NtpServerHost(ip, (int64_t)(options.delay_ms * 1000), (int64_t)(options.jitter_ms * 1000),
+                                            error_us);
+    ntp_hosts.push_back(host);
+    simNetAddHost(host);
+    std::string name = "ntp" + std::to_string(i + 1) + ".example.net";
+    simNetAddName(name.c_str(), ip);
+    ntp_names += (i ? "," : "") + name;
+  }
+  if (simBootNumber() == 1) seedSettings(ntp_names);
+
+  if (options.frames_path) display.frames_file = fopen(options.frames_path, simBootNumber() == 1 ? "w" : "a");
+  simDisplayListen([](const SimDisplayWrite& write) { display.onWrite(write); });
+  scheduleSample(SAMPLE_US);
+  scheduleLoopSample(LOOP_SAMPLE_US);
+  scheduleClockSample(CLOCK_SAMPLE_US);
+
+  browser = new SimHttpClient(simIp(192, 168, 1, 10), LAN_DELAY_US, options.http_bytes_per_ms);
+  admin = new SimHttpClient(simIp(192, 168, 1, 11), LAN_DELAY_US, 0);
+  if (options.load_clients + options.load_slow_clients > 0) {
+    int64_t start_us = scenarioToDevice(options.load_start_sec);
+    if (start_us > 0) startLoad(start_us, scenarioToDevice(options.load_start_sec + options.load_sec));
+  }
+  if (options.bench_pages > 0 && simBootNumber() == 1) {
+    bench_client = new SimHttpClient(simIp(192, 168, 1, 12), LAN_DELAY_US, 0);
+    simAt(60000000, []() { benchFetch(0); });
+  }
+  if (options.http_interval_sec > 0) pollStatus(60000000, (int64_t)(options.http_interval_sec * 1e6), 0);
+  if (until_us > 20000000) fetchHandlerStats(until_us - 10000000);
+  if ((options.serve_ntp || options.beacon) && simBootNumber() == 1) saveSettings(45000000, ntp_names);
+  if (options.beacon) {
+    beacon_leader = new BeaconLeaderHost(simIp(192, 168, 1, 30));
+    simNetAddHost(beacon_leader);
+    int64_t replay_from_us = options.beacon_replay_sec >= 0 ? scenarioToDevice(options.beacon_replay_sec) : -1;
+    scheduleBeacons(1000000, replay_from_us);
+    if (until_us > 20000000) fetchBeaconStatus(until_us - 5000000);
+  }
+  if (options.serve_ntp) {
+    ntp_client = new NtpClientHost(simIp(192, 168, 1, 20), 1000, 500);
+    simNetAddHost(ntp_client);
+    pollDeviceNtp(90000000, 64000000);
+  }
+  for (double restart_sec : options.restarts) {
+    int64_t at_us = scenarioToDevice(restart_sec);
+    if (at_us > 0 && at_us < until_us) simAt(at_us, []() { simRestart("scenario"); });
+  }
+  simOnRestart([](const char* reason) {
+    if (display.frames_file) fclose(display.frames_file);
+    report("restart", simNowUs());
+  });
+
+  simTaskCreate(loopTask, "loopTask", 8192, NULL, 1, ARDUINO_RUNNING_CORE);
+  deadlocked = !simRun(until_us);
+  if (display.frames_file) fclose(display.frames_file);
+  report(deadlocked ? "deadlock" : "end", simNowUs());
+  // The firmware never tears its globals down; their destructors would
+  // run against a scheduler that has already stopped
+  _exit(0);
+}
@@ -0,0 +1,171 @@
+// Replays NTP sample traces through clock_core.h's clock filter and
+// clock select, as ntpReadReply() and ntpSelectPeer() run them: each
+// reply goes into its peer's eight-entry register, the filter picks the
+// sample to use and the select runs over every peer heard from.
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "clock_core.h"
+
+const int REGISTER_SIZE = 8;  // NTP_FILTER_SIZE in the sketch
+const int MAX_PEERS = 4;      // NTP_MAX_SERVERS
+
+struct TraceSample {
+  int64_t offset_us;
+  uint32_t delay_us;
+  uint32_t distance_us;
+  bool present = true;  // false: no reply this round
+};
+
+struct TraceRound {
+  int64_t at_sec;
+  TraceSample peers[MAX_PEERS];
+};
+
+struct Trace {
+  const char* name;
+  int peers;
+  const TraceRound* rounds;
+  int round_count;
+  uint8_t falsetickers;  // peers that must never be chosen, as a bit mask
+  int survivors;         // expected every round; -1 for no majority
+  int64_t max_offset_us; // chosen offset bound
+};
+
+// Three servers agree to a few ms, the fourth is 3 s out
+const TraceRound FALSETICKER[] = {
+  {0, {{-2029, 29305, 23652}, {1923, 30468, 24234}, {-2106, 24791, 21395}, {2997844, 32779, 25389}}},
+  {64, {{1425, 29991, 23995}, {1437, 24950, 21475}, {-2733, 27517, 22758}, {3000776, 25408, 21704}}},
+  {128, {{-2885, 30851, 24425}, {-2350, 27943, 22971}, {3226, 33028, 25514}, {3001911, 24968, 21484}}},
+  {192, {{-1026, 26028, 22014}, {-2879, 34332, 26166}, {2717, 33455, 25727}, {2999109, 24812, 21406}}},
+  {256, {{1864, 24763, 21381}, {-501, 26181, 22090}, {-2278, 30867, 24433}, {2998221, 32858, 25429}}},
+  {320, {{1284, 33353, 25676}, {-787, 33179, 25589}, {1953, 25688, 21844}, {2999308, 33358, 25679}}},
+  {384, {{-2565, 30101, 24050}, {-2694, 32974, 25487}, {-2780, 33246, 25623}, {2999506, 34141, 26070}}},
+  {448, {{1956, 32133, 25066}, {-187, 32711, 25355}, {570, 29146, 23573}, {3003624, 33593, 25796}}},
+  {512, {{-886, 29924, 23962}, {3398, 28070, 23035}, {2757, 26945, 22472}, {2997570, 27999, 22999}}},
+  {576, {{1142, 33411, 25705}, {379, 32604, 25302}, {2671, 29627, 23813}, {2998838, 31353, 24676}}},
+};
+
+// Server 1's path congests for two rounds: 400 ms round trips with a
+// skewed 180 ms offset, which the filter must not pass on
+const TraceRound DELAY_SPIKE[] = {
+  {0, {{-2550, 28988, 23494}, {1446, 24967, 21483}, {-1642, 27425, 22712}}},
+  {64, {{-1686, 26802, 22401}, {403, 28005, 23002}, {-2048, 24321, 21160}}},
+  {128, {{1586, 28571, 23285}, {-121, 26570, 22285}, {-352, 29695, 23847}}},
+  {192, {{931, 28869, 23434}, {612, 28750, 23375}, {-1941, 24563, 21281}}},
+  {256, {{1011, 26211, 22105}, {180000, 404259, 211129}, {-164, 24497, 21248}}},
+  {320, {{1553, 29301, 23650}, {180000, 418651, 218325}, {-77, 29870, 23935}}},
+  {384, {{-356, 29477, 23738}, {1113, 24184, 21092}, {-1566, 26911, 22455}}},
+  {448, {{-2192, 29004, 23502}, {-2573, 28044, 23022}, {-475, 25787, 21893}}},
+  {512, {{-728, 25059, 21529}, {226, 27259, 22629}, {-2397, 28067, 23033}}},
+  {576, {{892, 25362, 21681}, {1522, 27290, 22645}, {-1566, 26276, 22138}}},
+};
+
+// Two servers 3 s apart: neither can be trusted
+const TraceRound SPLIT[] = {
+  {0, {{-1200, 28000, 23000}, {2999100, 27000, 22500}}},
+  {64, {{800, 26000, 22000}, {3001300, 29000, 23500}}},
+  {128, {{-300, 30000, 24000}, {3000200, 26000, 22000}}},
+};
+
+// One server stops answering; its last sample stays usable but ages
+const TraceRound SILENT[] = {
+  {0, {{-900, 26000, 22000}, {600, 27000, 22500}, {-200, 25000, 21500}}},
+  {64, {{-700, 25500, 21750}, {300, 26500, 22250}, {-400, 25500, 21750}}},
+  {128, {{-600, 27000, 22500}, {0, 0, 0, false}, {-100, 26000, 22000}}},
+  {192, {{-800, 26000, 22000}, {0, 0, 0, false}, {-300, 25000, 21500}}},
+  {256, {{-500, 25000, 21500}, {0, 0, 0, false}, {-200, 27000, 22500}}},
+};
+
+#define TRACE(name, rounds, peers, falsetickers, survivors, max_offset_us) \
+  {name, peers, rounds, (int)(sizeof(rounds) / sizeof(rounds[0])), falsetickers, survivors, max_offset_us}
+
+const Trace TRACES[] = {
+  TRACE("falseticker", FALSETICKER, 4, 0x08, 3, 5000),
+  TRACE("delay spike", DELAY_SPIKE, 3, 0x00, 3, 5000),
+  TRACE("split", SPLIT, 2, 0x00, -1, 0),
+  TRACE("silent peer", SILENT, 3, 0x00, 3, 5000),
+};
+
+struct Register {
+  NtpSample samples[REGISTER_SIZE];
+  int count = 0;
+  int next = 0;
+  NtpSample filtered;
+};
+
+static int failures = 0;
+
+static void expect(bool ok, const char* what, const char* trace, int64_t at_sec) {
+  if (ok) return;
+  printf("  %s at %llds: %s\n", trace, (long long)at_sec, what);
+  failures++;
+}
+
+static void replay(const Trace& trace) {
+  Register registers[MAX_PEERS];
+  int before = failures;
+  for (int r = 0; r < trace.round_count; r++) {
+    const TraceRound& round = trace.rounds[r];
+    int64_t now = round.at_sec * 1000000;
+    for (int p = 0; p < trace.peers; p++) {
+      const TraceSample& in = round.peers[p];
+      if (!in.present) continue;
+      Register& reg = registers[p];
+      reg.samples[reg.next] = NtpSample{in.offset_us, in.delay_us, in.distance_us, now};
+      reg.next = (reg.next + 1) % REGISTER_SIZE;
+      if (reg.count < REGISTER_SIZE) reg.count++;
+      reg.filtered = reg.samples[ntpFilter(reg.samples, reg.count, now)];
+    }
+
+    NtpSample candidates[MAX_PEERS];
+    int peer_of[MAX_PEERS];
+    int n = 0;
+    for (int p = 0; p < trace.peers; p++) {
+      if (registers[p].count == 0) continue;
+      candidates[n] = registers[p].filtered;
+      peer_of[n++] = p;
+    }
+    int survivors = 0;
+    int chosen = ntpSelect(candidates, n, now, survivors);
+    if (trace.survivors < 0) {
+      expect(chosen < 0, "expected no majority", trace.name, round.at_sec);
+      continue;
+    }
+    expect(chosen >= 0, "no peer selected", trace.name, round.at_sec);
+    if (chosen < 0) continue;
+    expect(!(trace.falsetickers & (1 << peer_of[chosen])), "falseticker selected", trace.name, round.at_sec);
+    expect(survivors == trace.survivors, "wrong survivor count", trace.name, round.at_sec);
+    expect(llabs(candidates[chosen].offset_us) <= trace.max_offset_us, "selected offset out of bounds", trace.name,
+           round.at_sec);
+  }
+  printf("%-12s %2d rounds  %s\n", trace.name, trace.round_count, failures == before ? "ok" : "FAIL");
+}
+
+// The filter's tie-breaks and ageing, which the traces only touch in passing
+static void filterCases() {
+  int before = failures;
+  NtpSample equal[3] = {{100, 20000, 20000, 0}, {200, 20000, 20000, 64000000}, {300, 20000, 20000, 128000000}};
+  expect(ntpFilter(equal, 3, 128000000) == 2, "equal delays should pick the newest", "filter", 0);
+
+  NtpSample lower[2] = {{100, 10000, 15000, 0}, {200, 30000, 25000, 64000000}};
+  expect(ntpFilter(lower, 2, 64000000) == 0, "a clearly lower delay should win over a newer sample", "filter", 0);
+
+  // 5 ms less delay is worth 2.5 ms of distance, about 170 s of ageing at 15 ppm
+  NtpSample aged[2] = {{100, 20000, 20000, 0}, {200, 25000, 22500, 1000000000}};
+  expect(ntpFilter(aged, 2, 1000000000) == 1, "a 1000 s old sample should give way", "filter", 0);
+
+  int survivors = 0;
+  NtpSample fresh[2] = {{0, 20000, 10000, 600000000}, {500, 20000, 12000, 600000000}};
+  expect(ntpSelect(fresh, 2, 600000000, survivors) == 0, "lowest distance should be chosen", "select", 0);
+  NtpSample stale[2] = {{0, 20000, 10000, 0}, {500, 20000, 12000, 600000000}};
+  expect(ntpSelect(stale, 2, 600000000, survivors) == 1, "10 minutes of age should outweigh 2 ms", "select", 0);
+  printf("%-12s %2d cases   %s\n", "filter", 5, failures == before ? "ok" : "FAIL");
+}
+
+int main() {
+  for (const Trace& trace : TRACES) replay(trace);
+  filterCases();
+  printf("%d failures\n", failures);
+  return failures ? 1 : 0;
+}
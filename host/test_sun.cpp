@@ -0,0 +1,61 @@
+// Checks sunTimesUtc() against a reference table of sunrise and sunset
+// times. The table comes from NOAA's full solar calculator equations,
+// iterated to the event itself rather than evaluated at noon; the sketch
+// uses the low-precision series, so a minute or two apart is expected.
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "clock_core.h"
+
+const int TOLERANCE_MIN = 2;  // as documented for sunTimesUtc()
+
+struct SunCase {
+  const char* place;
+  int year, month, day;
+  double latitude, longitude;
+  SunDay kind;
+  int rise_min, set_min;  // minutes after 00:00 UTC of the date; outside 0-1440 on the neighbouring UTC day
+};
+
+const SunCase CASES[] = {
+  {"New York", 2024, 6, 21, 40.7128, -74.0060, SUN_NORMAL, 565, 1471},
+  {"New York", 2024, 12, 21, 40.7128, -74.0060, SUN_NORMAL, 737, 1292},
+  {"London", 2024, 3, 20, 51.5074, -0.1278, SUN_NORMAL, 362, 1094},
+  {"London", 2024, 12, 21, 51.5074, -0.1278, SUN_NORMAL, 484, 954},
+  {"Reykjavik", 2024, 6, 21, 64.1466, -21.9426, SUN_NORMAL, 175, 1444},
+  {"Anchorage", 2025, 6, 21, 61.2181, -149.9003, SUN_NORMAL, 740, 1903},
+  {"Honolulu", 2024, 2, 10, 21.3069, -157.8583, SUN_NORMAL, 1025, 1707},
+  {"Quito", 2025, 3, 21, -0.1807, -78.4678, SUN_NORMAL, 678, 1404},
+  {"Singapore", 2024, 9, 15, 1.3521, 103.8198, SUN_NORMAL, -64, 663},
+  {"Sydney", 2024, 1, 1, -33.8688, 151.2093, SUN_NORMAL, -313, 549},
+  {"Sydney", 2024, 6, 21, -33.8688, 151.2093, SUN_NORMAL, -180, 414},
+  {"Auckland", 2025, 7, 1, -36.8485, 174.7633, SUN_NORMAL, -265, 315},
+  {"Buenos Aires", 2025, 12, 21, -34.6037, -58.3816, SUN_NORMAL, 517, 1386},
+  {"Cape Town", 2025, 6, 21, -33.9249, 18.4241, SUN_NORMAL, 351, 945},
+  {"Tromso", 2024, 6, 21, 69.6492, 18.9553, SUN_ALWAYS_UP, 0, 0},
+  {"Tromso", 2024, 12, 21, 69.6492, 18.9553, SUN_ALWAYS_DOWN, 0, 0},
+};
+
+int main() {
+  int failed = 0;
+  for (const SunCase& c : CASES) {
+    long days = daysFromCivil(c.year, c.month, c.day);
+    time_t rise = 0, set = 0;
+    SunDay kind = sunTimesUtc(days, c.latitude, c.longitude, rise, set);
+    bool ok = kind == c.kind;
+    int rise_error = 0, set_error = 0;
+    if (ok && kind == SUN_NORMAL) {
+      long midnight = days * 86400;
+      rise_error = (int)lround((rise - midnight) / 60.0) - c.rise_min;
+      set_error = (int)lround((set - midnight) / 60.0) - c.set_min;
+      ok = abs(rise_error) <= TOLERANCE_MIN && abs(set_error) <= TOLERANCE_MIN;
+    }
+    printf("%-13s %04d-%02d-%02d  ", c.place, c.year, c.month, c.day);
+    if (kind != SUN_NORMAL) printf("%-27s", kind == SUN_ALWAYS_UP ? "midnight sun" : "polar night");
+    else printf("rise %+2d min  set %+2d min    ", rise_error, set_error);
+    printf("%s\n", ok ? "ok" : "FAIL");
+    if (!ok) failed++;
+  }
+  printf("%d of %d cases failed\n", failed, (int)(sizeof(CASES) / sizeof(CASES[0])));
+  return failed ? 1 : 0;
+}
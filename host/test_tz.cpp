@@ -0,0 +1,122 @@
+// Checks clock_core.h's POSIX TZ engine against the system's zoneinfo
+// and glibc's own POSIX TZ parser: every 30 minutes from 2023 through
+// 2033, plus the second before each transition, for every entry in the
+// sketch's timezone table.
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "clock_core.h"
+
+// Keep in step with timezones[] in esp_ntp_clock.c
+struct ZoneCase {
+  const char* posix;
+  const char* zoneinfo;
+};
+
+const ZoneCase ZONES[] = {
+  {"EST5EDT,M3.2.0,M11.1.0", "America/New_York"},
+  {"CST6CDT,M3.2.0,M11.1.0", "America/Chicago"},
+  {"MST7MDT,M3.2.0,M11.1.0", "America/Denver"},
+  {"PST8PDT,M3.2.0,M11.1.0", "America/Los_Angeles"},
+  {"AKST9AKDT,M3.2.0,M11.1.0", "America/Anchorage"},
+  {"HST10", "Pacific/Honolulu"},
+  {"MST7", "America/Phoenix"},
+  {"UTC0", "Etc/UTC"},
+  {"NST3:30NDT,M3.2.0,M11.1.0", "America/St_Johns"},
+  {"AST4ADT,M3.2.0,M11.1.0", "America/Halifax"},
+  {"<-03>3", "America/Sao_Paulo"},
+  {"GMT0BST,M3.5.0/1,M10.5.0", "Europe/London"},
+  {"CET-1CEST,M3.5.0,M10.5.0/3", "Europe/Berlin"},
+  {"EET-2EEST,M3.5.0/3,M10.5.0/4", "Europe/Helsinki"},
+  {"MSK-3", "Europe/Moscow"},
+  {"IST-5:30", "Asia/Kolkata"},
+  {"<+0545>-5:45", "Asia/Kathmandu"},
+  {"CST-8", "Asia/Shanghai"},
+  {"JST-9", "Asia/Tokyo"},
+  {"ACST-9:30ACDT,M10.1.0,M4.1.0/3", "Australia/Adelaide"},
+  {"AEST-10", "Australia/Brisbane"},
+  {"AEST-10AEDT,M10.1.0,M4.1.0/3", "Australia/Sydney"},
+  {"NZST-12NZDT,M9.5.0,M4.1.0/3", "Pacific/Auckland"},
+  {"<-04>4<-03>,M9.1.6/24,M4.1.6/24", "America/Santiago"},
+};
+
+const time_t FROM = 1672531200;  // 2023-01-01 00:00 UTC
+const time_t UNTIL = 2019686400; // 2034-01-01 00:00 UTC
+const time_t STEP = 1800;
+
+static bool haveZoneinfo(const char* zone) {
+  char path[96];
+  snprintf(path, sizeof(path), "/usr/share/zoneinfo/%s", zone);
+  return access(path, R_OK) == 0;
+}
+
+// Offsets at every instant of the span as one reference sees them
+static void referenceOffsets(const char* tz, long* offsets, size_t count) {
+  setenv("TZ", tz, 1);
+  tzset();
+  for (size_t i = 0; i < count; i++) {
+    time_t utc = FROM + (time_t)i * STEP;
+    struct tm local;
+    localtime_r(&utc, &local);
+    offsets[i] = local.tm_gmtoff;
+  }
+}
+
+static int compare(const ZoneCase& zone, const char* reference, const char* tz) {
+  TzRule rule;
+  if (!parsePosixTz(zone.posix, rule)) {
+    printf("%-34s parse failed\n", zone.posix);
+    return 1;
+  }
+  size_t count = (UNTIL - FROM) / STEP;
+  long* expected = new long[count];
+  referenceOffsets(tz, expected, count);
+
+  int mismatches = 0;
+  TzWindow window = {0, 0, 0, false};
+  for (size_t i = 0; i < count; i++) {
+    time_t utc = FROM + (time_t)i * STEP;
+    int32_t offset = tzOffset(rule, window, utc);
+    bool ok = offset == expected[i];
+    // Transitions fall on the half hour in every zone here, so the second
+    // before one must still have the old offset
+    if (ok && i > 0 && expected[i] != expected[i - 1]) {
+      TzWindow fresh = {0, 0, 0, false};
+      ok = tzOffset(rule, fresh, utc - 1) == expected[i - 1] && tzOffset(rule, window, utc) == expected[i];
+    }
+    if (!ok && mismatches++ < 3) {
+      char when[32];
+      struct tm t;
+      gmtime_r(&utc, &t);
+      strftime(when, sizeof(when), "%Y-%m-%d %H:%M UTC", &t);
+      printf("%-34s %s: %d, %s says %ld\n", zone.posix, when, (int)offset, reference, expected[i]);
+    }
+  }
+
+  // Random order: the cached window has to move backwards as well
+  srand(1);
+  for (int n = 0; n < 20000; n++) {
+    size_t i = (size_t)rand() % count;
+    time_t utc = FROM + (time_t)i * STEP;
+    if (tzOffset(rule, window, utc) != expected[i] && mismatches++ < 3) {
+      printf("%-34s random lookup at %ld differs from %s\n", zone.posix, (long)utc, reference);
+    }
+  }
+  delete[] expected;
+  return mismatches;
+}
+
+int main() {
+  int failed = 0;
+  for (const ZoneCase& zone : ZONES) {
+    bool have_zoneinfo = haveZoneinfo(zone.zoneinfo);
+    int zoneinfo = have_zoneinfo ? compare(zone, zone.zoneinfo, zone.zoneinfo) : 0;
+    int posix = compare(zone, "glibc", zone.posix);
+    printf("%-34s %-20s %s\n", zone.posix, zone.zoneinfo,
+           zoneinfo + posix ? "FAIL" : have_zoneinfo ? "ok" : "ok (no zoneinfo, POSIX only)");
+    if (zoneinfo + posix) failed++;
+  }
+  printf("%d of %d zones failed\n", failed, (int)(sizeof(ZONES) / sizeof(ZONES[0])));
+  return failed ? 1 : 0;
+}
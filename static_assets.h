@@ -0,0 +1,58 @@
+// Generated by tools/embed_assets.py from assets/ - do not edit.
+#pragma once
+
+struct StaticAsset {
+  const char* path;
+  const char* mime;
+  const char* etag;
+  const uint8_t* data;  // gzip
+  size_t length;
+};
+
+// style.css: 1402 bytes, 608 gzipped
+#define STYLE_CSS_ETAG "18647cb6091d"
+const uint8_t STYLE_CSS_GZ[] PROGMEM = {
+  0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x85, 0x94, 0xc1, 0x8e, 0x9b, 0x30,
+  0x10, 0x86, 0xef, 0xfb, 0x14, 0x91, 0x56, 0x95, 0x5a, 0x29, 0x44, 0x40, 0xc2, 0xaa, 0x35, 0xea,
+  0xa1, 0xcf, 0x51, 0xed, 0x61, 0xc0, 0x63, 0xe2, 0x06, 0x6c, 0x64, 0x9b, 0x86, 0x14, 0xed, 0xbb,
+  0x77, 0x0c, 0x98, 0x85, 0x6c, 0xa4, 0x15, 0xe2, 0x80, 0x3d, 0x9e, 0xf9, 0xfc, 0xcf, 0x3f, 0x14,
+  0x9a, 0xdf, 0x06, 0xa1, 0x95, 0x8b, 0x04, 0x34, 0xb2, 0xbe, 0xb1, 0x5f, 0x46, 0x42, 0xbd, 0xb7,
+  0xa0, 0x6c, 0x64, 0xd1, 0x48, 0x91, 0x37, 0x60, 0x2a, 0xa9, 0x58, 0x9c, 0xb7, 0xc0, 0xb9, 0x54,
+  0x15, 0x4b, 0xe3, 0xb6, 0xcf, 0x0b, 0x28, 0x2f, 0x95, 0xd1, 0x9d, 0xe2, 0xec, 0x39, 0x81, 0x04,
+  0x52, 0xcc, 0x4b, 0x5d, 0x6b, 0xc3, 0x9e, 0x11, 0x31, 0x7f, 0x7b, 0x3a, 0x94, 0x94, 0x13, 0xa4,
+  0x42, 0x33, 0x34, 0xd0, 0x47, 0x57, 0xc9, 0xdd, 0x99, 0x9d, 0x62, 0x7f, 0x34, 0x24, 0xdc, 0x41,
+  0xe7, 0x34, 0x85, 0x9e, 0x93, 0x61, 0x3e, 0x1a, 0x8b, 0x1f, 0xb9, 0xc3, 0xde, 0x45, 0x50, 0xcb,
+  0x4a, 0xb1, 0x12, 0x95, 0x43, 0xe3, 0x23, 0xd2, 0x25, 0xa2, 0x14, 0x79, 0xa1, 0x0d, 0x47, 0x13,
+  0x15, 0xda, 0x39, 0xdd, 0xb0, 0xa4, 0xed, 0x77, 0x56, 0xd7, 0x92, 0xef, 0x9e, 0x8f, 0xc7, 0x63,
+  0x80, 0x5c, 0x76, 0x7d, 0x41, 0x4f, 0x03, 0x86, 0x0f, 0x1b, 0xe6, 0x97, 0x34, 0x39, 0x62, 0xc8,
+  0x65, 0x80, 0xcb, 0xce, 0x4e, 0xd1, 0x9b, 0x6b, 0xce, 0xac, 0x49, 0x46, 0x55, 0x62, 0x8a, 0xee,
+  0x23, 0x7b, 0x06, 0xae, 0xaf, 0x44, 0x7f, 0xa2, 0xa5, 0x17, 0x7a, 0x4d, 0x55, 0xc0, 0xd7, 0x78,
+  0x3f, 0x3e, 0x87, 0xe3, 0x37, 0xaa, 0x56, 0x43, 0x81, 0xf5, 0xc0, 0xa5, 0x6d, 0x6b, 0xb8, 0xb1,
+  0xa2, 0xd6, 0xe5, 0x65, 0x49, 0x14, 0xfb, 0x44, 0x3b, 0x4a, 0x17, 0xe4, 0x02, 0x00, 0x3a, 0x22,
+  0x55, 0xdb, 0xb9, 0xdf, 0xee, 0xd6, 0xe2, 0x4f, 0x2f, 0xc0, 0xeb, 0x7e, 0xb5, 0xd0, 0x82, 0xb5,
+  0x57, 0xe2, 0x7c, 0xdd, 0x5b, 0xac, 0xb1, 0x74, 0xc3, 0x24, 0x66, 0x12, 0xc7, 0x5f, 0x16, 0xd8,
+  0x24, 0x7d, 0x87, 0x1d, 0x59, 0x77, 0x1e, 0x79, 0xbe, 0xde, 0xbd, 0x46, 0xdb, 0x4b, 0x67, 0x77,
+  0xdd, 0x8c, 0x79, 0x52, 0xa4, 0x10, 0xf0, 0x84, 0x10, 0xd3, 0xb5, 0xe5, 0x3f, 0x5f, 0x67, 0xd1,
+  0xbe, 0xdf, 0x42, 0xdb, 0xae, 0x68, 0x24, 0x61, 0x17, 0x1d, 0xc9, 0xae, 0x1e, 0x12, 0x9e, 0xee,
+  0xeb, 0x50, 0xb3, 0x43, 0x57, 0xe3, 0x38, 0xa0, 0x2a, 0xad, 0xf0, 0x01, 0x60, 0xd9, 0x19, 0x4b,
+  0x91, 0xad, 0x96, 0xa3, 0x25, 0x46, 0xc3, 0x12, 0x12, 0xb2, 0x84, 0x5a, 0x30, 0x7d, 0x5e, 0x51,
+  0x56, 0x67, 0x47, 0x84, 0x35, 0xdf, 0xaa, 0xfd, 0x90, 0x94, 0x9d, 0xf5, 0x5f, 0x34, 0x33, 0xef,
+  0xf4, 0x31, 0x6c, 0x55, 0xf0, 0x6d, 0x39, 0x14, 0x4e, 0xd1, 0x18, 0x90, 0x97, 0x39, 0x98, 0xdb,
+  0x36, 0x80, 0x9c, 0x38, 0x07, 0x70, 0x50, 0xd5, 0xdd, 0x71, 0x91, 0x65, 0x6b, 0x05, 0x29, 0x50,
+  0xa1, 0xa3, 0x26, 0x5e, 0x86, 0x47, 0x1d, 0xfb, 0x3e, 0xb9, 0xeb, 0x63, 0x13, 0x3e, 0x15, 0xe2,
+  0x71, 0x83, 0x83, 0xf5, 0x44, 0x8d, 0x7d, 0xfe, 0xa7, 0xb3, 0x4e, 0x8a, 0x5b, 0xe4, 0x07, 0x92,
+  0x06, 0x8a, 0xd9, 0x16, 0x4a, 0x8c, 0x0a, 0xc2, 0x41, 0x54, 0xf9, 0x38, 0x69, 0x91, 0x74, 0xd8,
+  0xd8, 0xf7, 0x79, 0x0b, 0xb0, 0x41, 0x97, 0x89, 0x62, 0x35, 0xa4, 0x14, 0x62, 0xad, 0xe4, 0x91,
+  0x82, 0x06, 0x07, 0x5f, 0x85, 0x25, 0xa3, 0x18, 0x60, 0xec, 0xb0, 0x29, 0xbe, 0x4e, 0xef, 0x17,
+  0x22, 0x54, 0x3c, 0xaf, 0xa0, 0x65, 0xfe, 0xf6, 0xe7, 0xa9, 0x63, 0xe9, 0x3c, 0xa3, 0x74, 0x7a,
+  0x36, 0xce, 0x69, 0xb1, 0xee, 0x32, 0x99, 0x4b, 0xc8, 0x81, 0xec, 0x75, 0x6f, 0xa3, 0xb0, 0x23,
+  0xc4, 0x66, 0xcb, 0x4b, 0x41, 0x5b, 0x52, 0x09, 0xbd, 0x9d, 0x7d, 0x3c, 0x42, 0x26, 0xde, 0x9d,
+  0x99, 0x7d, 0x28, 0x97, 0xad, 0x46, 0x3f, 0x78, 0x68, 0xcc, 0xb3, 0x6b, 0x87, 0xf5, 0x94, 0x8d,
+  0x42, 0x74, 0x65, 0x89, 0xd6, 0x0e, 0x5b, 0x79, 0xd0, 0x18, 0x6d, 0xc2, 0x9a, 0x77, 0xc3, 0xdb,
+  0x13, 0xac, 0x7f, 0x62, 0x6f, 0x4f, 0xff, 0x01, 0x8f, 0x2a, 0x30, 0xcb, 0x7a, 0x05, 0x00, 0x00,
+};
+
+const StaticAsset STATIC_ASSETS[] = {
+  {"/style.css", "text/css", "\"" STYLE_CSS_ETAG "\"", STYLE_CSS_GZ, sizeof(STYLE_CSS_GZ)},
+};
+const int NUM_STATIC_ASSETS = sizeof(STATIC_ASSETS) / sizeof(STATIC_ASSETS[0]);
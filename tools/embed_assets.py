@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+"""Gzip the files in assets/ and write them to static_assets.h as PROGMEM arrays.
+
+Run from the repository root after editing anything in assets/:
+
+    python3 tools/embed_assets.py
+"""
+import gzip
+import hashlib
+import os
+import re
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+ASSET_DIR = os.path.join(ROOT, "assets")
+OUTPUT = os.path.join(ROOT, "static_assets.h")
+
+MIME_TYPES = {
+    ".css": "text/css",
+    ".js": "application/javascript",
+    ".svg": "image/svg+xml",
+    ".html": "text/html; charset=utf-8",
+}
+
+
+def symbol(name):
+    return re.sub(r"[^A-Za-z0-9]", "_", name).upper()
+
+
+def main():
+    out = [
+        "// Generated by tools/embed_assets.py from assets/ - do not edit.",
+        "#pragma once",
+        "",
+        "struct StaticAsset {",
+        "  const char* path;",
+        "  const char* mime;",
+        "  const char* etag;",
+        "  const uint8_t* data;  // gzip",
+        "  size_t length;",
+        "};",
+        "",
+    ]
+    entries = []
+    for name in sorted(os.listdir(ASSET_DIR)):
+        ext = os.path.splitext(name)[1]
+        if ext not in MIME_TYPES:
+            continue
+        with open(os.path.join(ASSET_DIR, name), "rb") as f:
+            raw = f.read()
+        packed = gzip.compress(raw, compresslevel=9, mtime=0)
+        etag = hashlib.sha1(raw).hexdigest()[:12]
+        sym = symbol(name)
+        out.append(f"// {name}: {len(raw)} bytes, {len(packed)} gzipped")
+        out.append(f"#define {sym}_ETAG \"{etag}\"")
+        out.append(f"const uint8_t {sym}_GZ[] PROGMEM = {{")
+        for i in range(0, len(packed), 16):
+            out.append("  " + ", ".join(f"0x{b:02x}" for b in packed[i:i + 16]) + ",")
+        out.append("};")
+        out.append("")
+        entries.append(f"  {{\"/{name}\", \"{MIME_TYPES[ext]}\", \"\\\"\" {sym}_ETAG \"\\\"\", {sym}_GZ, sizeof({sym}_GZ)}},")
+    out.append("const StaticAsset STATIC_ASSETS[] = {")
+    out.extend(entries)
+    out.append("};")
+    out.append("const int NUM_STATIC_ASSETS = sizeof(STATIC_ASSETS) / sizeof(STATIC_ASSETS[0]);")
+    with open(OUTPUT, "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()